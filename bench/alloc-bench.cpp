@@ -0,0 +1,202 @@
+/** \file alloc-bench.cpp
+ *  \brief Heap allocations per job on the client, with and without arena-parsed outputs
+ *
+ * Replaces the global operator new to count allocations in this process.
+ * The StandInServer runs in a child process, so only the client side is counted.
+ * Reports whole round trips (building the request, the I/O thread, parsing the output)
+ * and receiving and parsing the output alone (see Client::SetUseArena()).
+ * Once warmed up, parsing on arenas should only allocate the contents of string fields
+ * too long for std::string's inline buffer (e.g. job_dir), whatever the output size;
+ * fails if it allocates more than that.
+ *
+ * Usage: alloc-bench [jobs] [padding KB] (default: 1000 jobs, no padding)
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <exception>
+using std::exception;
+#include <map>
+using std::map;
+#include <new>
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+
+#include <google/protobuf/message.h>
+
+#include "tcpb/client.h"
+#include "tcpb/input.h"
+#include "tcpb/output.h"
+#include "standin.h"
+
+static std::atomic<long> allocations(0);
+static std::atomic<long> allocatedBytes(0);
+
+void* operator new(size_t size)
+{
+  allocations++;
+  allocatedBytes += size;
+  void *p = malloc(size ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+// String fields too long for std::string's inline buffer, whose contents even an arena keeps on the heap
+static long HeapStrings(const google::protobuf::Message &msg)
+{
+  const google::protobuf::Reflection *reflection = msg.GetReflection();
+  vector<const google::protobuf::FieldDescriptor *> fields;
+  size_t inlineSize = string().capacity();
+  long count = 0;
+
+  reflection->ListFields(msg, &fields);
+  for (size_t i = 0; i < fields.size(); i++) {
+    const google::protobuf::FieldDescriptor *field = fields[i];
+    int n = (field->is_repeated() ? reflection->FieldSize(msg, field) : 1);
+    for (int j = 0; j < n; j++) {
+      if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_STRING) {
+        string value = (field->is_repeated() ? reflection->GetRepeatedString(msg, field, j) :
+          reflection->GetString(msg, field));
+        count += (value.size() > inlineSize ? 1 : 0);
+      } else if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+        count += HeapStrings(field->is_repeated() ? reflection->GetRepeatedMessage(msg, field, j) :
+          reflection->GetMessage(msg, field));
+      }
+    }
+  }
+
+  return count;
+}
+
+// Fork a stand-in server padding its outputs, and wait until it listens
+static pid_t StartServer(const string &path,
+  size_t padding)
+{
+  int ready[2];
+  char byte = 0;
+  if (pipe(ready) != 0) {
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(ready[0]);
+    TCPB::StandInServer server(path, 0, 1);
+    server.SetOutputPadding(padding);
+    if (write(ready[1], &byte, 1) != 1) {
+      _exit(1);
+    }
+    pause();
+    _exit(0);
+  }
+
+  close(ready[1]);
+  if (pid < 0 || read(ready[0], &byte, 1) != 1) {
+    pid = -1;
+  }
+  close(ready[0]);
+  return pid;
+}
+
+int main(int argc, char** argv) {
+  int jobs = (argc > 1 ? atoi(argv[1]) : 1000);
+  long padding = (argc > 2 ? atol(argv[2]) : 0);
+  if (jobs < 1 || padding < 0) {
+    printf("Usage: %s [jobs] [padding KB]\n", argv[0]);
+    return 1;
+  }
+
+  vector<string> atoms = {"O", "H", "H"};
+  map<string, string> options = {{"run", "gradient"}, {"method", "hf"}, {"basis", "sto-3g"}};
+  double geom[9] = {0.0, 0.0, 0.1, 0.0, 1.4, -0.9, 0.0, -1.4, -0.9};
+  TCPB::Input input(atoms, options, geom);
+  string path = "/tmp/tcpb-alloc-bench." + to_string(getpid());
+
+  pid_t server = StartServer(path, (size_t)padding << 10);
+  if (server < 0) {
+    printf("Could not start the stand-in server\n");
+    return 1;
+  }
+
+  int failed = 0;
+  printf("%-10s %16s %16s %16s\n", "outputs", "allocs/job", "KB/job", "parse allocs/job");
+  for (int arena = 0; arena < 2; arena++) {
+    try {
+      TCPB::Client client("unix:" + path, 0);
+      client.SetWaitPolicy(TCPB::WaitPolicy(0, 0));
+      client.SetUseArena(arena);
+
+      // Warm up, so connection setup and first-use caches are not counted
+      for (int i = 0; i < 10; i++) {
+        client.ComputeJobSync(input);
+      }
+
+      // Whole round trips
+      long startCount = allocations;
+      long startBytes = allocatedBytes;
+      for (int i = 0; i < jobs; i++) {
+        TCPB::Output output = client.ComputeJobSync(input);
+      }
+      long roundTrip = allocations - startCount;
+      long roundTripBytes = allocatedBytes - startBytes;
+
+      // Receiving and parsing the output alone, including releasing it
+      long parse = 0;
+      long strings = 0;
+      for (int i = 0; i < jobs; i++) {
+        client.SendJobAsync(input);
+        while (!client.CheckJobComplete()) {
+        }
+        TCPB::Output output;
+        startCount = allocations;
+        output = client.RecvJobAsync();
+        long parsed = allocations - startCount;
+        strings += HeapStrings(output.GetOutputPB());
+        startCount = allocations;
+        output = TCPB::Output();
+        parse += parsed + (allocations - startCount);
+      }
+
+      printf("%-10s %16.1f %16.1f %16.1f\n", (arena ? "arena" : "heap"),
+        (double)roundTrip / jobs, roundTripBytes / 1024.0 / jobs, (double)parse / jobs);
+
+      // Once warmed up, parsing on arenas only allocates for long strings,
+      // however large the output is (the receive buffer may still grow now and then)
+      if (arena && parse > strings + jobs / 10) {
+        printf("Parsing on arenas allocated %ld times in %d jobs, %ld for long strings\n",
+          parse, jobs, strings);
+        failed++;
+      } else if (arena) {
+        printf("Parsing on arenas allocated only for long strings (%.1f per job)\n",
+          (double)strings / jobs);
+      }
+    } catch (const exception &e) {
+      printf("Benchmark failed: %s\n", e.what());
+      failed++;
+    }
+  }
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  unlink(path.c_str());
+  return (failed ? 1 : 0);
+}
@@ -0,0 +1,113 @@
+/** \file api-bench.cpp
+ *  \brief Per-step overhead of the C API (tc_compute_energy_gradient_) against a local StandInServer
+ *
+ * Runs an MD-like loop of energy and gradient steps with a fixed job time on the server,
+ * and reports what each step costs on top of it, status polling granularity included
+ * (see WaitPolicy). Fails if the mean overhead exceeds the limit, which catches
+ * a fixed sleep between steps coming back.
+ *
+ * Usage: api-bench [steps] [job us] [limit ms] (default: 100 steps, 5000 us jobs, 10 ms)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+using std::chrono::duration;
+using std::chrono::steady_clock;
+#include <exception>
+using std::exception;
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+
+#include "tcpb/api.h"
+#include "standin.h"
+
+static const int PORT = 54722;
+
+int main(int argc, char** argv) {
+  int steps = (argc > 1 ? atoi(argv[1]) : 100);
+  long jobTime = (argc > 2 ? atol(argv[2]) : 5000);
+  double limit = (argc > 3 ? atof(argv[3]) : 10.0);
+  if (steps < 1 || jobTime < 0) {
+    printf("Usage: %s [steps] [job us] [limit ms]\n", argv[0]);
+    return 1;
+  }
+
+  // TeraChem input file for tc_setup_
+  char tcfile[256];
+  snprintf(tcfile, sizeof(tcfile), "/tmp/tcpb-api-bench.%d.inp", (int)getpid());
+  FILE *f = fopen(tcfile, "w");
+  if (f == NULL) {
+    printf("Could not write %s\n", tcfile);
+    return 1;
+  }
+  fprintf(f, "basis sto-3g\nmethod rhf\ncharge 0\nspinmult 1\n");
+  fclose(f);
+
+  int status;
+  int numqmatoms = 3;
+  int nummmatoms = 0;
+  int globaltreatment = 0;
+  char host[80] = "localhost";
+  int port = PORT;
+  char qmattypes[3][5] = {"O", "H", "H"};
+  double qmcoords[9] = {0.0, 0.0, 0.1, 0.0, 1.4, -0.9, 0.0, -1.4, -0.9};
+  double qmgrad[9];
+  double energy;
+  vector<double> overheads(steps);
+
+  try {
+    TCPB::StandInServer server(PORT, jobTime);
+
+    tc_connect_(host, &port, &status);
+    if (status != 0) {
+      printf("tc_connect_ failed with status %d\n", status);
+      return 1;
+    }
+    tc_setup_(tcfile, qmattypes, &numqmatoms, &status);
+    unlink(tcfile);
+    if (status != 0) {
+      printf("tc_setup_ failed with status %d\n", status);
+      return 1;
+    }
+
+    for (int i = 0; i < steps; i++) {
+      steady_clock::time_point start = steady_clock::now();
+      tc_compute_energy_gradient_(qmattypes, qmcoords, &numqmatoms, &energy, qmgrad, nullptr,
+        nullptr, &nummmatoms, nullptr, &globaltreatment, &status);
+      if (status != 0) {
+        printf("Step %d failed with status %d\n", i, status);
+        return 1;
+      }
+      overheads[i] = duration<double, std::milli>(steady_clock::now() - start).count() -
+        jobTime / 1000.0;
+      qmcoords[0] += 1.0e-3;
+    }
+    tc_finalize_();
+  } catch (const exception &e) {
+    printf("Benchmark failed: %s\n", e.what());
+    return 1;
+  }
+
+  // The first step pays for the connection setup, report it separately
+  double first = overheads[0];
+  double sum = 0.0;
+  for (int i = 1; i < steps; i++) {
+    sum += overheads[i];
+  }
+  double mean = (steps > 1 ? sum / (steps - 1) : first);
+  std::sort(overheads.begin() + 1, overheads.end());
+  printf("Job time %.3f ms, overhead per step: first %.3f ms, then mean %.3f ms, p50 %.3f ms, "
+    "max %.3f ms\n", jobTime / 1000.0, first, mean, overheads[steps / 2], overheads[steps - 1]);
+
+  if (mean > limit) {
+    printf("Mean overhead above the limit of %.1f ms\n", limit);
+    return 1;
+  }
+  return 0;
+}
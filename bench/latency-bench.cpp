@@ -0,0 +1,183 @@
+/** \file latency-bench.cpp
+ *  \brief Per-job round trip over TCP for small (xTB-sized) jobs, against a local StandInServer
+ *
+ * Compares Client with a minimal client that frames messages the old way:
+ * no TCP_NODELAY, and header and payload in two separate send() calls,
+ * which lets Nagle's algorithm and delayed ACKs hold back the payload.
+ *
+ * Usage: latency-bench [jobs] [atoms] (default: 200 jobs of 30 atoms)
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+using std::chrono::duration;
+using std::chrono::steady_clock;
+#include <exception>
+using std::exception;
+#include <map>
+using std::map;
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+#include "tcpb/client.h"
+#include "tcpb/input.h"
+#include "standin.h"
+using terachem_server::Status;
+
+static const int PORT = 54721;
+
+static bool SendAll(int fd,
+  const char *buf,
+  size_t len)
+{
+  while (len > 0) {
+    ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    buf += sent;
+    len -= sent;
+  }
+  return true;
+}
+
+static bool RecvAll(int fd,
+  char *buf,
+  size_t len)
+{
+  while (len > 0) {
+    ssize_t got = recv(fd, buf, len, 0);
+    if (got <= 0) {
+      return false;
+    }
+    buf += got;
+    len -= got;
+  }
+  return true;
+}
+
+// Header and payload in two send() calls, like Client did before framed sends
+static bool SendTwoCalls(int fd,
+  int type,
+  const string &payload)
+{
+  uint32_t header[2] = {htonl(type), htonl((uint32_t)payload.size())};
+  return SendAll(fd, (const char *)header, sizeof(header)) &&
+    SendAll(fd, payload.data(), payload.size());
+}
+
+static bool Recv(int fd,
+  int &type,
+  string &payload)
+{
+  uint32_t header[2];
+  if (!RecvAll(fd, (char *)header, sizeof(header))) {
+    return false;
+  }
+  type = ntohl(header[0]);
+  payload.resize(ntohl(header[1]));
+  return RecvAll(fd, &payload[0], payload.size());
+}
+
+// One job the old way: submit, poll until completed, read the output
+static bool RunLegacyJob(int fd,
+  const string &job)
+{
+  int type;
+  string reply;
+  Status status;
+
+  if (!SendTwoCalls(fd, terachem_server::JOBINPUT, job) || !Recv(fd, type, reply)) {
+    return false;
+  }
+  do {
+    if (!SendTwoCalls(fd, terachem_server::STATUS, "") || !Recv(fd, type, reply)) {
+      return false;
+    }
+    status.ParseFromString(reply);
+  } while (!status.completed());
+
+  return Recv(fd, type, reply) && type == terachem_server::JOBOUTPUT;
+}
+
+static void PrintLatencies(const char *label,
+  vector<double> &latencies)
+{
+  std::sort(latencies.begin(), latencies.end());
+  double sum = 0.0;
+  for (size_t i = 0; i < latencies.size(); i++) {
+    sum += latencies[i];
+  }
+  printf("%-28s mean %8.3f ms  p50 %8.3f ms  p99 %8.3f ms\n", label,
+    sum / latencies.size(), latencies[latencies.size() / 2],
+    latencies[latencies.size() * 99 / 100]);
+}
+
+int main(int argc, char** argv) {
+  int jobs = (argc > 1 ? atoi(argv[1]) : 200);
+  int natoms = (argc > 2 ? atoi(argv[2]) : 30);
+  if (jobs < 1 || natoms < 1) {
+    printf("Usage: %s [jobs] [atoms]\n", argv[0]);
+    return 1;
+  }
+
+  vector<string> atoms(natoms, "C");
+  vector<double> geom(3 * natoms);
+  for (int i = 0; i < 3 * natoms; i++) {
+    geom[i] = 1.5 * i;
+  }
+  map<string, string> options = {{"run", "gradient"}, {"method", "gfn2xtb"},
+    {"basis", "gfn2xtb"}};
+  TCPB::Input input(atoms, options, geom.data());
+
+  try {
+    TCPB::StandInServer server(PORT);
+    vector<double> latencies(jobs);
+
+    // Legacy framing, Nagle left on
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      printf("Could not connect to the stand-in server\n");
+      return 1;
+    }
+    string job;
+    input.GetPB().SerializeToString(&job);
+    for (int i = 0; i < jobs; i++) {
+      steady_clock::time_point start = steady_clock::now();
+      if (!RunLegacyJob(fd, job)) {
+        printf("Legacy job failed\n");
+        return 1;
+      }
+      latencies[i] = duration<double, std::milli>(steady_clock::now() - start).count();
+    }
+    close(fd);
+    PrintLatencies("two send()s, Nagle on:", latencies);
+
+    // Client: one framed send per message, TCP_NODELAY
+    TCPB::Client client("localhost", PORT);
+    client.SetWaitPolicy(TCPB::WaitPolicy(0, 0));
+    for (int i = 0; i < jobs; i++) {
+      steady_clock::time_point start = steady_clock::now();
+      client.ComputeJobSync(input);
+      latencies[i] = duration<double, std::milli>(steady_clock::now() - start).count();
+    }
+    PrintLatencies("Client, one sendmsg():", latencies);
+  } catch (const exception &e) {
+    printf("Benchmark failed: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
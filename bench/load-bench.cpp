@@ -0,0 +1,147 @@
+/** \file load-bench.cpp
+ *  \brief Synthetic load on a Broker: batch tenants flooding the queue, interactive jobs cutting in
+ *
+ * Two batch tenants with fair-share weights 3 and 1 keep the queue full with priority 0 jobs,
+ * while an interactive client sends a priority 2 job at a fixed interval. The broker runs
+ * in-process in front of local StandInServers. Reports the queue wait per priority class
+ * (Broker::GetWaitStats()), the share each batch tenant got, and the interactive round trip.
+ *
+ * Usage: load-bench [seconds] [servers] [job us] (default: 5 s, 2 servers, 20000 us)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+using std::chrono::duration;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+#include <exception>
+using std::exception;
+#include <map>
+using std::map;
+#include <memory>
+using std::shared_ptr;
+#include <string>
+using std::string;
+using std::to_string;
+#include <thread>
+using std::thread;
+#include <vector>
+using std::vector;
+
+#include "tcpb/broker.h"
+#include "tcpb/client.h"
+#include "tcpb/input.h"
+#include "standin.h"
+
+static const int BASE_PORT = 54740;
+static const int BATCH_CONNECTIONS = 4;
+static const int INTERACTIVE_INTERVAL = 100;
+
+// Input tagged with a priority class and a tenant
+static TCPB::Input TaggedInput(int priority,
+  const string &tenant)
+{
+  vector<string> atoms = {"O", "H", "H"};
+  map<string, string> options = {{"run", "gradient"}, {"method", "hf"}, {"basis", "sto-3g"}};
+  double geom[9] = {0.0, 0.0, 0.1, 0.0, 1.4, -0.9, 0.0, -1.4, -0.9};
+  TCPB::Input input(atoms, options, geom);
+  input.GetMutablePB().set_priority(priority);
+  input.GetMutablePB().set_tenant(tenant);
+  return input;
+}
+
+int main(int argc, char** argv) {
+  int seconds = (argc > 1 ? atoi(argv[1]) : 5);
+  int numServers = (argc > 2 ? atoi(argv[2]) : 2);
+  long jobTime = (argc > 3 ? atol(argv[3]) : 20000);
+  if (seconds < 1 || numServers < 1 || jobTime < 0) {
+    printf("Usage: %s [seconds] [servers] [job us]\n", argv[0]);
+    return 1;
+  }
+
+  string path = "/tmp/tcpb-load-bench." + to_string(getpid());
+  TCPB::WaitPolicy policy(0, 500, 5000);
+  std::atomic<bool> stop(false);
+  std::atomic<long> batchJobs[2];
+  batchJobs[0] = 0;
+  batchJobs[1] = 0;
+  vector<double> interactive;
+
+  try {
+    vector<shared_ptr<TCPB::StandInServer> > servers;
+    vector<TCPB::ClientPool::Endpoint> endpoints;
+    for (int i = 0; i < numServers; i++) {
+      servers.push_back(std::make_shared<TCPB::StandInServer>(BASE_PORT + i, jobTime));
+      endpoints.push_back(TCPB::ClientPool::Endpoint("localhost", BASE_PORT + i));
+    }
+
+    TCPB::SchedulerOptions scheduling(3, 2000);
+    scheduling.weights["batch-a"] = 3.0;
+    scheduling.weights["batch-b"] = 1.0;
+    TCPB::Broker broker(path, endpoints, TCPB::ClientOptions(), 4, scheduling);
+
+    // Batch tenants: every connection submits its next job as soon as the last one is back
+    vector<thread> threads;
+    for (int t = 0; t < 2; t++) {
+      for (int c = 0; c < BATCH_CONNECTIONS; c++) {
+        threads.push_back(thread([&, t] {
+          TCPB::Client client("unix:" + path, 0);
+          client.SetWaitPolicy(policy);
+          TCPB::Input input = TaggedInput(0, (t == 0 ? "batch-a" : "batch-b"));
+          while (!stop) {
+            client.ComputeJobSync(input);
+            batchJobs[t]++;
+          }
+        }));
+      }
+    }
+
+    // Interactive client: one job per interval, timed end to end
+    threads.push_back(thread([&] {
+      TCPB::Client client("unix:" + path, 0);
+      client.SetWaitPolicy(policy);
+      TCPB::Input input = TaggedInput(2, "viz");
+      while (!stop) {
+        steady_clock::time_point start = steady_clock::now();
+        client.ComputeJobSync(input);
+        interactive.push_back(duration<double, std::milli>(steady_clock::now() - start).count());
+        std::this_thread::sleep_until(start + milliseconds(INTERACTIVE_INTERVAL));
+      }
+    }));
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (size_t i = 0; i < threads.size(); i++) {
+      threads[i].join();
+    }
+
+    vector<TCPB::ClassStats> stats = broker.GetWaitStats();
+    printf("Queue wait per class, %d servers, %.0f ms jobs, %d s:\n", numServers,
+      jobTime / 1000.0, seconds);
+    for (size_t c = 0; c < stats.size(); c++) {
+      printf("  class %d: %5ld jobs, wait mean %7.1f ms, p50 %7.1f ms, p99 %7.1f ms, max %7.1f ms\n",
+        (int)c, stats[c].jobs, stats[c].meanWait, stats[c].p50, stats[c].p99, stats[c].maxWait);
+    }
+
+    long total = batchJobs[0] + batchJobs[1];
+    printf("Batch share: batch-a %ld jobs (%.0f%%), batch-b %ld jobs (%.0f%%), weights 3:1\n",
+      (long)batchJobs[0], 100.0 * batchJobs[0] / std::max(total, 1L),
+      (long)batchJobs[1], 100.0 * batchJobs[1] / std::max(total, 1L));
+
+    if (!interactive.empty()) {
+      std::sort(interactive.begin(), interactive.end());
+      printf("Interactive round trip: %d jobs, p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+        (int)interactive.size(), interactive[interactive.size() / 2],
+        interactive[interactive.size() * 99 / 100], interactive.back());
+    }
+  } catch (const exception &e) {
+    printf("Benchmark failed: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,103 @@
+/** \file pool-bench.cpp
+ *  \brief ClientPool throughput as the number of servers grows, against local StandInServers
+ *
+ * Runs the same batch on 1, 2, 4, ... servers with a fixed job time and reports jobs per second
+ * and the scaling efficiency relative to one server. Then checks session affinity:
+ * a CONTINUE trajectory submitted alongside the batch has to stay on one server.
+ *
+ * Usage: pool-bench [jobs] [job us] [max servers] (default: 200 jobs, 20000 us, 8 servers)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+using std::chrono::duration;
+using std::chrono::steady_clock;
+#include <exception>
+using std::exception;
+#include <map>
+using std::map;
+#include <memory>
+using std::shared_ptr;
+#include <set>
+using std::set;
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+#include "tcpb/input.h"
+#include "tcpb/pool.h"
+#include "standin.h"
+
+static const int BASE_PORT = 54730;
+
+int main(int argc, char** argv) {
+  int jobs = (argc > 1 ? atoi(argv[1]) : 200);
+  long jobTime = (argc > 2 ? atol(argv[2]) : 20000);
+  int maxServers = (argc > 3 ? atoi(argv[3]) : 8);
+  if (jobs < 1 || jobTime < 0 || maxServers < 1) {
+    printf("Usage: %s [jobs] [job us] [max servers]\n", argv[0]);
+    return 1;
+  }
+
+  vector<string> atoms = {"O", "H", "H"};
+  map<string, string> options = {{"run", "gradient"}, {"method", "hf"}, {"basis", "sto-3g"}};
+  double geom[9] = {0.0, 0.0, 0.1, 0.0, 1.4, -0.9, 0.0, -1.4, -0.9};
+  TCPB::Input input(atoms, options, geom);
+  vector<TCPB::Input> batch(jobs, input);
+  int failed = 0;
+
+  try {
+    vector<shared_ptr<TCPB::StandInServer> > servers;
+    vector<TCPB::ClientPool::Endpoint> endpoints;
+    for (int i = 0; i < maxServers; i++) {
+      servers.push_back(std::make_shared<TCPB::StandInServer>(BASE_PORT + i, jobTime));
+      endpoints.push_back(TCPB::ClientPool::Endpoint("localhost", BASE_PORT + i));
+    }
+
+    printf("%8s %10s %12s %11s\n", "servers", "time s", "jobs/s", "efficiency");
+    double single = 0.0;
+    for (int n = 1; n <= maxServers; n *= 2) {
+      TCPB::ClientPool pool(vector<TCPB::ClientPool::Endpoint>(endpoints.begin(),
+          endpoints.begin() + n));
+
+      steady_clock::time_point start = steady_clock::now();
+      vector<TCPB::BatchResult> results = pool.ComputeBatch(batch);
+      double elapsed = duration<double>(steady_clock::now() - start).count();
+
+      for (size_t i = 0; i < results.size(); i++) {
+        failed += (results[i].success ? 0 : 1);
+      }
+      double rate = jobs / elapsed;
+      single = (n == 1 ? rate : single);
+      printf("%8d %10.2f %12.1f %10.0f%%\n", n, elapsed, rate, 100.0 * rate / (n * single));
+    }
+
+    // A CONTINUE trajectory next to a batch keeps its server
+    TCPB::ClientPool pool(endpoints);
+    TCPB::Input step(input);
+    step.GetMutablePB().set_md_global_type(terachem_server::JobInput::CONTINUE);
+    set<int> used;
+    vector<TCPB::JobHandle> others;
+    for (int i = 0; i < 20; i++) {
+      others.push_back(pool.Submit(input));
+      pool.Submit(step, 7).Get();
+      used.insert(pool.GetSessionServer(7));
+    }
+    for (size_t i = 0; i < others.size(); i++) {
+      others[i].Get();
+    }
+    printf("CONTINUE trajectory of 20 steps ran on %d server(s)\n", (int)used.size());
+    failed += (used.size() == 1 ? 0 : 1);
+  } catch (const exception &e) {
+    printf("Benchmark failed: %s\n", e.what());
+    return 1;
+  }
+
+  if (failed) {
+    printf("%d failures\n", failed);
+    return 1;
+  }
+  return 0;
+}
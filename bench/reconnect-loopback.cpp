@@ -0,0 +1,102 @@
+/** \file reconnect-loopback.cpp
+ *  \brief Cuts the connection of a job mid-flight and checks that Client recovers it
+ *
+ * The StandInServer closes the connection at a status check of the running job.
+ * When the server keeps the job, the client has to resume it on the new connection,
+ * whether it is still working or already complete. When the server drops it,
+ * the client has to submit it again. Every job's result is checked against the stand-in model,
+ * along with the reconnect, resume and resubmit counts in ClientStats.
+ * Exits with 0 if everything matched.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <exception>
+using std::exception;
+#include <map>
+using std::map;
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+
+#include "tcpb/client.h"
+#include "tcpb/input.h"
+#include "tcpb/output.h"
+#include "standin.h"
+
+static int failures = 0;
+
+static void Check(bool ok,
+  const string &what)
+{
+  if (!ok) {
+    printf("FAILED: %s\n", what.c_str());
+    failures++;
+  }
+}
+
+// Run one gradient job through a cut connection and compare against the stand-in model
+static void CutJob(const string &label,
+  TCPB::StandInServer &server,
+  const string &path,
+  bool keep,
+  int resumes,
+  int resubmits)
+{
+  vector<string> atoms = {"O", "H", "H"};
+  map<string, string> options = {{"run", "gradient"}, {"method", "hf"}, {"basis", "sto-3g"}};
+  vector<double> qm = {0.0, 0.0, 0.1, 0.0, 1.4, -0.9, 0.0, -1.4, -0.9};
+  TCPB::Input input(atoms, options, qm.data());
+
+  TCPB::Client client("unix:" + path, 0);
+  client.SetWaitPolicy(TCPB::WaitPolicy(0, 1000, 1000));
+  int jobs = server.GetJobs();
+  int cuts = server.GetCuts();
+  server.SetKeepJobs(keep);
+  server.CutConnection(0);
+
+  double energy;
+  vector<double> qmGrad(qm.size());
+  TCPB::Output output = client.ComputeJobSync(input);
+  output.GetEnergy(energy);
+  output.GetGradient(qmGrad.data(), nullptr);
+
+  double expected = -1.0;
+  for (size_t i = 0; i < qm.size(); i++) {
+    expected += 0.5 * qm[i] * qm[i];
+    Check(qmGrad[i] == qm[i], label + ": QM gradient " + to_string(i));
+  }
+  Check(fabs(energy - expected) <= 1.0e-12, label + ": energy");
+
+  const TCPB::ClientStats &stats = client.GetStats();
+  Check(server.GetCuts() == cuts + 1, label + ": connection was not cut");
+  Check(stats.reconnects == 1, label + ": " + to_string(stats.reconnects) + " reconnects");
+  Check(stats.resumes == resumes, label + ": " + to_string(stats.resumes) + " resumes");
+  Check(stats.resubmits == resubmits, label + ": " + to_string(stats.resubmits) + " resubmits");
+  Check(server.GetJobs() == jobs + 1, label + ": " + to_string(server.GetJobs() - jobs) +
+    " jobs ran on the server");
+}
+
+int main(int argc, char** argv) {
+  string path = "/tmp/tcpb-reconnect-loopback." + to_string(getpid());
+
+  try {
+    // Long enough that the job is still working when the client is back
+    TCPB::StandInServer slow(path + ".slow", 200000);
+    CutJob("kept, working", slow, path + ".slow", true, 1, 0);
+    CutJob("dropped", slow, path + ".slow", false, 0, 1);
+
+    // No job time: the job completes at the first check on the new connection
+    TCPB::StandInServer fast(path + ".fast");
+    CutJob("kept, complete", fast, path + ".fast", true, 1, 0);
+  } catch (const exception &e) {
+    printf("FAILED: %s\n", e.what());
+    failures++;
+  }
+
+  printf("%s\n", (failures ? "Reconnect loopback FAILED" : "Reconnect loopback passed"));
+  return (failures ? 1 : 0);
+}
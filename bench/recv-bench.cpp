@@ -0,0 +1,121 @@
+/** \file recv-bench.cpp
+ *  \brief Receive time and peak memory for large job outputs (e.g. Hessians or MO vectors)
+ *
+ * Each output size gets a StandInServer in a child process, so only the client side
+ * shows up in the peak RSS. Sizes are in MB and run in increasing order,
+ * since the peak RSS of a process only ever grows.
+ *
+ * Usage: recv-bench [MB ...] (default: 10 100 1000)
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+using std::chrono::duration;
+using std::chrono::steady_clock;
+#include <exception>
+using std::exception;
+#include <map>
+using std::map;
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+
+#include "tcpb/client.h"
+#include "tcpb/input.h"
+#include "tcpb/output.h"
+#include "standin.h"
+
+// Peak resident set size of this process in MB
+static double PeakRSS()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0;
+}
+
+// Fork a stand-in server padding its outputs, and wait until it listens
+static pid_t StartServer(const string &path,
+  size_t padding)
+{
+  int ready[2];
+  char byte = 0;
+  if (pipe(ready) != 0) {
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(ready[0]);
+    TCPB::StandInServer server(path, 0, 1);
+    server.SetOutputPadding(padding);
+    if (write(ready[1], &byte, 1) != 1) {
+      _exit(1);
+    }
+    pause();
+    _exit(0);
+  }
+
+  close(ready[1]);
+  if (pid < 0 || read(ready[0], &byte, 1) != 1) {
+    pid = -1;
+  }
+  close(ready[0]);
+  return pid;
+}
+
+int main(int argc, char** argv) {
+  vector<long> sizes;
+  for (int i = 1; i < argc; i++) {
+    sizes.push_back(atol(argv[i]));
+  }
+  if (sizes.empty()) {
+    sizes = {10, 100, 1000};
+  }
+  std::sort(sizes.begin(), sizes.end());
+
+  vector<string> atoms = {"O", "H", "H"};
+  map<string, string> options = {{"run", "gradient"}, {"method", "hf"}, {"basis", "sto-3g"}};
+  double geom[9] = {0.0, 0.0, 0.1, 0.0, 1.4, -0.9, 0.0, -1.4, -0.9};
+  TCPB::Input input(atoms, options, geom);
+
+  printf("%10s %12s %12s %14s\n", "output MB", "recv ms", "MB/s", "peak RSS MB");
+  for (size_t i = 0; i < sizes.size(); i++) {
+    string path = "/tmp/tcpb-recv-bench." + to_string(getpid()) + "." + to_string(i);
+    pid_t server = StartServer(path, (size_t)sizes[i] << 20);
+    if (server < 0) {
+      printf("Could not start the stand-in server\n");
+      return 1;
+    }
+
+    try {
+      TCPB::Client client("unix:" + path, 0);
+      client.SendJobAsync(input);
+      while (!client.CheckJobComplete()) {
+        usleep(1000);
+      }
+
+      steady_clock::time_point start = steady_clock::now();
+      TCPB::Output output = client.RecvJobAsync();
+      double elapsed = duration<double, std::milli>(steady_clock::now() - start).count();
+
+      double mb = output.GetOutputPB().ByteSizeLong() / 1048576.0;
+      printf("%10.1f %12.1f %12.0f %14.1f\n", mb, elapsed, mb / (elapsed / 1000.0), PeakRSS());
+    } catch (const exception &e) {
+      printf("%10ld failed: %s\n", sizes[i], e.what());
+    }
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    unlink(path.c_str());
+  }
+
+  return 0;
+}
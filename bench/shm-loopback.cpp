@@ -0,0 +1,108 @@
+/** \file shm-loopback.cpp
+ *  \brief Round-trips QM/MM jobs through a local StandInServer, inline and over shared memory
+ *
+ * Checks the energy and both gradients against the stand-in model for every job,
+ * and that the shared memory jobs reached the server through the region.
+ * Exits with 0 if everything matched.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <exception>
+using std::exception;
+#include <map>
+using std::map;
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+
+#include "tcpb/client.h"
+#include "tcpb/input.h"
+#include "tcpb/output.h"
+#include "standin.h"
+
+static int failures = 0;
+
+static void Check(bool ok,
+  const string &what)
+{
+  if (!ok) {
+    printf("FAILED: %s\n", what.c_str());
+    failures++;
+  }
+}
+
+// Run one gradient job with numMM point charges and compare against the stand-in model
+static void RoundTrip(TCPB::Client &client,
+  int numMM,
+  bool async)
+{
+  vector<string> atoms = {"O", "H", "H"};
+  map<string, string> options = {{"run", "gradient"}, {"method", "hf"}, {"basis", "sto-3g"}};
+  vector<double> qm = {0.0, 0.0, 0.1, 0.0, 1.4, -0.9, 0.0, -1.4, -0.9};
+  vector<double> mmPos(3 * numMM), mmCharges(numMM);
+  for (int j = 0; j < numMM; j++) {
+    mmCharges[j] = (j % 2 ? -0.8 : 0.4) + 1.0e-6 * j;
+    for (int k = 0; k < 3; k++) {
+      mmPos[3 * j + k] = 10.0 + 0.01 * j + k;
+    }
+  }
+
+  TCPB::Input input(atoms, options, qm.data(), nullptr, mmPos.data(), mmCharges.data(), numMM);
+  double energy;
+  vector<double> qmGrad(qm.size()), mmGrad(3 * numMM);
+  TCPB::Output output = (async ? client.Submit(input).Get() : client.ComputeJobSync(input));
+  output.GetEnergy(energy);
+  output.GetGradient(qmGrad.data(), mmGrad.data());
+
+  string label = to_string(numMM) + " charges" + (async ? " (Submit)" : "");
+  double expected = -1.0;
+  for (size_t i = 0; i < qm.size(); i++) {
+    expected += 0.5 * qm[i] * qm[i];
+    Check(qmGrad[i] == qm[i], label + ": QM gradient " + to_string(i));
+  }
+  int badMM = 0;
+  for (int j = 0; j < numMM; j++) {
+    for (int k = 0; k < 3; k++) {
+      expected += 0.5 * mmCharges[j] * mmPos[3 * j + k] * mmPos[3 * j + k];
+      badMM += (mmGrad[3 * j + k] != mmCharges[j] * mmPos[3 * j + k]);
+    }
+  }
+  Check(output.GetOutputPB().mmatom_gradient_size() == 3 * numMM, label + ": MM gradient size");
+  Check(badMM == 0, label + ": " + to_string(badMM) + " MM gradient components");
+  Check(fabs(energy - expected) <= 1.0e-9 * fabs(expected), label + ": energy");
+}
+
+int main(int argc, char** argv) {
+  string path = "/tmp/tcpb-shm-loopback." + to_string(getpid());
+
+  try {
+    TCPB::StandInServer server(path);
+    TCPB::Client client("unix:" + path, 0);
+
+    // Inline first, then the same jobs through shared memory, growing the region on the way
+    RoundTrip(client, 1000, false);
+    Check(server.GetSharedMemoryJobs() == 0, "inline job went through shared memory");
+
+    client.SetUseSharedMemory(true);
+    RoundTrip(client, 1000, false);
+    RoundTrip(client, 100000, false);
+    RoundTrip(client, 100000, true);
+    RoundTrip(client, 10, true);
+    Check(server.GetSharedMemoryJobs() == 4, "shared memory jobs seen by the server: " +
+      to_string(server.GetSharedMemoryJobs()) + " of 4");
+
+    client.SetUseSharedMemory(false);
+    RoundTrip(client, 1000, true);
+    Check(server.GetJobs() == 6, "jobs completed: " + to_string(server.GetJobs()) + " of 6");
+  } catch (const exception &e) {
+    printf("FAILED: %s\n", e.what());
+    failures++;
+  }
+
+  printf("%s\n", (failures ? "Shared memory loopback FAILED" : "Shared memory loopback passed"));
+  return (failures ? 1 : 0);
+}
@@ -0,0 +1,271 @@
+/** \file standin.cpp
+ *  \brief Implementation of StandInServer class
+ */
+
+#include <chrono>
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+#include <exception>
+using std::exception;
+#include <mutex>
+using std::lock_guard;
+using std::mutex;
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+
+#include "standin.h"
+using terachem_server::JobInput;
+using terachem_server::JobOutput;
+using terachem_server::Status;
+
+namespace TCPB {
+
+StandInServer::StandInServer(int port,
+  long jobTime,
+  int numWorkers) :
+  EpollServerSocket(port, numWorkers, false),
+  jobTime_(jobTime),
+  padding_(0),
+  owner_(-1),
+  keepJobs_(false),
+  orphaned_(false),
+  cutAfter_(-1),
+  cuts_(0),
+  jobId_(0),
+  shm_(nullptr),
+  jobs_(0),
+  shmJobs_(0),
+  declined_(0)
+{
+  StartEpollLoop(numWorkers);
+}
+
+StandInServer::StandInServer(const string &path,
+  long jobTime,
+  int numWorkers) :
+  EpollServerSocket(path, numWorkers, false),
+  jobTime_(jobTime),
+  padding_(0),
+  owner_(-1),
+  keepJobs_(false),
+  orphaned_(false),
+  cutAfter_(-1),
+  cuts_(0),
+  jobId_(0),
+  shm_(nullptr),
+  jobs_(0),
+  shmJobs_(0),
+  declined_(0)
+{
+  StartEpollLoop(numWorkers);
+}
+
+StandInServer::~StandInServer()
+{
+  Stop();
+  delete shm_;
+}
+
+void StandInServer::SetOutputPadding(size_t bytes)
+{
+  padding_ = bytes;
+}
+
+// Append a base-128 varint, as protobuf encodes tags and lengths
+static void AppendVarint(string &buf,
+  uint64_t value)
+{
+  while (value >= 0x80) {
+    buf.push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  buf.push_back((char)value);
+}
+
+void StandInServer::SetKeepJobs(bool keep)
+{
+  lock_guard<mutex> lock(mutex_);
+  keepJobs_ = keep;
+}
+
+void StandInServer::CutConnection(int checks)
+{
+  lock_guard<mutex> lock(mutex_);
+  cutAfter_ = checks;
+}
+
+int StandInServer::GetCuts()
+{
+  lock_guard<mutex> lock(mutex_);
+  return cuts_;
+}
+
+int StandInServer::GetJobs()
+{
+  lock_guard<mutex> lock(mutex_);
+  return jobs_;
+}
+
+int StandInServer::GetSharedMemoryJobs()
+{
+  lock_guard<mutex> lock(mutex_);
+  return shmJobs_;
+}
+
+int StandInServer::GetDeclined()
+{
+  lock_guard<mutex> lock(mutex_);
+  return declined_;
+}
+
+void StandInServer::RunJob(JobOutput &output)
+{
+  const google::protobuf::RepeatedField<double> &xyz = input_.mol().xyz();
+  double energy = -1.0;
+
+  *output.mutable_mol() = input_.mol();
+  for (int i = 0; i < xyz.size(); i++) {
+    energy += 0.5 * xyz[i] * xyz[i];
+  }
+
+  // MM arrays in shared memory, remapped only when the client moved to a new region
+  const double *pos = input_.mmatom_position().data();
+  const double *charges = input_.mmatom_charge().data();
+  double *grad = nullptr;
+  long numCharges = input_.mmatom_charge_size();
+  if (!input_.shm_name().empty()) {
+    if (shm_ == nullptr || shm_->GetName() != input_.shm_name()) {
+      delete shm_;
+      shm_ = nullptr;
+      shm_ = new SharedMemoryRegion(input_.shm_name());
+    }
+    numCharges = input_.shm_mmatom_charge().size();
+    pos = shm_->GetDoubles(input_.shm_mmatom_position().offset(), 3 * numCharges);
+    charges = shm_->GetDoubles(input_.shm_mmatom_charge().offset(), numCharges);
+    if (input_.run() != JobInput::ENERGY) {
+      grad = shm_->GetDoubles(input_.shm_mmatom_gradient().offset(), 3 * numCharges);
+      output.mutable_shm_mmatom_gradient()->set_offset(input_.shm_mmatom_gradient().offset());
+      output.mutable_shm_mmatom_gradient()->set_size(3 * numCharges);
+    }
+  } else if (input_.run() != JobInput::ENERGY) {
+    output.mutable_mmatom_gradient()->Resize(3 * numCharges, 0.0);
+    grad = output.mutable_mmatom_gradient()->mutable_data();
+  }
+
+  for (long j = 0; j < numCharges; j++) {
+    for (int k = 0; k < 3; k++) {
+      energy += 0.5 * charges[j] * pos[3 * j + k] * pos[3 * j + k];
+      if (grad != nullptr) {
+        grad[3 * j + k] = charges[j] * pos[3 * j + k];
+      }
+    }
+  }
+
+  output.add_energy(energy);
+  if (input_.run() != JobInput::ENERGY) {
+    output.mutable_gradient()->CopyFrom(xyz);
+  }
+
+  string jobDir = "standin/" + to_string(jobId_);
+  output.set_job_dir(jobDir);
+  output.set_job_scr_dir(jobDir + "/scr");
+  output.set_server_job_id(jobId_);
+  output.set_orb1afile(jobDir + "/scr/c0");
+}
+
+bool StandInServer::HandleClientMessage(int connId,
+  const FramedMessage &request,
+  vector<FramedMessage> &replies)
+{
+  Status status;
+  JobOutput output;
+  bool completed = false;
+  string msg;
+
+  if (request.type == terachem_server::JOBINPUT) {
+    lock_guard<mutex> lock(mutex_);
+    if (owner_ >= 0) {
+      status.set_busy(true);
+      declined_++;
+    } else if (!input_.ParseFromString(request.payload)) {
+      SocketLog("Could not parse job input from connection %d", connId);
+      return false;
+    } else {
+      owner_ = connId;
+      start_ = steady_clock::now();
+      status.set_accepted(true);
+      status.set_server_job_id(++jobId_);
+      status.set_job_dir("standin/" + to_string(jobId_));
+    }
+  } else if (request.type == terachem_server::STATUS) {
+    lock_guard<mutex> lock(mutex_);
+    if (orphaned_) {
+      // A job kept from a closed connection goes to the first one that asks
+      owner_ = connId;
+      orphaned_ = false;
+    } else if (owner_ == connId && cutAfter_ >= 0 && cutAfter_-- == 0) {
+      // Let go of the job right away, the client may be back before the close is handled
+      cuts_++;
+      orphaned_ = keepJobs_;
+      owner_ = (keepJobs_ ? owner_ : -1);
+      return false;
+    }
+
+    if (owner_ != connId) {
+      // Some other client's job, or none at all
+      status.set_busy(owner_ >= 0);
+    } else if (duration_cast<microseconds>(steady_clock::now() - start_).count() < jobTime_) {
+      status.set_busy(true);
+      status.set_working(true);
+      status.set_server_job_id(jobId_);
+    } else {
+      owner_ = -1;
+      try {
+        RunJob(output);
+      } catch (const exception &e) {
+        SocketLog("Job %d of connection %d failed: %s", jobId_, connId, e.what());
+        return false;
+      }
+      jobs_++;
+      shmJobs_ += (input_.shm_name().empty() ? 0 : 1);
+      status.set_completed(true);
+      status.set_server_job_id(jobId_);
+      completed = true;
+    }
+  } else {
+    SocketLog("Unexpected message type %d from connection %d", request.type, connId);
+    return false;
+  }
+
+  status.SerializeToString(&msg);
+  replies.push_back(FramedMessage(terachem_server::STATUS, msg));
+  if (completed) {
+    output.SerializeToString(&msg);
+
+    // Packed repeated float field, which a parser merges with the rest of the message
+    size_t padding = (padding_ + sizeof(float) - 1) / sizeof(float) * sizeof(float);
+    if (padding > 0) {
+      AppendVarint(msg, (JobOutput::kCompressedHessianFieldNumber << 3) | 2);
+      AppendVarint(msg, padding);
+      msg.append(padding, '\0');
+    }
+    replies.push_back(FramedMessage(terachem_server::JOBOUTPUT, msg));
+  }
+
+  return true;
+}
+
+void StandInServer::HandleClientDisconnect(int connId)
+{
+  lock_guard<mutex> lock(mutex_);
+  if (owner_ == connId) {
+    orphaned_ = keepJobs_;
+    owner_ = (keepJobs_ ? owner_ : -1);
+  }
+}
+
+} // end namespace TCPB
@@ -0,0 +1,167 @@
+/** \file standin.h
+ *  \brief Definition of StandInServer class
+ */
+
+#ifndef TCPB_STANDIN_H_
+#define TCPB_STANDIN_H_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tcpb/shm.h"
+#include "tcpb/socket.h"
+#include "tcpb/terachem_server.pb.h"
+
+namespace TCPB {
+
+/**
+ * \brief Local stand-in for a TeraChem server, for tests and benchmarks without TeraChem
+ *
+ * Speaks TCPB like a server does: it runs one job at a time and declines others as busy,
+ * reports a job as working until jobTime has passed, and hands out the output with
+ * the completed status. Instead of quantum chemistry it evaluates a harmonic model
+ * that is cheap and easy to check,
+ *
+ *   E = -1 + 1/2 sum_i x_i^2 + 1/2 sum_j q_j |r_j|^2,  dE/dx_i = x_i,  dE/dr_j = q_j r_j
+ *
+ * with x the QM coordinates, r_j and q_j the MM positions and charges, all in the units given.
+ * The MM arrays may come inline or in the shared memory region named by the job (shm_name),
+ * in which case the MM gradient is written back to the region, as TeraChem would.
+ **/
+class StandInServer : public EpollServerSocket {
+public:
+  /**
+   * \brief Constructor for StandInServer class
+   *
+   * @param port Port to listen on
+   * @param jobTime Microseconds each job takes (default: 0)
+   * @param numWorkers Number of threads handling client messages (default: 4)
+   **/
+  StandInServer(int port,
+    long jobTime = 0,
+    int numWorkers = 4);
+
+  /**
+   * \brief Constructor for StandInServer class on a Unix domain socket
+   *
+   * @param path Filesystem path of the socket to listen on
+   * @param jobTime Microseconds each job takes (default: 0)
+   * @param numWorkers Number of threads handling client messages (default: 4)
+   **/
+  StandInServer(const std::string &path,
+    long jobTime = 0,
+    int numWorkers = 4);
+
+  /**
+   * \brief Destructor for StandInServer class
+   **/
+  ~StandInServer();
+
+  /**
+   * \brief Pad every job output, to benchmark large messages (e.g. Hessians or MO vectors)
+   *
+   * The padding goes into compressed_hessian as zeros, appended to the serialized output
+   * without building it as a protobuf first.
+   *
+   * @param bytes Extra bytes per job output, rounded up to whole floats (0 for none)
+   **/
+  void SetOutputPadding(size_t bytes);
+
+  /**
+   * \brief Keep running the job of a closed connection, for the next connection to pick up
+   *
+   * By default a closed connection takes its job with it. With jobs kept, the first status
+   * message from another connection adopts the job, so a reconnecting client can resume it.
+   *
+   * @param keep Whether jobs outlive their connection
+   **/
+  void SetKeepJobs(bool keep);
+
+  /**
+   * \brief Close the connection of the running job at one of its status checks, once
+   *
+   * The connection is closed instead of answering, as if it had dropped mid-job.
+   * With no job time, the job is only complete at the check after that.
+   *
+   * @param checks Status checks of the owning connection to answer before closing it (0 for the next one)
+   **/
+  void CutConnection(int checks);
+
+  /**
+   * \brief Get the number of connections closed by CutConnection()
+   *
+   * @return Connections cut
+   **/
+  int GetCuts();
+
+  /**
+   * \brief Get the number of jobs handed back so far
+   *
+   * @return Completed jobs
+   **/
+  int GetJobs();
+
+  /**
+   * \brief Get the number of completed jobs whose MM arrays came through shared memory
+   *
+   * @return Completed shared memory jobs
+   **/
+  int GetSharedMemoryJobs();
+
+  /**
+   * \brief Get the number of job submissions declined because a job was running
+   *
+   * @return Busy replies to job inputs
+   **/
+  int GetDeclined();
+
+private:
+  long jobTime_;                            //!< Microseconds each job takes
+  std::atomic<size_t> padding_;             //!< Extra bytes of compressed_hessian per job output
+  std::mutex mutex_;                        //!< Guards everything below
+  int owner_;                               //!< Connection of the running job, or -1
+  bool keepJobs_;                           //!< Whether a job outlives its connection
+  bool orphaned_;                           //!< The running job lost its connection and waits to be adopted
+  int cutAfter_;                            //!< Status checks to answer before cutting the connection, or -1
+  int cuts_;                                //!< Connections cut
+  int jobId_;                               //!< Id of the last accepted job
+  std::chrono::steady_clock::time_point start_; //!< When the running job was accepted
+  terachem_server::JobInput input_;         //!< Input of the running job
+  SharedMemoryRegion *shm_;                 //!< Last region named by a job, kept mapped
+  int jobs_;                                //!< Completed jobs
+  int shmJobs_;                             //!< Completed jobs with MM arrays in shared memory
+  int declined_;                            //!< Job inputs declined as busy
+
+  /**
+   * \brief Evaluate the model for the running job (mutex_ held)
+   *
+   * @param output Job output to fill in
+   **/
+  void RunJob(terachem_server::JobOutput &output);
+
+  /**
+   * \brief Reply to a job input or status message
+   *
+   * @param connId Id of the connection that sent the message
+   * @param request Complete incoming message
+   * @param replies Status message, and job output for a completed job
+   * @return False to close the connection (unexpected or unparsable messages)
+   **/
+  virtual bool HandleClientMessage(int connId,
+    const FramedMessage &request,
+    std::vector<FramedMessage> &replies);
+
+  /**
+   * \brief Drop the job of a closed connection, freeing the server, unless jobs are kept
+   *
+   * @param connId Id of the closed connection
+   **/
+  virtual void HandleClientDisconnect(int connId);
+}; // end class StandInServer
+
+} // end namespace TCPB
+
+#endif
@@ -0,0 +1,87 @@
+/** \file tcpb-standin.cpp
+ *  \brief TeraChem stand-in daemon: answers TCPB jobs with a cheap model, for tests without TeraChem
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <exception>
+using std::exception;
+#include <string>
+using std::string;
+
+#include "standin.h"
+
+static void PrintUsage(const char *prog)
+{
+  printf("Usage: %s [options] <listen>\n", prog);
+  printf("  listen         Port, or unix:/path, to accept TCPB clients on\n");
+  printf("  -j us          Microseconds each job takes (default: 0)\n");
+  printf("  -w workers     Threads handling client messages (default: 4)\n");
+  printf("Send SIGUSR1 to print the job counts.\n");
+}
+
+static void PrintJobStats(TCPB::StandInServer &server)
+{
+  printf("Jobs: %d (shared memory: %d), declined as busy: %d\n", server.GetJobs(),
+    server.GetSharedMemoryJobs(), server.GetDeclined());
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  long jobTime = 0;
+  int numWorkers = 4;
+  int arg = 1;
+
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    if (strcmp(argv[arg], "-j") == 0) {
+      jobTime = atol(argv[arg + 1]);
+    } else if (strcmp(argv[arg], "-w") == 0) {
+      numWorkers = atoi(argv[arg + 1]);
+    } else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - arg != 1) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  string listen(argv[arg]);
+
+  // Block the shutdown signals before any thread starts, so they all come to sigwait() below
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  TCPB::StandInServer *server;
+  try {
+    if (listen.compare(0, 5, "unix:") == 0) {
+      server = new TCPB::StandInServer(listen.substr(5), jobTime, numWorkers);
+    } else {
+      server = new TCPB::StandInServer(atoi(listen.c_str()), jobTime, numWorkers);
+    }
+  } catch (const exception &e) {
+    printf("Could not start the stand-in server: %s\n", e.what());
+    return 1;
+  }
+
+  printf("Answering TCPB jobs on %s\n", listen.c_str());
+  fflush(stdout);
+
+  int sig;
+  while (sigwait(&signals, &sig) == 0 && sig == SIGUSR1) {
+    PrintJobStats(*server);
+  }
+
+  printf("Shutting down\n");
+  PrintJobStats(*server);
+  delete server;
+
+  return 0;
+}
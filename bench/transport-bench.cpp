@@ -0,0 +1,97 @@
+/** \file transport-bench.cpp
+ *  \brief Round-trip latency over loopback TCP and Unix domain sockets at several payload sizes
+ *
+ * Every job carries a number of MM point charges (32 bytes each on the way in, 24 on the way out)
+ * and goes to an instant StandInServer, so the time is all transport and serialization.
+ *
+ * Usage: transport-bench [reps] [charges ...] (default: 50 reps of 0 1000 10000 100000 charges)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+using std::chrono::duration;
+using std::chrono::steady_clock;
+#include <exception>
+using std::exception;
+#include <map>
+using std::map;
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+
+#include "tcpb/client.h"
+#include "tcpb/input.h"
+#include "standin.h"
+
+static const int PORT = 54723;
+
+// Median round trip in milliseconds
+static double MedianRoundTrip(TCPB::Client &client,
+  const TCPB::Input &input,
+  int reps)
+{
+  vector<double> times(reps);
+  client.ComputeJobSync(input);
+  for (int i = 0; i < reps; i++) {
+    steady_clock::time_point start = steady_clock::now();
+    client.ComputeJobSync(input);
+    times[i] = duration<double, std::milli>(steady_clock::now() - start).count();
+  }
+  std::sort(times.begin(), times.end());
+  return times[reps / 2];
+}
+
+int main(int argc, char** argv) {
+  int reps = (argc > 1 ? atoi(argv[1]) : 50);
+  vector<int> sizes;
+  for (int i = 2; i < argc; i++) {
+    sizes.push_back(atoi(argv[i]));
+  }
+  if (sizes.empty()) {
+    sizes = {0, 1000, 10000, 100000};
+  }
+  if (reps < 1) {
+    printf("Usage: %s [reps] [charges ...]\n", argv[0]);
+    return 1;
+  }
+
+  vector<string> atoms = {"O", "H", "H"};
+  map<string, string> options = {{"run", "gradient"}, {"method", "hf"}, {"basis", "sto-3g"}};
+  double geom[9] = {0.0, 0.0, 0.1, 0.0, 1.4, -0.9, 0.0, -1.4, -0.9};
+  string path = "/tmp/tcpb-transport-bench." + to_string(getpid());
+
+  try {
+    TCPB::StandInServer tcpServer(PORT);
+    TCPB::StandInServer unixServer(path);
+    TCPB::Client tcp("localhost", PORT);
+    TCPB::Client uds("unix:" + path, 0);
+    tcp.SetWaitPolicy(TCPB::WaitPolicy(0, 0));
+    uds.SetWaitPolicy(TCPB::WaitPolicy(0, 0));
+
+    printf("%10s %12s %12s %12s %8s\n", "charges", "in KB", "TCP ms", "UDS ms", "speedup");
+    for (size_t i = 0; i < sizes.size(); i++) {
+      int n = sizes[i];
+      vector<double> pos(3 * n), charges(n);
+      for (int j = 0; j < n; j++) {
+        charges[j] = (j % 2 ? -0.8 : 0.4);
+        pos[3 * j] = pos[3 * j + 1] = pos[3 * j + 2] = 10.0 + 0.01 * j;
+      }
+      TCPB::Input input(atoms, options, geom, nullptr, pos.data(), charges.data(), n);
+
+      double tcpTime = MedianRoundTrip(tcp, input, reps);
+      double udsTime = MedianRoundTrip(uds, input, reps);
+      printf("%10d %12.1f %12.3f %12.3f %8.2f\n", n, input.GetPB().ByteSizeLong() / 1024.0,
+        tcpTime, udsTime, tcpTime / udsTime);
+    }
+  } catch (const exception &e) {
+    printf("Benchmark failed: %s\n", e.what());
+    return 1;
+  }
+
+  return 0;
+}
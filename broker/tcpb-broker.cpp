@@ -0,0 +1,134 @@
+/** \file tcpb-broker.cpp
+ *  \brief TCPB broker daemon: queues client jobs and forwards them to a pool of TeraChem servers
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <exception>
+using std::exception;
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+#include "tcpb/broker.h"
+
+static void PrintUsage(const char *prog)
+{
+  printf("Usage: %s [options] <listen> <server> [<server> ...]\n", prog);
+  printf("  listen         Port, or unix:/path, to accept TCPB clients on\n");
+  printf("  server         TeraChem server as host:port, or unix:/path\n");
+  printf("  -w workers     Threads handling client messages (default: 4)\n");
+  printf("  -m MB          Largest client message accepted (default: %d)\n",
+    (int)(DEFAULT_MAX_MESSAGE_SIZE >> 20));
+  printf("  -c classes     Priority classes (default: 3)\n");
+  printf("  -a ms          Wait that raises a job by one class, 0 for none (default: 30000)\n");
+  printf("  -t name=weight Positive fair-share weight of a tenant (default: 1), may be repeated\n");
+  printf("Send SIGUSR1 to print the queue wait statistics.\n");
+}
+
+static void PrintWaitStats(TCPB::Broker &broker)
+{
+  std::vector<TCPB::ClassStats> stats = broker.GetWaitStats();
+
+  printf("Queued: %d, running: %d\n", broker.GetQueueLength(), broker.GetRunning());
+  for (size_t c = 0; c < stats.size(); c++) {
+    printf("  class %d: %ld jobs, wait mean %.1f ms, p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+      (int)c, stats[c].jobs, stats[c].meanWait, stats[c].p50, stats[c].p99, stats[c].maxWait);
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  int numWorkers = 4;
+  long maxMessage = DEFAULT_MAX_MESSAGE_SIZE >> 20;
+  TCPB::SchedulerOptions scheduling;
+  int arg = 1;
+
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    string value(argv[arg + 1]);
+    size_t equals = value.find('=');
+    if (strcmp(argv[arg], "-w") == 0) {
+      numWorkers = atoi(value.c_str());
+    } else if (strcmp(argv[arg], "-m") == 0 && atol(value.c_str()) > 0) {
+      maxMessage = atol(value.c_str());
+    } else if (strcmp(argv[arg], "-c") == 0) {
+      scheduling.numClasses = atoi(value.c_str());
+    } else if (strcmp(argv[arg], "-a") == 0) {
+      scheduling.agingInterval = atoi(value.c_str());
+    } else if (strcmp(argv[arg], "-t") == 0 && equals != string::npos) {
+      // atof() would turn a typo into weight 0
+      char *end;
+      double weight = strtod(value.c_str() + equals + 1, &end);
+      if (end == value.c_str() + equals + 1 || *end != '\0' || !(weight > 0.0)) {
+        printf("Bad tenant weight: %s\n", value.c_str());
+        PrintUsage(argv[0]);
+        return 1;
+      }
+      scheduling.weights[value.substr(0, equals)] = weight;
+    } else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - arg < 2) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  string listen(argv[arg++]);
+  vector<TCPB::ClientPool::Endpoint> servers;
+  for (; arg < argc; arg++) {
+    string server(argv[arg]);
+    size_t colon = server.rfind(':');
+    if (server.compare(0, 5, "unix:") == 0) {
+      servers.push_back(TCPB::ClientPool::Endpoint(server, 0));
+    } else if (colon != string::npos) {
+      servers.push_back(TCPB::ClientPool::Endpoint(server.substr(0, colon),
+        atoi(server.c_str() + colon + 1)));
+    } else {
+      printf("Bad server address: %s\n", server.c_str());
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  // Block the shutdown signals before any thread starts, so they all come to sigwait() below
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  TCPB::Broker *broker;
+  try {
+    if (listen.compare(0, 5, "unix:") == 0) {
+      broker = new TCPB::Broker(listen.substr(5), servers, TCPB::ClientOptions(), numWorkers,
+        scheduling);
+    } else {
+      broker = new TCPB::Broker(atoi(listen.c_str()), servers, TCPB::ClientOptions(), numWorkers,
+        scheduling);
+    }
+  } catch (const exception &e) {
+    printf("Could not start the broker: %s\n", e.what());
+    return 1;
+  }
+
+  broker->SetMaxMessageSize((size_t)maxMessage << 20);
+
+  printf("Forwarding jobs from %s to %d servers\n", listen.c_str(), (int)servers.size());
+
+  int sig;
+  while (sigwait(&signals, &sig) == 0 && sig == SIGUSR1) {
+    PrintWaitStats(*broker);
+  }
+
+  printf("Shutting down\n");
+  PrintWaitStats(*broker);
+  delete broker;
+
+  return 0;
+}
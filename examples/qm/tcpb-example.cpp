@@ -10,7 +10,6 @@ using std::map;
 using std::string;
 #include <vector>
 using std::vector;
-#include <unistd.h>
 
 #include "tcpb/client.h"
 #include "tcpb/input.h"
@@ -69,9 +68,6 @@ int main(int argc, char** argv) {
   energy = 0.0;
   memset(grad, 0.0, 3*num_atoms*sizeof(double));
 
-  // Sleep a bit to ensure the server will receive the next ComputeGradient call
-  usleep(100000);
-
   const TCPB::Output output2 = TC.ComputeGradient(input2, energy, grad);
 
   printf("From ComputeGradient 'input2' call:\n");
@@ -10,7 +10,6 @@ using std::map;
 using std::string;
 #include <vector>
 using std::vector;
-#include <unistd.h>
 
 #include "tcpb/client.h"
 #include "tcpb/input.h"
@@ -147,9 +146,6 @@ int main(int argc, char** argv) {
 
   printf("Debug protobuf 2nd input string:\n%s\n", input.GetDebugString().c_str());
 
-  // Sleep a bit to ensure the server will receive the next ComputeGradient call
-  usleep(100000);
-
   output = TC->ComputeGradient(input, energy, qmgrad, mmgrad);
 
   printf("Debug protobuf 2nd output string:\n%s\n", output.GetDebugString().c_str());
@@ -190,9 +186,6 @@ int main(int argc, char** argv) {
 
   printf("Debug protobuf 3rd input string:\n%s\n", input.GetDebugString().c_str());
 
-  // Sleep a bit to ensure the server will receive the next ComputeGradient call
-  usleep(100000);
-
   output = TC->ComputeGradient(input, energy, qmgrad, mmgrad);
 
   printf("Debug protobuf 3rd output string:\n%s\n", output.GetDebugString().c_str());
@@ -293,9 +286,6 @@ int main(int argc, char** argv) {
 
   printf("Debug protobuf 4th input string:\n%s\n", input.GetDebugString().c_str());
 
-  // Sleep a bit to ensure the server will receive the next ComputeGradient call
-  usleep(100000);
-
   output = TC->ComputeGradient(input, energy, qmgrad, mmgrad);
 
   printf("Debug protobuf 4th output string:\n%s\n", output.GetDebugString().c_str());
@@ -0,0 +1,76 @@
+"""
+NumPy bindings for libtcpb through the compiled _pytcpb extension
+
+Coordinates and charges are handed to libtcpb as they are when they already are contiguous
+float64 arrays, and gradients and charges come back as NumPy arrays written in place by libtcpb.
+The GIL is released while waiting on the server, so threads driving different sessions
+run concurrently.
+"""
+import numpy
+
+from . import _pytcpb
+
+def _as_doubles(values):
+    # No copy for a contiguous float64 array, whatever its shape
+    return numpy.ascontiguousarray(values, dtype=numpy.float64).reshape(-1)
+
+def connect(host,port):
+    """
+    Python version of function tc_connect from libtcpb.so
+    """
+    return _pytcpb.connect(host,port)
+
+def setup(tcfile,qmattypes,session=0):
+    """
+    Python version of function tc_setup (or tc_session_setup, for a session other than 0) from libtcpb.so
+    """
+    return _pytcpb.setup(session,tcfile,list(qmattypes))
+
+def compute_energy_gradient(qmattypes,qmcoords,mmcoords=[],mmcharges=[],globaltreatment=0,session=0):
+    """
+    Python version of function tc_compute_energy_gradient (or tc_session_compute_energy_gradient,
+    for a session other than 0) from libtcpb.so
+
+    Coordinates may be flat or (N,3) arrays. Returns the energy, the QM and MM gradients
+    as flat NumPy arrays, and the status.
+    """
+    qmattypes = list(qmattypes)
+    numqmatoms = len(qmattypes)
+    qmcoords = _as_doubles(qmcoords)
+    mmcoords = _as_doubles(mmcoords)
+    nummmatoms = int(len(mmcoords)/3)
+    mmcharges = _as_doubles(mmcharges) if len(mmcharges) > 0 else None
+    if (len(qmcoords)!=3*numqmatoms or (mmcharges is not None and len(mmcharges)!=nummmatoms) or globaltreatment<0 or globaltreatment>2):
+        return 1
+    qmgrad = numpy.empty(3*numqmatoms)
+    mmgrad = numpy.empty(3*nummmatoms)
+    energy, status = _pytcpb.compute_energy_gradient(session,qmattypes,qmcoords,mmcoords if nummmatoms > 0 else None,
+                                                     mmcharges if nummmatoms > 0 else None,globaltreatment,qmgrad,
+                                                     mmgrad if nummmatoms > 0 else None)
+    return energy, qmgrad, mmgrad, status
+
+def get_qm_charges(numqmatoms,session=0):
+    """
+    Python version of function tc_get_qm_charges (or tc_session_get_qm_charges, for a session other than 0) from libtcpb.so
+    """
+    qmcharges = numpy.empty(numqmatoms)
+    status = _pytcpb.get_qm_charges(session,qmcharges)
+    return qmcharges, status
+
+def finalize():
+    """
+    Python version of function tc_finalize from libtcpb.so
+    """
+    _pytcpb.finalize()
+
+def session_create(host,port):
+    """
+    Python version of function tc_session_create from libtcpb.so
+    """
+    return _pytcpb.session_create(host,port)
+
+def session_destroy(session):
+    """
+    Python version of function tc_session_destroy from libtcpb.so
+    """
+    _pytcpb.session_destroy(session)
@@ -0,0 +1,291 @@
+/** \file _pytcpb.cpp
+ *  \brief Native Python bindings for the TCPB-cpp C API
+ *
+ * Arrays are passed through the buffer protocol, so NumPy arrays (or any other C-contiguous
+ * float64 buffer) go to libtcpb without element-wise copies, and results are written straight
+ * into arrays allocated by the caller. The GIL is released during every call to libtcpb,
+ * so Python threads driving different sessions run concurrently.
+ *
+ * Session 0 stands for the default session of the original tc_* functions.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string.h>
+#include <vector>
+using std::vector;
+
+#include "api.h"
+
+// Holds a borrowed buffer and releases it on scope exit (the GIL is held again by then)
+struct Buffer {
+  Py_buffer view;
+  bool held;
+
+  Buffer() : held(false) {}
+
+  ~Buffer() {
+    if (held)
+      PyBuffer_Release(&view);
+  }
+
+  double* data() const {
+    return (held ? (double*)view.buf : NULL);
+  }
+
+  Py_ssize_t size() const {
+    return (held ? view.len / (Py_ssize_t)sizeof(double) : 0);
+  }
+};
+
+// Borrows a C-contiguous float64 buffer (None is allowed and leaves buf empty)
+static bool GetDoubles(PyObject* obj, Buffer &buf, bool writable, const char* name) {
+  if (obj == NULL || obj == Py_None)
+    return true;
+  int flags = PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0);
+  if (PyObject_GetBuffer(obj, &buf.view, flags) != 0)
+    return false;
+  buf.held = true;
+  const char* format = (buf.view.format != NULL ? buf.view.format : "B");
+  if (buf.view.itemsize != sizeof(double) || (strcmp(format, "d") && strcmp(format, "@d") &&
+      strcmp(format, "=d") && strcmp(format, "<d"))) {
+    PyErr_Format(PyExc_TypeError, "%s must be a contiguous float64 array", name);
+    return false;
+  }
+  return true;
+}
+
+// Copies a sequence of atom symbols into the Fortran-style char[n][5] layout
+static bool GetAtomTypes(PyObject* obj, vector<char> &types, int &numatoms) {
+  PyObject* seq = PySequence_Fast(obj, "qmattypes must be a sequence of strings");
+  if (seq == NULL)
+    return false;
+  numatoms = (int)PySequence_Fast_GET_SIZE(seq);
+  types.assign(5 * (numatoms > 0 ? numatoms : 1), '\0');
+  for (int i = 0; i < numatoms; i++) {
+    PyObject* item = PySequence_Fast_GET_ITEM(seq, i);
+#if PY_MAJOR_VERSION >= 3
+    const char* symbol = PyUnicode_AsUTF8(item);
+#else
+    const char* symbol = PyString_AsString(item);
+#endif
+    if (symbol == NULL) {
+      Py_DECREF(seq);
+      return false;
+    }
+    strncpy(&types[5*i], symbol, 4);
+  }
+  Py_DECREF(seq);
+  return true;
+}
+
+static PyObject* py_connect(PyObject* self, PyObject* args) {
+  const char* host;
+  int port, status;
+  char bhost[80];
+  if (!PyArg_ParseTuple(args, "si", &host, &port))
+    return NULL;
+  memset(bhost, 0, sizeof(bhost));
+  strncpy(bhost, host, sizeof(bhost) - 1);
+  Py_BEGIN_ALLOW_THREADS
+  tc_connect_(bhost, &port, &status);
+  Py_END_ALLOW_THREADS
+  return Py_BuildValue("i", status);
+}
+
+static PyObject* py_session_create(PyObject* self, PyObject* args) {
+  const char* host;
+  int port, session, status;
+  char bhost[80];
+  if (!PyArg_ParseTuple(args, "si", &host, &port))
+    return NULL;
+  memset(bhost, 0, sizeof(bhost));
+  strncpy(bhost, host, sizeof(bhost) - 1);
+  Py_BEGIN_ALLOW_THREADS
+  tc_session_create_(bhost, &port, &session, &status);
+  Py_END_ALLOW_THREADS
+  return Py_BuildValue("ii", session, status);
+}
+
+static PyObject* py_setup(PyObject* self, PyObject* args) {
+  int session, numqmatoms, status;
+  const char* tcfile;
+  PyObject* qmattypes;
+  char btcfile[256];
+  vector<char> types;
+  if (!PyArg_ParseTuple(args, "isO", &session, &tcfile, &qmattypes))
+    return NULL;
+  if (!GetAtomTypes(qmattypes, types, numqmatoms))
+    return NULL;
+  memset(btcfile, 0, sizeof(btcfile));
+  strncpy(btcfile, tcfile, sizeof(btcfile) - 1);
+  const char (*btypes)[5] = (const char (*)[5])types.data();
+  Py_BEGIN_ALLOW_THREADS
+  if (session == 0)
+    tc_setup_(btcfile, btypes, &numqmatoms, &status);
+  else
+    tc_session_setup_(&session, btcfile, btypes, &numqmatoms, &status);
+  Py_END_ALLOW_THREADS
+  return Py_BuildValue("i", status);
+}
+
+static PyObject* py_compute_energy_gradient(PyObject* self, PyObject* args) {
+  int session, numqmatoms, nummmatoms, globaltreatment, status;
+  PyObject *qmattypes, *qmcoords, *mmcoords, *mmcharges, *qmgrad, *mmgrad;
+  Buffer bqmcoords, bmmcoords, bmmcharges, bqmgrad, bmmgrad;
+  vector<char> types;
+  double totenergy = 0.0;
+  if (!PyArg_ParseTuple(args, "iOOOOiOO", &session, &qmattypes, &qmcoords, &mmcoords, &mmcharges,
+        &globaltreatment, &qmgrad, &mmgrad))
+    return NULL;
+  if (!GetAtomTypes(qmattypes, types, numqmatoms) ||
+      !GetDoubles(qmcoords, bqmcoords, false, "qmcoords") ||
+      !GetDoubles(mmcoords, bmmcoords, false, "mmcoords") ||
+      !GetDoubles(mmcharges, bmmcharges, false, "mmcharges") ||
+      !GetDoubles(qmgrad, bqmgrad, true, "qmgrad") ||
+      !GetDoubles(mmgrad, bmmgrad, true, "mmgrad"))
+    return NULL;
+  nummmatoms = (int)(bmmcoords.size() / 3);
+  if (bqmcoords.size() != 3 * numqmatoms || bqmgrad.size() != 3 * numqmatoms ||
+      (bmmcharges.held && bmmcharges.size() != nummmatoms) ||
+      (nummmatoms > 0 && bmmgrad.size() != 3 * nummmatoms)) {
+    PyErr_SetString(PyExc_ValueError, "compute_energy_gradient: array sizes do not match the number of atoms");
+    return NULL;
+  }
+  const char (*btypes)[5] = (const char (*)[5])types.data();
+  Py_BEGIN_ALLOW_THREADS
+  if (session == 0)
+    tc_compute_energy_gradient_(btypes, bqmcoords.data(), &numqmatoms, &totenergy, bqmgrad.data(),
+      bmmcoords.data(), bmmcharges.data(), &nummmatoms, bmmgrad.data(), &globaltreatment, &status);
+  else
+    tc_session_compute_energy_gradient_(&session, btypes, bqmcoords.data(), &numqmatoms, &totenergy,
+      bqmgrad.data(), bmmcoords.data(), bmmcharges.data(), &nummmatoms, bmmgrad.data(),
+      &globaltreatment, &status);
+  Py_END_ALLOW_THREADS
+  return Py_BuildValue("di", totenergy, status);
+}
+
+static PyObject* py_session_start_energy_gradient(PyObject* self, PyObject* args) {
+  int session, numqmatoms, nummmatoms, globaltreatment, status;
+  PyObject *qmattypes, *qmcoords, *mmcoords, *mmcharges;
+  Buffer bqmcoords, bmmcoords, bmmcharges;
+  vector<char> types;
+  if (!PyArg_ParseTuple(args, "iOOOOi", &session, &qmattypes, &qmcoords, &mmcoords, &mmcharges,
+        &globaltreatment))
+    return NULL;
+  if (!GetAtomTypes(qmattypes, types, numqmatoms) ||
+      !GetDoubles(qmcoords, bqmcoords, false, "qmcoords") ||
+      !GetDoubles(mmcoords, bmmcoords, false, "mmcoords") ||
+      !GetDoubles(mmcharges, bmmcharges, false, "mmcharges"))
+    return NULL;
+  nummmatoms = (int)(bmmcoords.size() / 3);
+  if (bqmcoords.size() != 3 * numqmatoms || (bmmcharges.held && bmmcharges.size() != nummmatoms)) {
+    PyErr_SetString(PyExc_ValueError, "session_start_energy_gradient: array sizes do not match the number of atoms");
+    return NULL;
+  }
+  const char (*btypes)[5] = (const char (*)[5])types.data();
+  Py_BEGIN_ALLOW_THREADS
+  tc_session_start_energy_gradient_(&session, btypes, bqmcoords.data(), &numqmatoms, bmmcoords.data(),
+    bmmcharges.data(), &nummmatoms, &globaltreatment, &status);
+  Py_END_ALLOW_THREADS
+  return Py_BuildValue("i", status);
+}
+
+static PyObject* py_session_progress(PyObject* self, PyObject* args) {
+  int session, state = 0, fd = -1, events = 0, timeout = -1, status;
+  if (!PyArg_ParseTuple(args, "i", &session))
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  tc_session_progress_(&session, &state, &fd, &events, &timeout, &status);
+  Py_END_ALLOW_THREADS
+  return Py_BuildValue("iiiii", state, fd, events, timeout, status);
+}
+
+static PyObject* py_session_collect_energy_gradient(PyObject* self, PyObject* args) {
+  int session, status;
+  PyObject *qmgrad, *mmgrad;
+  Buffer bqmgrad, bmmgrad;
+  double totenergy = 0.0;
+  if (!PyArg_ParseTuple(args, "iOO", &session, &qmgrad, &mmgrad))
+    return NULL;
+  if (!GetDoubles(qmgrad, bqmgrad, true, "qmgrad") || !GetDoubles(mmgrad, bmmgrad, true, "mmgrad"))
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  tc_session_collect_energy_gradient_(&session, &totenergy, bqmgrad.data(), bmmgrad.data(), &status);
+  Py_END_ALLOW_THREADS
+  return Py_BuildValue("di", totenergy, status);
+}
+
+static PyObject* py_get_qm_charges(PyObject* self, PyObject* args) {
+  int session, status;
+  PyObject* qmcharges;
+  Buffer bqmcharges;
+  if (!PyArg_ParseTuple(args, "iO", &session, &qmcharges))
+    return NULL;
+  if (!GetDoubles(qmcharges, bqmcharges, true, "qmcharges"))
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  if (session == 0)
+    tc_get_qm_charges_(bqmcharges.data(), &status);
+  else
+    tc_session_get_qm_charges_(&session, bqmcharges.data(), &status);
+  Py_END_ALLOW_THREADS
+  return Py_BuildValue("i", status);
+}
+
+static PyObject* py_finalize(PyObject* self, PyObject* args) {
+  Py_BEGIN_ALLOW_THREADS
+  tc_finalize_();
+  Py_END_ALLOW_THREADS
+  Py_RETURN_NONE;
+}
+
+static PyObject* py_session_destroy(PyObject* self, PyObject* args) {
+  int session;
+  if (!PyArg_ParseTuple(args, "i", &session))
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  tc_session_destroy_(&session);
+  Py_END_ALLOW_THREADS
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef methods[] = {
+  {"connect", py_connect, METH_VARARGS,
+   "connect(host, port) -> status"},
+  {"session_create", py_session_create, METH_VARARGS,
+   "session_create(host, port) -> (session, status)"},
+  {"setup", py_setup, METH_VARARGS,
+   "setup(session, tcfile, qmattypes) -> status"},
+  {"compute_energy_gradient", py_compute_energy_gradient, METH_VARARGS,
+   "compute_energy_gradient(session, qmattypes, qmcoords, mmcoords, mmcharges, globaltreatment, qmgrad, mmgrad)"
+   " -> (energy, status)\n\nqmgrad and mmgrad are filled in place, mmcoords, mmcharges and mmgrad may be None."},
+  {"session_start_energy_gradient", py_session_start_energy_gradient, METH_VARARGS,
+   "session_start_energy_gradient(session, qmattypes, qmcoords, mmcoords, mmcharges, globaltreatment) -> status"},
+  {"session_progress", py_session_progress, METH_VARARGS,
+   "session_progress(session) -> (state, fd, events, timeout, status)"},
+  {"session_collect_energy_gradient", py_session_collect_energy_gradient, METH_VARARGS,
+   "session_collect_energy_gradient(session, qmgrad, mmgrad) -> (energy, status)\n\nqmgrad and mmgrad are filled in place."},
+  {"get_qm_charges", py_get_qm_charges, METH_VARARGS,
+   "get_qm_charges(session, qmcharges) -> status\n\nqmcharges is filled in place."},
+  {"finalize", py_finalize, METH_NOARGS,
+   "finalize()"},
+  {"session_destroy", py_session_destroy, METH_VARARGS,
+   "session_destroy(session)"},
+  {NULL, NULL, 0, NULL}
+};
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef module = {
+  PyModuleDef_HEAD_INIT, "_pytcpb", "Native bindings for libtcpb", -1, methods
+};
+
+PyMODINIT_FUNC PyInit__pytcpb(void) {
+  return PyModule_Create(&module);
+}
+#else
+PyMODINIT_FUNC init_pytcpb(void) {
+  Py_InitModule3("_pytcpb", methods, "Native bindings for libtcpb");
+}
+#endif
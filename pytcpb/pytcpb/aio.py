@@ -0,0 +1,166 @@
+"""
+asyncio client for TeraChem servers
+
+Jobs run on the non-blocking sessions of libtcpb: the event loop watches each session's socket
+and timer, so any number of jobs on different servers are in flight on one event loop without
+threads. Needs the native _pytcpb extension and NumPy.
+
+Example:
+
+    client = await AsyncClient.connect('localhost', 12345, 'tc.in', ['O', 'H', 'H'])
+    energy, qmgrad, mmgrad = await client.compute_gradient(['O', 'H', 'H'], coords)
+
+    pool = AsyncPool(clients)
+    results = await asyncio.gather(*[pool.compute_gradient(atoms, c) for c in geometries])
+"""
+import asyncio
+import select
+
+import numpy
+
+from . import _pytcpb
+from ._native import _as_doubles
+
+class TCPBError(RuntimeError):
+    """
+    Raised when a job could not be started or failed on the server
+    """
+    def __init__(self, message, status):
+        RuntimeError.__init__(self, '%s (status %d)' % (message, status))
+        self.status = status
+
+class AsyncClient(object):
+    """
+    Connection to one TeraChem server, running one job at a time
+
+    Concurrent compute_gradient() calls on the same client wait for each other.
+    A cancelled call leaves its job running to completion in the background,
+    so the connection stays usable.
+    """
+    def __init__(self, session):
+        self.session = session
+        self._lock = asyncio.Lock()
+        self._reconnect = False
+
+    @classmethod
+    async def connect(cls, host, port, tcfile, qmattypes):
+        """
+        Create a session on a server and set it up from a TeraChem input file
+
+        Both calls block on the server, so they run in the default executor.
+        """
+        loop = asyncio.get_event_loop()
+        session, status = await loop.run_in_executor(None, _pytcpb.session_create, host, port)
+        if status != 0:
+            raise TCPBError('Could not connect to %s:%d' % (host, port), status)
+        status = await loop.run_in_executor(None, _pytcpb.setup, session, tcfile, list(qmattypes))
+        if status != 0:
+            _pytcpb.session_destroy(session)
+            raise TCPBError('Could not set up the session from %s' % tcfile, status)
+        return cls(session)
+
+    def close(self):
+        """
+        Disconnect from the server
+        """
+        if self.session:
+            _pytcpb.session_destroy(self.session)
+            self.session = 0
+
+    async def compute_gradient(self, qmattypes, qmcoords, mmcoords=[], mmcharges=[], globaltreatment=0):
+        """
+        Compute the energy and gradient, arguments as in pytcpb.compute_energy_gradient()
+
+        Returns the energy and the QM and MM gradients as flat NumPy arrays.
+        """
+        return await asyncio.shield(self._start(qmattypes, qmcoords, mmcoords, mmcharges, globaltreatment))
+
+    def _start(self, qmattypes, qmcoords, mmcoords=[], mmcharges=[], globaltreatment=0):
+        # The job runs as its own task, so it outlives a cancelled caller
+        return asyncio.ensure_future(self._run(list(qmattypes), qmcoords, mmcoords, mmcharges, globaltreatment))
+
+    async def _run(self, qmattypes, qmcoords, mmcoords, mmcharges, globaltreatment):
+        qmcoords = _as_doubles(qmcoords)
+        mmcoords = _as_doubles(mmcoords)
+        nummmatoms = int(len(mmcoords)/3)
+        mmcharges = _as_doubles(mmcharges) if len(mmcharges) > 0 else None
+        async with self._lock:
+            args = (self.session, qmattypes, qmcoords, mmcoords if nummmatoms > 0 else None,
+                    mmcharges if nummmatoms > 0 else None, globaltreatment)
+            if self._reconnect:
+                # After a failed job the session reconnects first, which blocks
+                self._reconnect = False
+                loop = asyncio.get_event_loop()
+                status = await loop.run_in_executor(None, _pytcpb.session_start_energy_gradient, *args)
+            else:
+                status = _pytcpb.session_start_energy_gradient(*args)
+            if status != 0:
+                raise TCPBError('Could not start the job', status)
+            self._reconnect = (await self._drive() == 2)
+            qmgrad = numpy.empty(3*len(qmattypes))
+            mmgrad = numpy.empty(3*nummmatoms)
+            energy, status = _pytcpb.session_collect_energy_gradient(self.session, qmgrad,
+                                                                     mmgrad if nummmatoms > 0 else None)
+            if status != 0:
+                raise TCPBError('Job failed', status)
+            return energy, qmgrad, mmgrad
+
+    async def _drive(self):
+        # Call session_progress whenever the socket is ready or the next status check is due
+        loop = asyncio.get_event_loop()
+        while True:
+            state, fd, events, timeout, status = _pytcpb.session_progress(self.session)
+            if status != 0:
+                raise TCPBError('Lost track of the job', status)
+            if state != 0:
+                return state
+            wakeup = loop.create_future()
+            def wake():
+                if not wakeup.done():
+                    wakeup.set_result(None)
+            if events & select.POLLIN:
+                loop.add_reader(fd, wake)
+            if events & select.POLLOUT:
+                loop.add_writer(fd, wake)
+            timer = loop.call_later(timeout/1000.0, wake) if timeout >= 0 else None
+            try:
+                await wakeup
+            finally:
+                if events & select.POLLIN:
+                    loop.remove_reader(fd)
+                if events & select.POLLOUT:
+                    loop.remove_writer(fd)
+                if timer is not None:
+                    timer.cancel()
+
+class AsyncPool(object):
+    """
+    Spreads jobs over several AsyncClients, each job goes to the next idle client
+    """
+    def __init__(self, clients):
+        self.clients = list(clients)
+        self._idle = asyncio.Queue()
+        for client in self.clients:
+            self._idle.put_nowait(client)
+
+    async def compute_gradient(self, *args, **kwargs):
+        """
+        Compute the energy and gradient on the next idle client, arguments as in AsyncClient.compute_gradient()
+
+        A cancelled call keeps its client busy until the job left running on it is done.
+        """
+        client = await self._idle.get()
+        try:
+            job = client._start(*args, **kwargs)
+        except BaseException:
+            self._idle.put_nowait(client)
+            raise
+        job.add_done_callback(lambda job: self._idle.put_nowait(client))
+        return await asyncio.shield(job)
+
+    def close(self):
+        """
+        Disconnect all clients
+        """
+        for client in self.clients:
+            client.close()
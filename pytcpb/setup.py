@@ -46,15 +46,25 @@ is_pypy = '__pypy__' in sys.builtin_module_names
 # packages to be installed
 packages = ['pytcpb']
 
-# extensions
-extensions = []
+# extensions: native bindings against libtcpb, optional since pytcpb falls back to ctypes
+# (set TCPB_LIBDIR to link against a libtcpb outside of this source tree)
+srcdir = os.path.dirname(os.path.abspath(__file__))
+extensions = [Extension('pytcpb._pytcpb',
+                        sources=[os.path.join('pytcpb', '_pytcpb.cpp')],
+                        include_dirs=[os.path.join(srcdir, '..', 'src'), os.path.join(srcdir, '..', 'include')],
+                        library_dirs=([os.environ['TCPB_LIBDIR']] if 'TCPB_LIBDIR' in os.environ else []) +
+                                     [os.path.join(srcdir, '..', 'lib'), os.path.join(srcdir, '..')],
+                        libraries=['tcpb'],
+                        extra_compile_args=['-std=c++11'],
+                        language='c++',
+                        optional=True)]
 
 if __name__ == '__main__':
 
     import shutil
 
     # See if we have the Python development headers.  If not, don't build the
-    # optimized prmtop parser extension
+    # native extension
     from distutils import sysconfig
     if not is_pypy and not os.path.exists(
             os.path.join(sysconfig.get_config_vars()['INCLUDEPY'], 'Python.h')):
@@ -4,6 +4,12 @@
 
 #include <map>
 using std::map;
+#include <memory>
+using std::shared_ptr;
+#include <mutex>
+using std::lock_guard;
+using std::mutex;
+#include <utility>
 #include <stdio.h>
 #include <stdlib.h>
 #include<iostream>
@@ -13,7 +19,6 @@ using std::map;
 using std::string;
 #include <vector>
 using std::vector;
-#include <unistd.h>
 
 #include "api.h"
 #include "client.h"
@@ -23,241 +28,601 @@ using std::vector;
 
 #define BohrToAng 0.52917724924
 
-extern "C" {
+// State of one QM region on one server, with its own client, input template and guess tracking
+struct TCSession {
+  TCPB::Client* TC;
+  TCPB::Input*  pb_input;
+  TCPB::Output* pb_output;
+  int old_numqmatoms;
+  int old_qmmmtype;
+  bool useopenmm;
+  TCPB::JobHandle pending; // Job from tc_submit_energy_gradient_, until it is collected
+  int started;             // Non-blocking job from tc_session_start_energy_gradient_: 0, none;
+                           // 1, in progress; 2, complete; 3, failed (until it is collected)
+  bool pending_mm;         // Whether the pending or started job has an MM region
+  int pending_state;       // Target state of the pending or started job
+  bool reconnect;          // Whether the next job has to start over on a new connection
+  mutex session_mutex; // Serializes calls on the same session
 
-  // Variables to be used/modified by all function calls, and to be active in between function calls
-  TCPB::Client* TC = nullptr;
-  TCPB::Input*  pb_input = nullptr;
-  TCPB::Output* pb_output = nullptr;
-  int old_numqmatoms = -1;
-  int old_qmmmtype = -1;
-  bool useopenmm = false;
+  TCSession() : TC(nullptr), pb_input(nullptr), pb_output(nullptr), old_numqmatoms(-1),
+    old_qmmmtype(-1), useopenmm(false), started(0), pending_mm(false), pending_state(0),
+    reconnect(false) {}
 
-  void tc_connect_(const char host[80], const int* port, int* status) {
-    try {
-      TC = new TCPB::Client(std::string(host), (*port));
-    }
-    catch (...) {
+  ~TCSession() {
+    delete TC;
+    delete pb_input;
+    delete pb_output;
+  }
+};
+
+// Session used by the original (handle-less) functions
+static TCSession default_session;
+
+// Sessions created with tc_session_create_, by handle
+static map<int, shared_ptr<TCSession> > sessions;
+static int next_session = 1;
+static mutex sessions_mutex;
+
+static shared_ptr<TCSession> FindSession(const int* session) {
+  lock_guard<mutex> lock(sessions_mutex);
+  if (session == nullptr || !sessions.count(*session))
+    return nullptr;
+  return sessions[*session];
+}
+
+static void Connect(TCSession &s, const char host[80], const int* port, int* status) {
+  // Reconnecting replaces the old client, which cancels a pending job
+  delete s.TC;
+  s.pending = TCPB::JobHandle();
+  s.started = 0;
+  s.TC = nullptr;
+  try {
+    s.TC = new TCPB::Client(std::string(host), (*port));
+  }
+  catch (...) {
+    (*status) = 1;
+    return;
+  }
+  bool avail = s.TC->IsAvailable();
+  if (!avail)
+    (*status) = 2;
+  else
+    (*status) = 0;
+}
+
+static void Setup(TCSession &s, const char tcfile[256], const char qmattypes[][5], const int* numqmatoms,
+  int* status) {
+  map<string, string> options = TCPB::Utils::ReadTCFile(tcfile);
+  if (options.size() == 0) {
+    (*status) = 1;
+    return;
+  }
+  // Adjust some options
+  options.erase("coordinates");
+  options.erase("pointcharges");
+  options.erase("run");
+  options.emplace("run","gradient");
+  // Check if the prmtop flag is in the input options. If true, set a variable in the enviroment and
+  // read the prmtop file content and the qmindices
+  string prmtopcontent;
+  std::vector< int > qmindices;
+  if (options.count("prmtop")) {
+    s.useopenmm = true;
+    std::ifstream fl(options["prmtop"]);
+    std::ostringstream ss;
+    if (fl.is_open()) {
+      ss << fl.rdbuf();
+      prmtopcontent = ss.str();
+    } else {
+      // prmtop file does not exist
       (*status) = 1;
       return;
     }
-    bool avail = TC->IsAvailable();
-    if (!avail)
-      (*status) = 2;
-    else
-      (*status) = 0;
-  }
-
-  void tc_setup_(const char tcfile[256], const char qmattypes[][5], const int* numqmatoms, int* status) {
-    map<string, string> options = TCPB::Utils::ReadTCFile(tcfile);
-    if (options.size() == 0) {
+    fl.close();
+    ss.str("");
+    if (!options.count("qmindices")) {
       (*status) = 1;
       return;
     }
-    // Adjust some options
-    options.erase("coordinates");
-    options.erase("pointcharges");
-    options.erase("run");
-    options.emplace("run","gradient");
-    // Check if the prmtop flag is in the input options. If true, set a variable in the enviroment and
-    // read the prmtop file content and the qmindices
-    string prmtopcontent;
-    std::vector< int > qmindices;
-    if (options.count("prmtop")) {
-      useopenmm = true;
-      std::ifstream fl(options["prmtop"]);
-      std::ostringstream ss;
-      if (fl.is_open()) {
-        ss << fl.rdbuf();
-        prmtopcontent = ss.str();
-      } else {
-        // prmtop file does not exist
-        (*status) = 1;
-        return;
+    fl.open(options["qmindices"]);
+    if (fl.is_open()) {
+      int num;
+      int cnt = 0;
+      while (fl >> num) {
+        qmindices.push_back(num);
+        cnt++;
       }
-      fl.close();
-      ss.str("");
-      if (!options.count("qmindices")) {
+      // Check if number of qmindices match the number of qmatoms
+      if (cnt != (*numqmatoms)) {
         (*status) = 1;
         return;
       }
-      fl.open(options["qmindices"]);
-      if (fl.is_open()) {
-        int num;
-        int cnt = 0;
-        while (fl >> num) {
-          qmindices.push_back(num);
-          cnt++;
-        }
-        // Check if number of qmindices match the number of qmatoms
-        if (cnt != (*numqmatoms)) {
-          (*status) = 1;
-          return;
-        }
-      } else {
-        // qmindices file does not exist
-        (*status) = 1;
-        return;
-      }
-      fl.close();
     } else {
-      useopenmm = false;
+      // qmindices file does not exist
+      (*status) = 1;
+      return;
     }
-    options.erase("prmtop");
-    options.erase("qmindices");
-    // Since this is just a setup call, set all QM coordinates to zero
-    double qmcoords[3*(*numqmatoms)];
-    memset(qmcoords, 0, 3*(*numqmatoms)*sizeof(double));
-    // Change type of array containing atom types
-    vector<string> qmatomtypes;
-    int i;
-    for (i = 0; i<(*numqmatoms); i++) {
-      qmatomtypes.push_back(std::string(qmattypes[i]));
+    fl.close();
+  } else {
+    s.useopenmm = false;
+  }
+  options.erase("prmtop");
+  options.erase("qmindices");
+  // Since this is just a setup call, set all QM coordinates to zero
+  double qmcoords[3*(*numqmatoms)];
+  memset(qmcoords, 0, 3*(*numqmatoms)*sizeof(double));
+  // Change type of array containing atom types
+  vector<string> qmatomtypes;
+  int i;
+  for (i = 0; i<(*numqmatoms); i++) {
+    qmatomtypes.push_back(std::string(qmattypes[i]));
+  }
+  // Attempt to create the PB input variable
+  delete s.pb_input;
+  s.pb_input = nullptr;
+  try {
+    s.pb_input = new TCPB::Input(qmatomtypes, options, qmcoords);
+  }
+  catch (...) {
+    (*status) = 2;
+    return;
+  }
+  // Set prmtop file content and qmindices
+  if (s.useopenmm) {
+    s.pb_input->GetMutablePB().clear_prmtop_content();
+    s.pb_input->GetMutablePB().set_prmtop_content(prmtopcontent);
+    s.pb_input->GetMutablePB().mutable_qm_indices()->Resize(qmindices.size(), 0);
+    for (i = 0; i<qmindices.size(); i++) {
+      s.pb_input->GetMutablePB().mutable_qm_indices()->mutable_data()[i] = qmindices[i];
     }
-    // Attempt to create the PB input variable
+  }
+  //printf("Debug protobuf input string:\n%s\n", s.pb_input->GetDebugString().c_str());
+  // If all is done, then done
+  (*status) = 0;
+}
+
+// Fills the input template of a session with the coordinates of the next job
+static bool PrepareInput(TCSession &s, const char qmattypes[][5], const double* qmcoords,
+  const int* numqmatoms, const double* mmcoords, const double* mmcharges, const int* nummmatoms,
+  const int* globaltreatment) {
+  int i;
+  bool ConsiderMM = (nummmatoms != nullptr && (*nummmatoms) > 0);
+  // Check that the session is connected and set up, and has no job of its own in flight
+  if (s.TC == nullptr || s.pb_input == nullptr || s.pending.Valid() || s.started != 0)
+    return false;
+  // A failed non-blocking job may have left the connection mid-message, so start over on a new one
+  if (s.reconnect) {
+    s.reconnect = false;
     try {
-      pb_input = new TCPB::Input(qmatomtypes, options, qmcoords);
+      s.TC->Reconnect();
     }
-    catch (...) {
-      (*status) = 2;
-      return;
+    catch (...) {}
+  }
+  // Check for mistakes in the varibles passed to the function
+  if (qmcoords == nullptr || numqmatoms == nullptr || (*numqmatoms) <= 0 ||
+      (ConsiderMM && (mmcoords == nullptr || (!s.useopenmm && mmcharges == nullptr))) ||
+      (globaltreatment != nullptr && ((*globaltreatment) < 0 || (*globaltreatment) > 2)))
+    return false;
+  // Set initial condition
+  bool usenewcondition = false;
+  if (s.useopenmm) {
+    s.pb_input->GetMutablePB().set_qmmm_type(terachem_server::JobInput_QmmmType::JobInput_QmmmType_TC_OPENMM);
+    mmcharges = nullptr;
+    if (s.old_qmmmtype != 2)
+      usenewcondition = true;
+    s.old_qmmmtype = 2;
+  } else if (mmcoords == nullptr || !ConsiderMM) {
+    s.pb_input->GetMutablePB().set_qmmm_type(terachem_server::JobInput_QmmmType::JobInput_QmmmType_NO_QMMM);
+    if (s.old_qmmmtype != 0)
+      usenewcondition = true;
+    s.old_qmmmtype = 0;
+  } else {
+    s.pb_input->GetMutablePB().set_qmmm_type(terachem_server::JobInput_QmmmType::JobInput_QmmmType_POINT_CHARGE);
+    if (s.old_qmmmtype != 1)
+      usenewcondition = true;
+    s.old_qmmmtype = 1;
+  }
+  if (globaltreatment == nullptr || (*globaltreatment) == 0) {
+    if (s.old_numqmatoms < 1 || s.old_numqmatoms !=  (*numqmatoms) || usenewcondition) {
+      s.pb_input->GetMutablePB().set_md_global_type(terachem_server::JobInput_MDGlobalTreatment::JobInput_MDGlobalTreatment_NEW_CONDITION);
+      s.old_numqmatoms = (*numqmatoms);
+    } else {
+      s.pb_input->GetMutablePB().set_md_global_type(terachem_server::JobInput_MDGlobalTreatment::JobInput_MDGlobalTreatment_CONTINUE);
     }
-    // Set prmtop file content and qmindices
-    if (useopenmm) {
-      pb_input->GetMutablePB().clear_prmtop_content();
-      pb_input->GetMutablePB().set_prmtop_content(prmtopcontent);
-      pb_input->GetMutablePB().mutable_qm_indices()->Resize(qmindices.size(), 0);
-      for (i = 0; i<qmindices.size(); i++) {
-        pb_input->GetMutablePB().mutable_qm_indices()->mutable_data()[i] = qmindices[i];
-      }
+  } else if ((*globaltreatment) == 1) {
+    s.pb_input->GetMutablePB().set_md_global_type(terachem_server::JobInput_MDGlobalTreatment::JobInput_MDGlobalTreatment_NEW_CONDITION);
+  } else if ((*globaltreatment) == 2) {
+    s.pb_input->GetMutablePB().set_md_global_type(terachem_server::JobInput_MDGlobalTreatment::JobInput_MDGlobalTreatment_NORMAL);
+  } else {
+    return false;
+  }
+  // Handle atom types
+  s.pb_input->GetMutablePB().mutable_mol()->clear_atoms();
+  for (i = 0; i<(*numqmatoms); i++) {
+    s.pb_input->GetMutablePB().mutable_mol()->add_atoms(std::string(qmattypes[i]));
+  }
+  // Handle coordinates of the QM region
+  s.pb_input->GetMutablePB().mutable_mol()->mutable_xyz()->Resize(3*(*numqmatoms), 0.0);
+  for (i = 0; i<3*(*numqmatoms); i++) {
+    //std::cout << "QM atom " << i+1 << ": " << qmcoords[i] << "\n";
+    s.pb_input->GetMutablePB().mutable_mol()->mutable_xyz()->mutable_data()[i] = qmcoords[i];
+  }
+  // Handle coordinates of the MM region
+  if (mmcoords == nullptr || !ConsiderMM) {
+    s.pb_input->GetMutablePB().clear_mmatom_position();
+  } else {
+    s.pb_input->GetMutablePB().mutable_mmatom_position()->Resize(3*(*nummmatoms), 0.0);
+    for (i = 0; i<3*(*nummmatoms); i++) {
+      //std::cout << "MM atom " << i+1 << ": " << mmcoords[i] << "\n";
+      s.pb_input->GetMutablePB().mutable_mmatom_position()->mutable_data()[i] = mmcoords[i];
+    }
+  }
+  // Handle charges of the MM region
+  if (mmcharges == nullptr || !ConsiderMM) {
+    s.pb_input->GetMutablePB().clear_mmatom_charge();
+  } else {
+    s.pb_input->GetMutablePB().mutable_mmatom_charge()->Resize((*nummmatoms), 0.0);
+    for (i = 0; i<(*nummmatoms); i++) {
+      s.pb_input->GetMutablePB().mutable_mmatom_charge()->mutable_data()[i] = mmcharges[i];
     }
-    //printf("Debug protobuf input string:\n%s\n", pb_input->GetDebugString().c_str());
-    // If all is done, then done
-    (*status) = 0;
+  }
+  //printf("Debug protobuf input string:\n%s\n", s.pb_input->GetDebugString().c_str());
+  return true;
+}
+
+// Keeps the output of the last job for GetQMCharges, sharing its protobuf instead of copying it
+static void KeepOutput(TCSession &s, TCPB::Output output) {
+  if (s.pb_output == nullptr) {
+    s.pb_output = new TCPB::Output(std::move(output));
+  } else {
+    (*s.pb_output) = std::move(output);
+  }
+}
+
+static void ComputeEnergyGradient(TCSession &s, const char qmattypes[][5], const double* qmcoords,
+  const int* numqmatoms, double* totenergy, double* qmgrad, const double* mmcoords, const double* mmcharges,
+  const int* nummmatoms, double* mmgrad, const int* globaltreatment, int* status) {
+  bool ConsiderMM = (nummmatoms != nullptr && (*nummmatoms) > 0);
+  if (totenergy == nullptr || qmgrad == nullptr || (ConsiderMM && mmgrad == nullptr) ||
+      !PrepareInput(s, qmattypes, qmcoords, numqmatoms, mmcoords, mmcharges, nummmatoms, globaltreatment)) {
+    (*status) = 1;
+    return;
+  }
+  // Attempt to create the PB input variable
+  try {
+    KeepOutput(s, s.TC->ComputeGradient((*s.pb_input), (*totenergy), qmgrad, mmgrad));
+    //printf("Debug protobuf output string:\n%s\n", s.pb_output->GetDebugString().c_str());
+  }
+  catch (...) {
+    (*status) = 2;
+    return;
+  }
+  // If all is done, then done
+  (*status) = 0;
+}
+
+// Copies the results of a finished job into the caller arrays and keeps its output for GetQMCharges
+static void CollectOutput(TCSession &s, const TCPB::Output &output, double* totenergy, double* qmgrad,
+  double* mmgrad) {
+  output.GetEnergy((*totenergy), s.pending_state);
+  output.GetGradient(qmgrad, mmgrad);
+  KeepOutput(s, output);
+}
+
+static void SubmitEnergyGradient(TCSession &s, const char qmattypes[][5], const double* qmcoords,
+  const int* numqmatoms, const double* mmcoords, const double* mmcharges, const int* nummmatoms,
+  const int* globaltreatment, int* status) {
+  if (!PrepareInput(s, qmattypes, qmcoords, numqmatoms, mmcoords, mmcharges, nummmatoms, globaltreatment)) {
+    (*status) = 1;
+    return;
+  }
+  // Submit copies the input, so the caller may reuse its arrays right away
+  try {
+    s.pending = s.TC->Submit(*s.pb_input);
+  }
+  catch (...) {
+    (*status) = 2;
+    return;
+  }
+  s.pending_mm = (nummmatoms != nullptr && (*nummmatoms) > 0);
+  s.pending_state = s.pb_input->GetTargetState();
+  (*status) = 0;
+}
+
+static void Test(TCSession &s, int* done, int* status) {
+  if (!s.pending.Valid()) {
+    (*done) = 0;
+    (*status) = 1;
+    return;
+  }
+  (*done) = (s.pending.Ready() ? 1 : 0);
+  (*status) = 0;
+}
+
+static void WaitEnergyGradient(TCSession &s, double* totenergy, double* qmgrad, double* mmgrad, int* status) {
+  if (!s.pending.Valid() || totenergy == nullptr || qmgrad == nullptr || (s.pending_mm && mmgrad == nullptr)) {
+    (*status) = 1;
+    return;
+  }
+  // The job is collected whether it succeeded or not
+  TCPB::JobHandle job = s.pending;
+  s.pending = TCPB::JobHandle();
+  try {
+    CollectOutput(s, job.Get(), totenergy, qmgrad, mmgrad);
+  }
+  catch (...) {
+    (*status) = 2;
+    return;
+  }
+  (*status) = 0;
+}
+
+static void StartEnergyGradient(TCSession &s, const char qmattypes[][5], const double* qmcoords,
+  const int* numqmatoms, const double* mmcoords, const double* mmcharges, const int* nummmatoms,
+  const int* globaltreatment, int* status) {
+  if (!PrepareInput(s, qmattypes, qmcoords, numqmatoms, mmcoords, mmcharges, nummmatoms, globaltreatment)) {
+    (*status) = 1;
+    return;
+  }
+  // StartJob serializes the input, nothing is sent until Progress
+  try {
+    s.TC->StartJob(*s.pb_input);
+  }
+  catch (...) {
+    (*status) = 2;
+    return;
+  }
+  s.started = 1;
+  s.pending_mm = (nummmatoms != nullptr && (*nummmatoms) > 0);
+  s.pending_state = s.pb_input->GetTargetState();
+  (*status) = 0;
+}
+
+static void Progress(TCSession &s, int* state, int* fd, int* events, int* timeout, int* status) {
+  if (s.started == 0) {
+    (*status) = 1;
+    return;
+  }
+  if (s.started == 1) {
+    TCPB::JobProgress progress = s.TC->Progress();
+    if (progress == TCPB::JOB_COMPLETE) {
+      s.started = 2;
+    } else if (progress == TCPB::JOB_FAILED) {
+      s.started = 3;
+      // Reconnecting can take a while, so it is left to the next job instead of blocking here
+      s.reconnect = true;
+    }
+  }
+  (*state) = s.started - 1;
+  (*fd) = s.TC->GetFD();
+  (*events) = (s.started == 1 ? s.TC->GetPollEvents() : 0);
+  (*timeout) = (s.started == 1 ? s.TC->GetPollTimeout() : 0);
+  (*status) = 0;
+}
+
+static void CollectEnergyGradient(TCSession &s, double* totenergy, double* qmgrad, double* mmgrad, int* status) {
+  if (s.started < 2 || totenergy == nullptr || qmgrad == nullptr || (s.pending_mm && mmgrad == nullptr)) {
+    (*status) = 1;
+    return;
+  }
+  // The job is collected whether it succeeded or not
+  bool failed = (s.started == 3);
+  s.started = 0;
+  if (failed) {
+    (*status) = 2;
+    return;
+  }
+  try {
+    CollectOutput(s, s.TC->GetPrevResults(), totenergy, qmgrad, mmgrad);
+  }
+  catch (...) {
+    (*status) = 2;
+    return;
+  }
+  (*status) = 0;
+}
+
+static void GetQMCharges(TCSession &s, double* qmcharges, int* status) {
+  //printf("Debug protobuf output string:\n%s\n", s.pb_output->GetDebugString().c_str());
+  if (s.pb_output == nullptr) {
+    (*status) = 1;
+    return;
+  }
+  try {
+    s.pb_output->GetCharges(qmcharges);
+  }
+  catch (...) {
+    (*status) = 1;
+    return;
+  }
+  // If all is done, then done
+  (*status) = 0;
+}
+
+extern "C" {
+
+  void tc_connect_(const char host[80], const int* port, int* status) {
+    lock_guard<mutex> lock(default_session.session_mutex);
+    Connect(default_session, host, port, status);
+  }
+
+  void tc_setup_(const char tcfile[256], const char qmattypes[][5], const int* numqmatoms, int* status) {
+    lock_guard<mutex> lock(default_session.session_mutex);
+    Setup(default_session, tcfile, qmattypes, numqmatoms, status);
   }
 
   void tc_compute_energy_gradient_(const char qmattypes[][5], const double* qmcoords, const int* numqmatoms,
     double* totenergy, double* qmgrad, const double* mmcoords, const double* mmcharges,
     const int* nummmatoms, double* mmgrad, const int* globaltreatment, int* status) {
-    int i;
-    bool ConsiderMM = (nummmatoms != nullptr && (*nummmatoms) > 0);
-    // Check for mistakes in the varibles passed to the function
-    if (qmcoords == nullptr || numqmatoms == nullptr || (*numqmatoms) <= 0 || totenergy == nullptr ||
-        qmgrad == nullptr || (ConsiderMM && (mmcoords == nullptr || (!useopenmm && mmcharges == nullptr) ||
-        mmgrad == nullptr) ) || (globaltreatment != nullptr && ((*globaltreatment) < 0 || (*globaltreatment) > 2))) {
-      (*status) = 1;
-      return;
+    lock_guard<mutex> lock(default_session.session_mutex);
+    ComputeEnergyGradient(default_session, qmattypes, qmcoords, numqmatoms, totenergy, qmgrad,
+      mmcoords, mmcharges, nummmatoms, mmgrad, globaltreatment, status);
+  }
+
+  void tc_submit_energy_gradient_(const char qmattypes[][5], const double* qmcoords, const int* numqmatoms,
+    const double* mmcoords, const double* mmcharges, const int* nummmatoms, const int* globaltreatment,
+    int* status) {
+    lock_guard<mutex> lock(default_session.session_mutex);
+    SubmitEnergyGradient(default_session, qmattypes, qmcoords, numqmatoms, mmcoords, mmcharges, nummmatoms,
+      globaltreatment, status);
+  }
+
+  void tc_test_(int* done, int* status) {
+    lock_guard<mutex> lock(default_session.session_mutex);
+    Test(default_session, done, status);
+  }
+
+  void tc_wait_energy_gradient_(double* totenergy, double* qmgrad, double* mmgrad, int* status) {
+    lock_guard<mutex> lock(default_session.session_mutex);
+    WaitEnergyGradient(default_session, totenergy, qmgrad, mmgrad, status);
+  }
+
+  void tc_get_qm_charges_(double* qmcharges, int* status) {
+    lock_guard<mutex> lock(default_session.session_mutex);
+    GetQMCharges(default_session, qmcharges, status);
+  }
+
+  void tc_finalize_() {
+    lock_guard<mutex> lock(default_session.session_mutex);
+    default_session.pending = TCPB::JobHandle();
+    if (default_session.TC != nullptr) {
+      delete default_session.TC;
+      default_session.TC = nullptr;
     }
-    // Sleep a bit to ensure the server will receive the next ComputeGradient call
-    if (old_numqmatoms > 0) {
-      usleep(110000);
+    if (default_session.pb_input != nullptr) {
+      delete default_session.pb_input;
+      default_session.pb_input = nullptr;
     }
-    // Set initial condition
-    bool usenewcondition = false;
-    if (useopenmm) {
-      pb_input->GetMutablePB().set_qmmm_type(terachem_server::JobInput_QmmmType::JobInput_QmmmType_TC_OPENMM);
-      mmcharges = nullptr;
-      if (old_qmmmtype != 2)
-        usenewcondition = true;
-      old_qmmmtype = 2;
-    } else if (mmcoords == nullptr || !ConsiderMM) {
-      pb_input->GetMutablePB().set_qmmm_type(terachem_server::JobInput_QmmmType::JobInput_QmmmType_NO_QMMM);
-      if (old_qmmmtype != 0)
-        usenewcondition = true;
-      old_qmmmtype = 0;
-    } else {
-      pb_input->GetMutablePB().set_qmmm_type(terachem_server::JobInput_QmmmType::JobInput_QmmmType_POINT_CHARGE);
-      if (old_qmmmtype != 1)
-        usenewcondition = true;
-      old_qmmmtype = 1;
+    if (default_session.pb_output != nullptr) {
+      delete default_session.pb_output;
+      default_session.pb_output = nullptr;
     }
-    if (globaltreatment == nullptr || (*globaltreatment) == 0) {
-      if (old_numqmatoms < 1 || old_numqmatoms !=  (*numqmatoms) || usenewcondition) {
-        pb_input->GetMutablePB().set_md_global_type(terachem_server::JobInput_MDGlobalTreatment::JobInput_MDGlobalTreatment_NEW_CONDITION);
-        old_numqmatoms = (*numqmatoms);
-      } else {
-        pb_input->GetMutablePB().set_md_global_type(terachem_server::JobInput_MDGlobalTreatment::JobInput_MDGlobalTreatment_CONTINUE);
-      }
-    } else if ((*globaltreatment) == 1) {
-      pb_input->GetMutablePB().set_md_global_type(terachem_server::JobInput_MDGlobalTreatment::JobInput_MDGlobalTreatment_NEW_CONDITION);
-    } else if ((*globaltreatment) == 2) {
-      pb_input->GetMutablePB().set_md_global_type(terachem_server::JobInput_MDGlobalTreatment::JobInput_MDGlobalTreatment_NORMAL);
-    } else {
-      (*status) = 1;
+    default_session.old_numqmatoms = -1;
+    default_session.old_qmmmtype = -1;
+    default_session.useopenmm = false;
+  }
+
+  void tc_session_create_(const char host[80], const int* port, int* session, int* status) {
+    shared_ptr<TCSession> s = std::make_shared<TCSession>();
+    Connect(*s, host, port, status);
+    if ((*status) == 1) {
+      (*session) = 0;
       return;
     }
-    // Handle atom types
-    pb_input->GetMutablePB().mutable_mol()->clear_atoms();
-    for (i = 0; i<(*numqmatoms); i++) {
-      pb_input->GetMutablePB().mutable_mol()->add_atoms(std::string(qmattypes[i]));
-    }
-    // Handle coordinates of the QM region
-    pb_input->GetMutablePB().mutable_mol()->mutable_xyz()->Resize(3*(*numqmatoms), 0.0);
-    for (i = 0; i<3*(*numqmatoms); i++) {
-      //std::cout << "QM atom " << i+1 << ": " << qmcoords[i] << "\n";
-      pb_input->GetMutablePB().mutable_mol()->mutable_xyz()->mutable_data()[i] = qmcoords[i];
-    }
-    // Handle coordinates of the MM region
-    if (mmcoords == nullptr || !ConsiderMM) {
-      pb_input->GetMutablePB().clear_mmatom_position();
-    } else {
-      pb_input->GetMutablePB().mutable_mmatom_position()->Resize(3*(*nummmatoms), 0.0);
-      for (i = 0; i<3*(*nummmatoms); i++) {
-        //std::cout << "MM atom " << i+1 << ": " << mmcoords[i] << "\n";
-        pb_input->GetMutablePB().mutable_mmatom_position()->mutable_data()[i] = mmcoords[i];
-      }
+    lock_guard<mutex> lock(sessions_mutex);
+    (*session) = next_session++;
+    sessions[*session] = s;
+  }
+
+  void tc_session_setup_(const int* session, const char tcfile[256], const char qmattypes[][5],
+    const int* numqmatoms, int* status) {
+    shared_ptr<TCSession> s = FindSession(session);
+    if (s == nullptr) {
+      (*status) = 1;
+      return;
     }
-    // Handle charges of the MM region
-    if (mmcharges == nullptr || !ConsiderMM) {
-      pb_input->GetMutablePB().clear_mmatom_charge();
-    } else {
-      pb_input->GetMutablePB().mutable_mmatom_charge()->Resize((*nummmatoms), 0.0);
-      for (i = 0; i<(*nummmatoms); i++) {
-        pb_input->GetMutablePB().mutable_mmatom_charge()->mutable_data()[i] = mmcharges[i];
-      }
+    lock_guard<mutex> lock(s->session_mutex);
+    Setup(*s, tcfile, qmattypes, numqmatoms, status);
+  }
+
+  void tc_session_compute_energy_gradient_(const int* session, const char qmattypes[][5],
+    const double* qmcoords, const int* numqmatoms, double* totenergy, double* qmgrad,
+    const double* mmcoords, const double* mmcharges, const int* nummmatoms, double* mmgrad,
+    const int* globaltreatment, int* status) {
+    shared_ptr<TCSession> s = FindSession(session);
+    if (s == nullptr) {
+      (*status) = 1;
+      return;
     }
-    //printf("Debug protobuf input string:\n%s\n", pb_input->GetDebugString().c_str());
-    // Attempt to create the PB input variable
-    try {
-      TCPB::Output temp_pb_output = TC->ComputeGradient((*pb_input), (*totenergy), qmgrad, mmgrad);
-      pb_output = new TCPB::Output;
-      (*pb_output) = temp_pb_output;
-      //printf("Debug protobuf output string:\n%s\n", pb_output->GetDebugString().c_str());
+    lock_guard<mutex> lock(s->session_mutex);
+    ComputeEnergyGradient(*s, qmattypes, qmcoords, numqmatoms, totenergy, qmgrad,
+      mmcoords, mmcharges, nummmatoms, mmgrad, globaltreatment, status);
+  }
+
+  void tc_session_submit_energy_gradient_(const int* session, const char qmattypes[][5],
+    const double* qmcoords, const int* numqmatoms, const double* mmcoords, const double* mmcharges,
+    const int* nummmatoms, const int* globaltreatment, int* status) {
+    shared_ptr<TCSession> s = FindSession(session);
+    if (s == nullptr) {
+      (*status) = 1;
+      return;
     }
-    catch (...) {
-      (*status) = 2;
+    lock_guard<mutex> lock(s->session_mutex);
+    SubmitEnergyGradient(*s, qmattypes, qmcoords, numqmatoms, mmcoords, mmcharges, nummmatoms,
+      globaltreatment, status);
+  }
+
+  void tc_session_test_(const int* session, int* done, int* status) {
+    shared_ptr<TCSession> s = FindSession(session);
+    if (s == nullptr) {
+      (*done) = 0;
+      (*status) = 1;
       return;
     }
-    // If all is done, then done
-    (*status) = 0;
+    lock_guard<mutex> lock(s->session_mutex);
+    Test(*s, done, status);
   }
 
-  void tc_get_qm_charges_(double* qmcharges, int* status) {
-    //printf("Debug protobuf output string:\n%s\n", pb_output->GetDebugString().c_str());
-    try {
-      pb_output->GetCharges(qmcharges);
+  void tc_session_wait_energy_gradient_(const int* session, double* totenergy, double* qmgrad,
+    double* mmgrad, int* status) {
+    shared_ptr<TCSession> s = FindSession(session);
+    if (s == nullptr) {
+      (*status) = 1;
+      return;
     }
-    catch (...) {
+    lock_guard<mutex> lock(s->session_mutex);
+    WaitEnergyGradient(*s, totenergy, qmgrad, mmgrad, status);
+  }
+
+  void tc_session_start_energy_gradient_(const int* session, const char qmattypes[][5],
+    const double* qmcoords, const int* numqmatoms, const double* mmcoords, const double* mmcharges,
+    const int* nummmatoms, const int* globaltreatment, int* status) {
+    shared_ptr<TCSession> s = FindSession(session);
+    if (s == nullptr) {
       (*status) = 1;
       return;
     }
-    // If all is done, then done
-    (*status) = 0;
+    lock_guard<mutex> lock(s->session_mutex);
+    StartEnergyGradient(*s, qmattypes, qmcoords, numqmatoms, mmcoords, mmcharges, nummmatoms,
+      globaltreatment, status);
   }
 
-  void tc_finalize_() {
-    if (TC != nullptr) {
-      delete TC;
-      TC = nullptr;
+  void tc_session_progress_(const int* session, int* state, int* fd, int* events, int* timeout, int* status) {
+    shared_ptr<TCSession> s = FindSession(session);
+    if (s == nullptr) {
+      (*status) = 1;
+      return;
     }
-    if (pb_input != nullptr) {
-      delete pb_input;
-      pb_input = nullptr;
+    lock_guard<mutex> lock(s->session_mutex);
+    Progress(*s, state, fd, events, timeout, status);
+  }
+
+  void tc_session_collect_energy_gradient_(const int* session, double* totenergy, double* qmgrad,
+    double* mmgrad, int* status) {
+    shared_ptr<TCSession> s = FindSession(session);
+    if (s == nullptr) {
+      (*status) = 1;
+      return;
     }
-    if (pb_output != nullptr) {
-      delete pb_output;
-      pb_output = nullptr;
+    lock_guard<mutex> lock(s->session_mutex);
+    CollectEnergyGradient(*s, totenergy, qmgrad, mmgrad, status);
+  }
+
+  void tc_session_get_qm_charges_(const int* session, double* qmcharges, int* status) {
+    shared_ptr<TCSession> s = FindSession(session);
+    if (s == nullptr) {
+      (*status) = 1;
+      return;
     }
+    lock_guard<mutex> lock(s->session_mutex);
+    GetQMCharges(*s, qmcharges, status);
+  }
+
+  void tc_session_destroy_(const int* session) {
+    // A call still running on the session keeps it alive until it returns
+    lock_guard<mutex> lock(sessions_mutex);
+    if (session != nullptr)
+      sessions.erase(*session);
   }
 
 } // extern "C"
@@ -49,13 +49,50 @@ extern "C" {
    *                                               1, always use NEW_CONDITION as the mode of execution
    *                                               2, always use NORMAL as the mode of execution
    * @param[out] status Status of execution: 0, all is good
-   *                                         1, mismatch in the variables passed to the function
+   *                                         1, mismatch in the variables passed to the function or a submitted job is pending
    *                                         2, calculation failed
    **/
   void tc_compute_energy_gradient_(const char qmattypes[][5], const double* qmcoords, const int* numqmatoms,
     double* totenergy, double* qmgrad, const double* mmcoords, const double* mmcharges,
     const int* nummmatoms, double* mmgrad, const int* globaltreatment, int* status);
 
+  /**
+   * \brief Start an energy and gradient calculation without waiting for it
+   *
+   * The coordinates are copied, so the caller may change them (e.g. to compute MM forces or
+   * build pair lists) while the server works. Collect the result with tc_wait_energy_gradient_.
+   * Only one job may be pending; tc_compute_energy_gradient_ fails until it is collected.
+   *
+   * Arguments are the inputs of tc_compute_energy_gradient_.
+   * @param[out] status Status of execution: 0, all is good
+   *                                         1, mismatch in the variables passed to the function or a job is already pending
+   *                                         2, could not submit the job
+   **/
+  void tc_submit_energy_gradient_(const char qmattypes[][5], const double* qmcoords, const int* numqmatoms,
+    const double* mmcoords, const double* mmcharges, const int* nummmatoms, const int* globaltreatment,
+    int* status);
+
+  /**
+   * \brief Check whether the job from tc_submit_energy_gradient_ is finished, without blocking
+   *
+   * @param[out] done 1 if tc_wait_energy_gradient_ would return right away, 0 otherwise
+   * @param[out] status Status of execution: 0, all is good
+   *                                         1, no job is pending
+   **/
+  void tc_test_(int* done, int* status);
+
+  /**
+   * \brief Wait for the job from tc_submit_energy_gradient_ and collect its results
+   *
+   * @param[out] totenergy Total energy of the QM in the presence of the MM region (unit: Hartrees)
+   * @param[out] qmgrad Gradient of the atoms in the QM region (unit: Hartree/Bohr)
+   * @param[out] mmgrad Gradient of the atoms in the MM region, needed if the job had MM atoms (unit: Hartree/Bohr)
+   * @param[out] status Status of execution: 0, all is good
+   *                                         1, no job is pending or mismatch in the variables passed to the function
+   *                                         2, calculation failed (the job is collected anyway)
+   **/
+  void tc_wait_energy_gradient_(double* totenergy, double* qmgrad, double* mmgrad, int* status);
+
   /**
    * \brief Gets the charges of the atoms in the QM region. Must be ran after tc_compute_energy_gradient_.
    *\
@@ -70,6 +107,144 @@ extern "C" {
    **/
   void tc_finalize_();
 
+  /*
+   * Handle-based sessions
+   *
+   * The functions above drive a single QM region on a single server. Each session below has its
+   * own client, input template and NEW_CONDITION/CONTINUE tracking, so one process can drive
+   * several servers. Calls on different sessions may run at the same time from different threads
+   * (e.g. OpenMP); calls on the same session are serialized.
+   */
+
+  /**
+   * \brief Creates a session and connects it to a TeraChem server
+   *
+   * @param[in]  host Address of the host
+   * @param[in]  port Port number
+   * @param[out] session Handle of the new session (0 if the connection failed)
+   * @param[out] status Status of execution: 0, all is good;
+   *                                         1, could not connect to server;
+   *                                         2, connected to server but it is not available
+   **/
+  void tc_session_create_(const char host[80], const int* port, int* session, int* status);
+
+  /**
+   * \brief Setup the TeraChem protobuf input of a session, like tc_setup_
+   *
+   * @param[in]  session Session handle from tc_session_create_
+   * @param[in]  tcfile Path to the TeraChem input file
+   * @param[in]  qmattypes List of atomic types in the QM region
+   * @param[in]  numqmatoms Number of atoms in the QM region
+   * @param[out] status Status of execution: 0, all is good
+   *                                         1, unknown session, no options read from tcfile or mismatch in the input variables
+   *                                         2, failed to setup
+   **/
+  void tc_session_setup_(const int* session, const char tcfile[256], const char qmattypes[][5],
+    const int* numqmatoms, int* status);
+
+  /**
+   * \brief Compute energy and gradient on the server of a session, like tc_compute_energy_gradient_
+   *
+   * @param[in]  session Session handle from tc_session_create_
+   * Other arguments and status values as in tc_compute_energy_gradient_ (status 1 also for an unknown session)
+   **/
+  void tc_session_compute_energy_gradient_(const int* session, const char qmattypes[][5],
+    const double* qmcoords, const int* numqmatoms, double* totenergy, double* qmgrad,
+    const double* mmcoords, const double* mmcharges, const int* nummmatoms, double* mmgrad,
+    const int* globaltreatment, int* status);
+
+  /**
+   * \brief Start an energy and gradient calculation on a session, like tc_submit_energy_gradient_
+   *
+   * @param[in]  session Session handle from tc_session_create_
+   * Other arguments and status values as in tc_submit_energy_gradient_ (status 1 also for an unknown session)
+   **/
+  void tc_session_submit_energy_gradient_(const int* session, const char qmattypes[][5],
+    const double* qmcoords, const int* numqmatoms, const double* mmcoords, const double* mmcharges,
+    const int* nummmatoms, const int* globaltreatment, int* status);
+
+  /**
+   * \brief Check whether the pending job of a session is finished, like tc_test_
+   *
+   * @param[in]  session Session handle from tc_session_create_
+   * Other arguments and status values as in tc_test_ (status 1 also for an unknown session)
+   **/
+  void tc_session_test_(const int* session, int* done, int* status);
+
+  /**
+   * \brief Wait for the pending job of a session and collect its results, like tc_wait_energy_gradient_
+   *
+   * @param[in]  session Session handle from tc_session_create_
+   * Other arguments and status values as in tc_wait_energy_gradient_ (status 1 also for an unknown session)
+   **/
+  void tc_session_wait_energy_gradient_(const int* session, double* totenergy, double* qmgrad,
+    double* mmgrad, int* status);
+
+  /*
+   * Non-blocking sessions
+   *
+   * For callers with an event loop (e.g. Python asyncio): tc_session_start_energy_gradient_ starts a
+   * job without sending anything, and each tc_session_progress_ call moves it on as far as it goes
+   * without blocking, then tells which file descriptor to watch, for what, and for how long.
+   * Many sessions can be driven this way from one thread.
+   */
+
+  /**
+   * \brief Start a non-blocking energy and gradient calculation on a session
+   *
+   * The coordinates are copied. Only one job may be started, submitted or running per session.
+   * After a failed job, this first reconnects the session, which blocks (see tc_session_progress_).
+   *
+   * @param[in]  session Session handle from tc_session_create_
+   * Other arguments and status values as in tc_submit_energy_gradient_ (status 1 also for an unknown session)
+   **/
+  void tc_session_start_energy_gradient_(const int* session, const char qmattypes[][5],
+    const double* qmcoords, const int* numqmatoms, const double* mmcoords, const double* mmcharges,
+    const int* nummmatoms, const int* globaltreatment, int* status);
+
+  /**
+   * \brief Move the job from tc_session_start_energy_gradient_ on, without blocking
+   *
+   * A failed job may leave the connection mid-message. It is not reconnected here, since that blocks,
+   * but by the next job on the session (e.g. tc_session_start_energy_gradient_ run off the event loop).
+   *
+   * @param[in]  session Session handle from tc_session_create_
+   * @param[out] state 0, in progress; 1, complete; 2, failed (collect it with tc_session_collect_energy_gradient_)
+   * @param[out] fd Socket file descriptor to watch while in progress
+   * @param[out] events Poll events to watch fd for (POLLIN and/or POLLOUT), 0 to wait for the timeout only
+   * @param[out] timeout Milliseconds after which to call again even if fd is not ready, -1 for no limit
+   * @param[out] status Status of execution: 0, all is good
+   *                                         1, unknown session or no job was started
+   **/
+  void tc_session_progress_(const int* session, int* state, int* fd, int* events, int* timeout, int* status);
+
+  /**
+   * \brief Collect the results of the job from tc_session_start_energy_gradient_ once it is finished
+   *
+   * @param[in]  session Session handle from tc_session_create_
+   * Other arguments and status values as in tc_wait_energy_gradient_ (status 1 also for an unknown session
+   * or a job that is still in progress)
+   **/
+  void tc_session_collect_energy_gradient_(const int* session, double* totenergy, double* qmgrad,
+    double* mmgrad, int* status);
+
+  /**
+   * \brief Gets the charges of the atoms in the QM region from the last calculation of a session
+   *
+   * @param[in]  session Session handle from tc_session_create_
+   * @param[out] qmccharges Charges of the atoms in the QM region (unit: atomic units)
+   * @param[out] status Status of execution: 0, all is good
+   *                                         1, unknown session or calculation failed
+   **/
+  void tc_session_get_qm_charges_(const int* session, double* qmcharges, int* status);
+
+  /**
+   * \brief Disconnects a session and deletes its variables
+   *
+   * @param[in]  session Session handle from tc_session_create_
+   **/
+  void tc_session_destroy_(const int* session);
+
 } // extern "C"
 
 #endif
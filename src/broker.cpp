@@ -0,0 +1,286 @@
+/** \file broker.cpp
+ *  \brief Implementation of Broker class
+ */
+
+#include <exception>
+using std::exception;
+#include <map>
+using std::map;
+#include <memory>
+using std::make_shared;
+using std::shared_ptr;
+#include <mutex>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+#include "broker.h"
+#include "terachem_server.pb.h"
+using terachem_server::JobInput;
+using terachem_server::Status;
+
+namespace TCPB {
+
+Broker::Broker(int port,
+  const vector<ClientPool::Endpoint> &servers,
+  const ClientOptions &options,
+  int numWorkers,
+  const SchedulerOptions &scheduling) :
+  EpollServerSocket(port, numWorkers, false),
+  scheduler_(scheduling),
+  running_(0),
+  nextJobId_(1),
+  stopping_(false),
+  dispatchPending_(false),
+  pool_(servers, options)
+{
+  dispatchThread_ = std::thread(&Broker::RunDispatcher, this);
+  StartEpollLoop(numWorkers);
+}
+
+Broker::Broker(const string &path,
+  const vector<ClientPool::Endpoint> &servers,
+  const ClientOptions &options,
+  int numWorkers,
+  const SchedulerOptions &scheduling) :
+  EpollServerSocket(path, numWorkers, false),
+  scheduler_(scheduling),
+  running_(0),
+  nextJobId_(1),
+  stopping_(false),
+  dispatchPending_(false),
+  pool_(servers, options)
+{
+  dispatchThread_ = std::thread(&Broker::RunDispatcher, this);
+  StartEpollLoop(numWorkers);
+}
+
+Broker::~Broker()
+{
+  Stop();
+
+  // Jobs cancelled by the pool destructor must not forward anything else
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+    jobs_.clear();
+  }
+  dispatchCond_.notify_one();
+  dispatchThread_.join();
+}
+
+int Broker::GetQueueLength()
+{
+  lock_guard<mutex> lock(mutex_);
+  return (int)scheduler_.Size();
+}
+
+int Broker::GetRunning()
+{
+  lock_guard<mutex> lock(mutex_);
+  return running_;
+}
+
+vector<ClassStats> Broker::GetWaitStats()
+{
+  lock_guard<mutex> lock(mutex_);
+  return scheduler_.GetWaitStats();
+}
+
+void Broker::SetTenantWeight(const string &tenant,
+  double weight)
+{
+  lock_guard<mutex> lock(mutex_);
+  scheduler_.SetWeight(tenant, weight);
+}
+
+void Broker::WakeDispatcher()
+{
+  {
+    lock_guard<mutex> lock(mutex_);
+    dispatchPending_ = true;
+  }
+  dispatchCond_.notify_one();
+}
+
+void Broker::RunDispatcher()
+{
+  while (true) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      dispatchCond_.wait(lock, [this] { return stopping_ || dispatchPending_; });
+      if (stopping_) {
+        return;
+      }
+      dispatchPending_ = false;
+    }
+
+    DispatchJobs();
+  }
+}
+
+void Broker::DispatchJobs()
+{
+  while (true) {
+    shared_ptr<BrokerJob> job;
+    int session;
+
+    {
+      lock_guard<mutex> lock(mutex_);
+
+      // One job per server, so a job only waits here and never behind another one on a server
+      if (stopping_ || scheduler_.Size() == 0 || running_ >= pool_.GetNumServers()) {
+        return;
+      }
+      job = std::static_pointer_cast<BrokerJob>(scheduler_.Pop());
+
+      // Trajectories stay on one server, a new one may start anywhere
+      JobInput::MDGlobalTreatment mdType = job->input.GetPB().md_global_type();
+      session = (mdType == JobInput::NORMAL ? -1 : job->connId);
+      if (mdType == JobInput::NEW_CONDITION) {
+        pool_.ReleaseSession(job->connId);
+      }
+
+      running_++;
+    }
+
+    // Picking a server takes round trips, so no lock is held here.
+    // The server is busy until it is done with the job, even if the job was cancelled.
+    JobHandle handle;
+    try {
+      handle = pool_.Submit(job->input, session, [this]() {
+        {
+          lock_guard<mutex> lock(mutex_);
+          running_--;
+        }
+        WakeDispatcher();
+      });
+    } catch (const exception &e) {
+      SocketLog("Could not forward job %d: %s", job->id, e.what());
+      shared_ptr<JobState> state = make_shared<JobState>(job->input, false);
+      FinishJob(state, JobState::FAILED, Output(), std::current_exception());
+      handle = JobHandle(state);
+
+      lock_guard<mutex> lock(mutex_);
+      running_--;
+    }
+
+    bool orphaned;
+    {
+      lock_guard<mutex> lock(mutex_);
+      job->handle = handle;
+      map<int, shared_ptr<BrokerJob> >::const_iterator it = jobs_.find(job->connId);
+      orphaned = (it == jobs_.end() || it->second != job);
+    }
+
+    // The connection closed while the job was being forwarded
+    if (orphaned) {
+      handle.Cancel();
+    }
+  }
+}
+
+bool Broker::HandleClientMessage(int connId,
+  const FramedMessage &request,
+  vector<FramedMessage> &replies)
+{
+  Status status;
+  string msg;
+  JobHandle handle;
+
+  if (request.type == terachem_server::JOBINPUT) {
+    JobInput pb;
+    if (!pb.ParseFromString(request.payload)) {
+      SocketLog("Could not parse job input from connection %d", connId);
+      return false;
+    }
+
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (jobs_.count(connId)) {
+        // Like a server, one job at a time per client
+        status.set_busy(true);
+      } else {
+        shared_ptr<BrokerJob> job = make_shared<BrokerJob>(nextJobId_++, connId, Input(pb));
+        jobs_[connId] = job;
+        scheduler_.Push(job);
+        status.set_accepted(true);
+        status.set_server_job_id(job->id);
+      }
+    }
+    WakeDispatcher();
+
+    status.SerializeToString(&msg);
+    replies.push_back(FramedMessage(terachem_server::STATUS, msg));
+  } else if (request.type == terachem_server::STATUS) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      map<int, shared_ptr<BrokerJob> >::iterator it = jobs_.find(connId);
+      if (it == jobs_.end()) {
+        // Jobs are queued, so the broker is always ready for one
+        status.set_busy(false);
+      } else if (!it->second->handle.Valid() || !it->second->handle.Ready()) {
+        status.set_busy(true);
+        status.set_working(true);
+        status.set_server_job_id(it->second->id);
+      } else {
+        status.set_server_job_id(it->second->id);
+        handle = it->second->handle;
+        jobs_.erase(it);
+      }
+    }
+
+    if (handle.Valid() && handle.GetStatus() == JobState::DONE) {
+      string output;
+      status.set_completed(true);
+      handle.Get().GetOutputPB().SerializeToString(&output);
+      status.SerializeToString(&msg);
+      replies.push_back(FramedMessage(terachem_server::STATUS, msg));
+      replies.push_back(FramedMessage(terachem_server::JOBOUTPUT, output));
+    } else {
+      // A failed job has no output, the client sees a status without a job state
+      if (handle.Valid()) {
+        try {
+          handle.Get();
+        } catch (const exception &e) {
+          SocketLog("Job %d of connection %d failed: %s", status.server_job_id(), connId,
+            e.what());
+        }
+      }
+      status.SerializeToString(&msg);
+      replies.push_back(FramedMessage(terachem_server::STATUS, msg));
+    }
+  } else {
+    SocketLog("Unexpected message type %d from connection %d", request.type, connId);
+    return false;
+  }
+
+  return true;
+}
+
+void Broker::HandleClientDisconnect(int connId)
+{
+  JobHandle handle;
+
+  {
+    lock_guard<mutex> lock(mutex_);
+    map<int, shared_ptr<BrokerJob> >::iterator it = jobs_.find(connId);
+    if (it != jobs_.end()) {
+      scheduler_.Remove(it->second);
+      handle = it->second->handle;
+      jobs_.erase(it);
+    }
+  }
+
+  // A running job is drained by its client in the background
+  if (handle.Valid()) {
+    handle.Cancel();
+  }
+  pool_.ReleaseSession(connId);
+}
+
+} // end namespace TCPB
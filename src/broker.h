@@ -0,0 +1,190 @@
+/** \file broker.h
+ *  \brief Definition of Broker class
+ */
+
+#ifndef TCPB_BROKER_H_
+#define TCPB_BROKER_H_
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "input.h"
+#include "pool.h"
+#include "scheduler.h"
+#include "socket.h"
+
+namespace TCPB {
+
+/**
+ * \brief TCPB broker that multiplexes many clients onto a pool of TeraChem servers
+ *
+ * Broker speaks the TCPB protocol to its clients like a TeraChem server does,
+ * so an unmodified Client can connect to it. Every connection may have one job at a time.
+ * Unlike a server, the broker never turns a job down because it is busy:
+ * jobs go into a JobScheduler queue, and are forwarded to the servers of a ClientPool
+ * (over persistent connections) as soon as one is free. While a job is queued or running,
+ * status requests get a working reply; once it is done, the output is sent back.
+ *
+ * Clients tag each JobInput with a priority class and a tenant (the priority and tenant fields).
+ * Untagged jobs are all in the lowest class of one tenant, which makes the queue plain FIFO.
+ *
+ * Jobs with NEW_CONDITION or CONTINUE stay on the server their connection first used,
+ * so an MD trajectory keeps its global state. A job whose connection closes is dropped,
+ * or cancelled and drained if it already reached a server.
+ * A server counts as busy until it is really done with a job, drained ones included.
+ * Jobs are forwarded by a dispatcher thread, so neither the epoll() loop
+ * nor the workers wait on round trips to the servers.
+ **/
+class Broker : public EpollServerSocket {
+public:
+  /**
+   * \brief Constructor for Broker class
+   *
+   * @param port Port to listen on for clients
+   * @param servers Hostname and port of each TeraChem server
+   * @param options Connection options for the servers
+   * @param numWorkers Number of threads handling client messages
+   * @param scheduling Priority classes, aging and tenant weights of the job queue
+   **/
+  Broker(int port,
+    const std::vector<ClientPool::Endpoint> &servers,
+    const ClientOptions &options = ClientOptions(),
+    int numWorkers = 4,
+    const SchedulerOptions &scheduling = SchedulerOptions());
+
+  /**
+   * \brief Constructor for Broker class on a Unix domain socket
+   *
+   * @param path Filesystem path of the socket to listen on for clients
+   * @param servers Hostname and port of each TeraChem server
+   * @param options Connection options for the servers
+   * @param numWorkers Number of threads handling client messages
+   * @param scheduling Priority classes, aging and tenant weights of the job queue
+   **/
+  Broker(const std::string &path,
+    const std::vector<ClientPool::Endpoint> &servers,
+    const ClientOptions &options = ClientOptions(),
+    int numWorkers = 4,
+    const SchedulerOptions &scheduling = SchedulerOptions());
+
+  /**
+   * \brief Destructor for Broker
+   *
+   * Closes all client connections and abandons their jobs.
+   **/
+  ~Broker();
+
+  /**
+   * \brief Get the number of jobs waiting for a free server
+   *
+   * @return Queued jobs
+   **/
+  int GetQueueLength();
+
+  /**
+   * \brief Get the number of jobs forwarded to the servers and not finished yet
+   *
+   * @return Running jobs
+   **/
+  int GetRunning();
+
+  /**
+   * \brief Get how long jobs waited in the queue
+   *
+   * @return Wait statistics for each priority class, lowest class first
+   **/
+  std::vector<ClassStats> GetWaitStats();
+
+  /**
+   * \brief Change the fair-share weight of a tenant
+   *
+   * @param tenant Tenant name
+   * @param weight Relative share of the servers (must be positive)
+   **/
+  void SetTenantWeight(const std::string &tenant,
+    double weight);
+
+  /**
+   * \brief Get the server pool, e.g. to look at its statistics
+   *
+   * @return ClientPool the jobs are forwarded to
+   **/
+  ClientPool &GetPool() {
+    return pool_;
+  }
+
+protected:
+  /**
+   * \brief A client job, from the moment it is accepted until its output is picked up
+   **/
+  struct BrokerJob : public ScheduledJob {
+    int id;           //!< Job id reported to the client
+    int connId;       //!< Connection that submitted the job
+    Input input;      //!< Job input, kept until the job is forwarded
+    JobHandle handle; //!< Handle from the pool, once forwarded
+
+    BrokerJob(int id,
+      int connId,
+      const Input &input) :
+      ScheduledJob(input.GetPB().priority(), input.GetPB().tenant()),
+      id(id),
+      connId(connId),
+      input(input) {}
+  };
+
+  std::mutex mutex_;                                    //!< Guards everything below except pool_
+  std::map<int, std::shared_ptr<BrokerJob> > jobs_;     //!< Current job of each connection
+  JobScheduler scheduler_;                              //!< Jobs waiting for a free server
+  int running_;                                         //!< Jobs forwarded and not settled by their server
+  int nextJobId_;                                       //!< Id of the next accepted job
+  bool stopping_;                                       //!< Set by the destructor, stops forwarding
+  bool dispatchPending_;                                //!< Whether the dispatcher should look at the queue
+  std::condition_variable dispatchCond_;                //!< Wakes the dispatcher
+  std::thread dispatchThread_;                          //!< Forwards queued jobs to the pool
+  ClientPool pool_;                                     //!< Servers (last, so it goes first on destruction)
+
+  /**
+   * \brief Have the dispatcher thread look for jobs to forward
+   **/
+  void WakeDispatcher();
+
+  /**
+   * \brief Body of the dispatcher thread: forward queued jobs whenever a server frees up
+   **/
+  void RunDispatcher();
+
+  /**
+   * \brief Forward queued jobs while there are free servers
+   *
+   * Called on the dispatcher thread only.
+   **/
+  void DispatchJobs();
+
+  /**
+   * \brief Answer a status request or job input from a client
+   *
+   * @param connId Id of the connection that sent the message
+   * @param request Complete incoming message
+   * @param replies Status message, and job output for a completed job
+   * @return False to close the connection (unexpected or unparsable messages)
+   **/
+  virtual bool HandleClientMessage(int connId,
+    const FramedMessage &request,
+    std::vector<FramedMessage> &replies);
+
+  /**
+   * \brief Drop or cancel the job of a closed connection
+   *
+   * @param connId Id of the closed connection
+   **/
+  virtual void HandleClientDisconnect(int connId);
+}; // end class Broker
+
+} // end namespace TCPB
+
+#endif
@@ -2,92 +2,127 @@
  *  \brief Implementation of TCPB::Client class
  */
 
+#include <algorithm>
+using std::min;
 #include <arpa/inet.h> // For htonl()/ntohl()
+#include <chrono>
+#include <poll.h> // For POLLIN/POLLOUT
+#include <stdio.h> // For snprintf()
+#include <string.h> // For memcpy()
 #include <string>
 using std::string;
-#include <unistd.h> //For sleep()
+#include <unistd.h> //For usleep()
+#include <utility>
+#include <vector>
+
+#include <google/protobuf/field_mask.pb.h>
+#include <google/protobuf/util/field_mask_util.h>
 
 #include "exceptions.h"
 #include "client.h"
 #include "input.h"
 #include "output.h"
+#include "shm.h"
 #include "socket.h"
 #include "terachem_server.pb.h"
 using terachem_server::JobInput;
 using terachem_server::JobOutput;
+using terachem_server::SharedArray;
 using terachem_server::Status;
 
 namespace TCPB {
 
 Client::Client(string host,
-  int port)
+  int port,
+  const ClientOptions &options)
 {
   host_ = host;
   port_ = port;
-  socket_ = new ClientSocket(host, port);
+  options_ = options;
+  socket_ = new ClientSocket(host, port, options);
+  shm_ = nullptr;
+  useShm_ = false;
+  useArena_ = false;
+  stopIO_ = false;
+  abortJob_ = false;
+  drainPending_ = false;
+
+  asyncStep_ = ASYNC_IDLE;
+  asyncOutPos_ = 0;
+  asyncInPos_ = 0;
+  asyncBackoff_ = 0;
+  asyncChecks_ = 0;
 
   currJobDir_ = "";
   currJobScrDir_ = "";
   currJobId_ = -1;
 
-  prevResults_ = Output(terachem_server::JobOutput());
+  prevResults_ = Output();
+  prevStatusChecks_ = 0;
 }
 
 Client::~Client()
 {
+  std::deque<std::shared_ptr<JobState> > queue;
+
+  // Stop the I/O thread, abandoning whatever it is waiting on
+  {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    stopIO_ = true;
+    std::swap(queue, queue_);
+  }
+  abortJob_ = true;
+  queueCond_.notify_all();
+  if (ioThread_.joinable()) {
+    ioThread_.join();
+  }
+
+  for (size_t i = 0; i < queue.size(); i++) {
+    FinishJob(queue[i], JobState::CANCELLED);
+    if (queue[i]->settled) {
+      queue[i]->settled();
+    }
+  }
+
   delete socket_;
+  delete shm_;
 }
 
 /************************
  * SERVER COMMUNICATION *
  ************************/
 
-bool Client::IsAvailable()
+bool Client::IsAvailable(bool wait)
 {
-  uint32_t header[2];
+  std::unique_lock<std::recursive_mutex> lock(ioMutex_, std::defer_lock);
   int msgType, msgSize;
-  string msgStr;
-  bool sendSuccess, recvSuccess;
+  bool sendSuccess;
+
+  // The connection is in use by a job, so the server is busy with it
+  if (wait) {
+    lock.lock();
+  } else if (!lock.try_lock()) {
+    return false;
+  }
 
   // Send Status Protocol Buffer
-  msgType = terachem_server::STATUS;
-  msgSize = 0;
-  header[0] = htonl((uint32_t)msgType);
-  header[1] = htonl((uint32_t)msgSize);
-  sendSuccess = socket_->HandleSend((char *)header, sizeof(header),
-      "IsAvailable() status header");
-  if (!sendSuccess) throw ServerCommError(
+  sendSuccess = socket_->HandleSendMessage(terachem_server::STATUS, NULL, 0,
+      "IsAvailable() status");
+  if (!sendSuccess) throw ServerConnectionError(
       "IsAvailable: Could not send status header",
       host_, port_, currJobDir_, currJobId_);
 
   // Receive Status Protocol Buffer
-  recvSuccess = socket_->HandleRecv((char *)header, sizeof(header),
-      "IsAvailable() status header");
-  if (!recvSuccess) throw ServerCommError(
-      "IsAvailable: Could not recv status header",
-      host_, port_, currJobDir_, currJobId_);
-
-  msgType = ntohl(header[0]);
-  msgSize = ntohl(header[1]);
+  RecvMessage("IsAvailable", "status", msgType, msgSize);
 
-  char msg[msgSize];
-  if (msgSize > 0) {
-    recvSuccess = socket_->HandleRecv(msg, sizeof(msg),
-        "IsAvailable() status protobuf");
-    if (!recvSuccess) throw ServerCommError(
-        "IsAvailable: Could not recv status protobuf",
-        host_, port_, currJobDir_, currJobId_);
-  }
-
-  if (header[0] != terachem_server::STATUS) throw ServerCommError(
+  if (msgType != terachem_server::STATUS) throw ServerCommError(
       "IsAvailable: Did not get the expected status message",
       host_, port_, currJobDir_, currJobId_);
 
   Status status;
-  if (msgSize > 0) {
-    msgStr.resize(msgSize);
-    memcpy((void *)msgStr.data(), msg, msgSize);
-    status.ParseFromString(msgStr);
+  if (msgSize > 0 && !status.ParseFromArray(recvBuf_.data(), msgSize)) {
+    throw ServerCommError("IsAvailable: Could not parse status protobuf",
+      host_, port_, currJobDir_, currJobId_);
   }
 
   return !status.busy();
@@ -95,63 +130,40 @@ bool Client::IsAvailable()
 
 bool Client::SendJobAsync(const Input &input)
 {
-  uint32_t header[2];
-  bool sendSuccess, recvSuccess;
-  int msgType, msgSize;
-  string msgStr;
-  const JobInput pb = input.GetPB();
+  std::lock_guard<std::recursive_mutex> lock(ioMutex_);
+  int msgSize;
 
-  msgType = terachem_server::JOBINPUT;
-  msgSize = pb.ByteSize();
-  pb.SerializeToString(&msgStr);
+  // Serialize straight into the pooled send buffer
+  msgSize = SerializeJobInput(input.GetPB());
 
-  // Send JobInput Protocol Buffer
-  header[0] = htonl((uint32_t)msgType);
-  header[1] = htonl((uint32_t)msgSize);
-  sendSuccess = socket_->HandleSend((char *)header, sizeof(header),
-      "SendJobAsync() job input header");
-  if (!sendSuccess) throw ServerCommError(
-      "SendJobAsync: Could not send job input header",
-      host_, port_, currJobDir_, currJobId_);
+  return SendSerializedJob(sendBuf_.data(), msgSize);
+}
 
-  if (msgSize) {
-    char msg[msgSize];
-    memcpy(msg, (void *)msgStr.data(), msgSize);
-    sendSuccess = socket_->HandleSend(msg, msgSize,
-        "SendJobAsync() job input protobuf");
-    if (!sendSuccess) throw ServerCommError(
-        "SendJobAsync: Could not send job input protobuf",
-        host_, port_, currJobDir_, currJobId_);
-  }
+bool Client::SendSerializedJob(const char *buf,
+  int len)
+{
+  std::lock_guard<std::recursive_mutex> lock(ioMutex_);
+  bool sendSuccess;
+  int msgType, msgSize;
 
-  // Receive Status Protocol Buffer
-  recvSuccess = socket_->HandleRecv((char *)header, sizeof(header),
-      "SendJobAsync() status header");
-  if (!recvSuccess) throw ServerCommError(
-      "SendJobAsync: Could not recv status header",
+  // Send JobInput Protocol Buffer, header and payload together
+  sendSuccess = socket_->HandleSendMessage(terachem_server::JOBINPUT,
+      buf, len, "SendJobAsync() job input");
+  if (!sendSuccess) throw ServerConnectionError(
+      "SendJobAsync: Could not send job input protobuf",
       host_, port_, currJobDir_, currJobId_);
 
-  msgType = ntohl(header[0]);
-  msgSize = ntohl(header[1]);
-
-  char msg[msgSize];
-  if (msgSize > 0) {
-    recvSuccess = socket_->HandleRecv(msg, sizeof(msg),
-        "SendJobAsync() status protobuf");
-    if (!recvSuccess) throw ServerCommError(
-        "SendJobAsync: Could not recv status protobuf",
-        host_, port_, currJobDir_, currJobId_);
-  }
+  // Receive Status Protocol Buffer
+  RecvMessage("SendJobAsync", "status", msgType, msgSize);
 
   if (msgType != terachem_server::STATUS) throw ServerCommError(
       "SendJobAsync: Did not get the expected status message",
       host_, port_, currJobDir_, currJobId_);
 
   Status status;
-  if (msgSize > 0) {
-    msgStr.resize(msgSize);
-    memcpy((void *)msgStr.data(), msg, msgSize);
-    status.ParseFromString(msgStr);
+  if (msgSize > 0 && !status.ParseFromArray(recvBuf_.data(), msgSize)) {
+    throw ServerCommError("SendJobAsync: Could not parse status protobuf",
+      host_, port_, currJobDir_, currJobId_);
   }
 
   if (status.job_status_case() != Status::JobStatusCase::kAccepted) {
@@ -167,51 +179,28 @@ bool Client::SendJobAsync(const Input &input)
 
 bool Client::CheckJobComplete()
 {
-  uint32_t header[2];
+  std::lock_guard<std::recursive_mutex> lock(ioMutex_);
   int msgType, msgSize;
-  bool sendSuccess, recvSuccess;
-  string msgStr;
+  bool sendSuccess;
 
   // Send Status Protocol Buffer
-  msgType = terachem_server::STATUS;
-  msgSize = 0;
-
-  header[0] = htonl((uint32_t)msgType);
-  header[1] = htonl((uint32_t)msgSize);
-  sendSuccess = socket_->HandleSend((char *)header, sizeof(header),
-      "CheckJobComplete() status header");
-  if (!sendSuccess) throw ServerCommError(
+  sendSuccess = socket_->HandleSendMessage(terachem_server::STATUS, NULL, 0,
+      "CheckJobComplete() status");
+  if (!sendSuccess) throw ServerConnectionError(
       "CheckJobComplete: Could not send status header",
       host_, port_, currJobDir_, currJobId_);
 
   // Receive Status Protocol Buffer
-  recvSuccess = socket_->HandleRecv((char *)header, sizeof(header),
-      "CheckJobComplete() status header");
-  if (!recvSuccess) throw ServerCommError(
-      "CheckJobComplete: Could not recv status header",
-      host_, port_, currJobDir_, currJobId_);
-
-  msgType = ntohl(header[0]);
-  msgSize = ntohl(header[1]);
-
-  char msg[msgSize];
-  if (msgSize > 0) {
-    recvSuccess = socket_->HandleRecv(msg, sizeof(msg),
-        "CheckJobComplete() status protobuf");
-    if (!recvSuccess) throw ServerCommError(
-        "CheckJobComplete: Could not recv status protobuf",
-        host_, port_, currJobDir_, currJobId_);
-  }
+  RecvMessage("CheckJobComplete", "status", msgType, msgSize);
 
   if (msgType != terachem_server::STATUS) throw ServerCommError(
       "CheckJobComplete:  Did not get the expected status message",
       host_, port_, currJobDir_, currJobId_);
 
   Status status;
-  if (msgSize > 0) {
-    msgStr.resize(msgSize);
-    memcpy((void *)msgStr.data(), msg, msgSize);
-    status.ParseFromString(msgStr);
+  if (msgSize > 0 && !status.ParseFromArray(recvBuf_.data(), msgSize)) {
+    throw ServerCommError("CheckJobComplete: Could not parse status protobuf",
+      host_, port_, currJobDir_, currJobId_);
   }
 
   if (status.job_status_case() == Status::JobStatusCase::kWorking) {
@@ -224,124 +213,961 @@ bool Client::CheckJobComplete()
   return true;
 }
 
-const Output Client::RecvJobAsync()
+Output Client::RecvJobAsync()
 {
-  uint32_t header[2];
-  bool recvSuccess;
+  std::lock_guard<std::recursive_mutex> lock(ioMutex_);
   int msgType, msgSize;
-  string msgStr;
-  JobOutput pb;
 
   // Receive JobOutput Protocol Buffer
-  recvSuccess = socket_->HandleRecv((char *)header, sizeof(header),
-      "RecvJobAsync() job output header");
-  if (!recvSuccess) throw ServerCommError(
-      "RecvJobAsync: Could not recv job output header",
+  RecvMessage("RecvJobAsync", "job output", msgType, msgSize);
+
+  return ParseJobOutput("RecvJobAsync", msgType, msgSize);
+}
+
+Output Client::ParseJobOutput(const char *caller,
+  int msgType,
+  int msgSize)
+{
+  std::shared_ptr<JobOutput> pb;
+
+  if (msgType != terachem_server::JOBOUTPUT) {
+    throw ServerCommError(string(caller) + ": Did not get the expected job output message",
+      host_, port_, currJobDir_, currJobId_);
+  } else if (msgSize == 0) {
+    throw ServerCommError(string(caller) + ": Got empty job output message",
+      host_, port_, currJobDir_, currJobId_);
+  }
+
+  std::shared_ptr<OutputArena> arena;
+  if (useArena_) {
+    arena = AcquireArena();
+  }
+  if (arena != nullptr) {
+    // The Output shares ownership of the arena and its block, which live as long as any copy of it
+    JobOutput *msg = google::protobuf::Arena::CreateMessage<JobOutput>(&arena->arena);
+    pb = std::shared_ptr<JobOutput>(arena, msg);
+  } else {
+    pb = std::make_shared<JobOutput>();
+  }
+
+  // Parse straight out of the receive buffer, no intermediate string
+  if (!pb->ParseFromArray(recvBuf_.data(), msgSize)) {
+    throw ServerCommError(string(caller) + ": Could not parse job output protobuf",
+      host_, port_, currJobDir_, currJobId_);
+  }
+
+  // Pick up the MM gradient if the server left it in shared memory
+  if (pb->has_shm_mmatom_gradient()) {
+    const SharedArray &array = pb->shm_mmatom_gradient();
+    if (shm_ == nullptr) throw ServerCommError(
+        string(caller) + ": Got a shared memory gradient without a shared memory region",
+        host_, port_, currJobDir_, currJobId_);
+
+    const double *grad = shm_->GetDoubles(array.offset(), array.size());
+    pb->mutable_mmatom_gradient()->Resize(array.size(), 0.0);
+    memcpy(pb->mutable_mmatom_gradient()->mutable_data(), grad,
+      array.size() * sizeof(double));
+  }
+
+  return Output(std::shared_ptr<const JobOutput>(pb));
+}
+
+static google::protobuf::ArenaOptions FirstBlockOptions(std::vector<char> &block)
+{
+  google::protobuf::ArenaOptions options;
+  options.initial_block = block.data();
+  options.initial_block_size = block.size();
+  return options;
+}
+
+Client::OutputArena::OutputArena(size_t size) :
+  block(size),
+  arena(FirstBlockOptions(block))
+{
+}
+
+std::shared_ptr<Client::OutputArena> Client::AcquireArena()
+{
+  // Up to two jobs back may still be referenced (e.g. the caller's copy of the previous output)
+  const size_t maxArenas = 3;
+  const size_t minBlock = 64 * 1024;
+
+  for (size_t i = 0; i < maxArenas; i++) {
+    if (i == arenas_.size()) {
+      arenas_.push_back(std::make_shared<OutputArena>(minBlock));
+      return arenas_[i];
+    } else if (arenas_[i].use_count() > 1) {
+      continue;
+    }
+
+    // Grow the first block to fit what the last output needed, so it does not spill onto the heap
+    size_t needed = arenas_[i]->arena.SpaceAllocated();
+    if (needed > arenas_[i]->block.size()) {
+      arenas_[i].reset();
+      arenas_[i] = std::make_shared<OutputArena>(needed + needed / 2);
+    } else {
+      arenas_[i]->arena.Reset();
+    }
+
+    return arenas_[i];
+  }
+
+  return nullptr;
+}
+
+Output Client::ComputeJobSync(const Input &input)
+{
+  return ComputeJobSync(input, waitPolicy_);
+}
+
+void Client::Reconnect()
+{
+  std::lock_guard<std::recursive_mutex> lock(ioMutex_);
+  using std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  steady_clock::time_point start = steady_clock::now();
+  ClientSocket *socket = nullptr;
+  long elapsed;
+  int delay = options_.reconnectDelay;
+
+  for (int attempt = 0; socket == nullptr; attempt++) {
+    try {
+      socket = new ClientSocket(host_, port_, options_);
+    } catch (const std::runtime_error &e) {
+      stats_.failedConnects++;
+      if (attempt + 1 >= options_.reconnectAttempts) throw ServerConnectionError(
+          string("Reconnect: Could not reconnect to the server (") + e.what() + ")",
+          host_, port_, currJobDir_, currJobId_);
+
+      usleep(1000L * delay);
+      delay *= 2;
+    }
+  }
+
+  delete socket_;
+  socket_ = socket;
+
+  elapsed = duration_cast<microseconds>(steady_clock::now() - start).count();
+  stats_.reconnects++;
+  stats_.reconnectTime += elapsed;
+  stats_.maxReconnectTime = std::max(stats_.maxReconnectTime, elapsed);
+}
+
+Output Client::ComputeJobSync(const Input &input,
+  const WaitPolicy &policy)
+{
+  return RunJob(input, nullptr, policy);
+}
+
+Output Client::RunJob(const Input &input,
+  const std::string *payload,
+  const WaitPolicy &policy,
+  int run,
+  JobState *job)
+{
+  std::lock_guard<std::recursive_mutex> lock(ioMutex_);
+  bool sent = false;
+  bool submitted = false;
+  bool completed = false;
+  bool resume = false;
+  int reconnects = 0;
+
+  // A job cancelled earlier has to be off the server first
+  DrainJob(policy, true);
+
+  while (true) {
+    try {
+      // After a reconnect, find out what became of the job
+      if (resume) {
+        resume = false;
+        submitted = ResumeJob(completed);
+        if (submitted) {
+          stats_.resumes++;
+        } else {
+          stats_.resubmits++;
+        }
+      }
+
+      // Try to submit job
+      if (!submitted) {
+        sent = true;
+        currJobId_ = -1;
+        int accepted = SubmitJob(input, payload, policy, run, job);
+        if (accepted < 0) {
+          // Cancelled while the server was busy, nothing of it is on the server
+          return Output();
+        } else if (accepted == 0) throw ServerCommError(
+            "ComputeJobSync: problem to submit the job",
+            host_, port_, currJobDir_, currJobId_);
+        submitted = true;
+      }
+
+      // Check for job completion
+      if (!completed) {
+        prevStatusChecks_ = WaitForJob(policy, job);
+        if (prevStatusChecks_ < 0) {
+          drainPending_ = true;
+          return Output();
+        }
+        completed = true;
+      }
+
+      // Let go of the previous output first, so its arena can take the new one
+      prevResults_ = Output();
+      prevResults_ = RecvJobAsync();
+      break;
+    } catch (const ServerConnectionError &) {
+      if (reconnects >= options_.maxReconnects) {
+        throw;
+      }
+      reconnects++;
+
+      Reconnect();
+      resume = sent;
+      submitted = false;
+      completed = false;
+    }
+  }
+
+  currJobDir_ = "";
+  currJobScrDir_ = "";
+  currJobId_ = -1;
+
+  return prevResults_;
+}
+
+// Every top-level JobInput field, except the MM arrays that go through shared memory
+static google::protobuf::FieldMask SharedMemoryControlMask()
+{
+  using google::protobuf::FieldDescriptor;
+
+  google::protobuf::FieldMask mask;
+  const google::protobuf::Descriptor *desc = JobInput::descriptor();
+  for (int i = 0; i < desc->field_count(); i++) {
+    const FieldDescriptor *field = desc->field(i);
+    if (field->number() != JobInput::kMmatomPositionFieldNumber &&
+      field->number() != JobInput::kMmatomChargeFieldNumber) {
+      mask.add_paths(field->name());
+    }
+  }
+
+  return mask;
+}
+
+int Client::SerializeJobInput(const JobInput &pb,
+  int run)
+{
+  const JobInput *msg = &pb;
+  int msgSize;
+
+  if (useShm_ && (pb.mmatom_position_size() > 0 || pb.mmatom_charge_size() > 0)) {
+    using google::protobuf::util::FieldMaskUtil;
+    static const google::protobuf::FieldMask mask = SharedMemoryControlMask();
+
+    // Layout: positions, charges, then room for the gradient (same size as positions)
+    uint64_t numPos = pb.mmatom_position_size();
+    uint64_t numCharges = pb.mmatom_charge_size();
+    size_t bytes = (2 * numPos + numCharges) * sizeof(double);
+    if (shm_ == nullptr || shm_->GetSize() < bytes) {
+      delete shm_;
+      shm_ = nullptr;
+      shm_ = new SharedMemoryRegion(bytes + bytes / 2);
+    }
+
+    memcpy(shm_->GetDoubles(0, numPos), pb.mmatom_position().data(),
+      numPos * sizeof(double));
+    memcpy(shm_->GetDoubles(numPos * sizeof(double), numCharges),
+      pb.mmatom_charge().data(), numCharges * sizeof(double));
+
+    // Copy everything but the MM arrays into the control message
+    ctrl_.Clear();
+    FieldMaskUtil::MergeMessageTo(pb, mask, FieldMaskUtil::MergeOptions(), &ctrl_);
+    ctrl_.set_shm_name(shm_->GetName());
+    ctrl_.mutable_shm_mmatom_position()->set_offset(0);
+    ctrl_.mutable_shm_mmatom_position()->set_size(numPos);
+    ctrl_.mutable_shm_mmatom_charge()->set_offset(numPos * sizeof(double));
+    ctrl_.mutable_shm_mmatom_charge()->set_size(numCharges);
+    ctrl_.mutable_shm_mmatom_gradient()->set_offset((numPos + numCharges) * sizeof(double));
+    ctrl_.mutable_shm_mmatom_gradient()->set_size(numPos);
+    msg = &ctrl_;
+  }
+
+  // A different run type goes on the control message, copying the input only if it is not there yet.
+  // ctrl_ keeps its capacity across calls, so the copy does not reallocate for jobs of similar size.
+  if (run >= 0 && msg->run() != run) {
+    if (msg == &pb) {
+      ctrl_.CopyFrom(pb);
+      msg = &ctrl_;
+    }
+    ctrl_.set_run((JobInput::RunType)run);
+  }
+
+  msgSize = msg->ByteSizeLong();
+  if ((size_t)msgSize > sendBuf_.size()) {
+    sendBuf_.resize(msgSize);
+  }
+  if (!msg->SerializeToArray(sendBuf_.data(), msgSize)) throw ServerCommError(
+      "SendJobAsync: Could not serialize job input protobuf",
+      host_, port_, currJobDir_, currJobId_);
+
+  return msgSize;
+}
+
+void Client::RecvMessage(const char *caller,
+  const char *what,
+  int &msgType,
+  int &msgSize)
+{
+  uint32_t header[2];
+  bool recvSuccess;
+  char log[256];
+
+  // Log labels on the stack, so a steady stream of messages does not touch the heap
+  snprintf(log, sizeof(log), "%s() %s header", caller, what);
+  recvSuccess = socket_->HandleRecv((char *)header, sizeof(header), log);
+  if (!recvSuccess) throw ServerConnectionError(
+      string(caller) + ": Could not recv " + what + " header",
       host_, port_, currJobDir_, currJobId_);
 
   msgType = ntohl(header[0]);
   msgSize = ntohl(header[1]);
 
-  char msg[msgSize];
+  if (msgSize < 0) throw ServerCommError(
+      string(caller) + ": Got invalid " + what + " message size",
+      host_, port_, currJobDir_, currJobId_);
+
   if (msgSize > 0) {
-    recvSuccess = socket_->HandleRecv(msg, sizeof(msg),
-        "RecvJobAsync() job output protobuf");
-    if (!recvSuccess) throw ServerCommError(
-        "RecvJobAsync: Could not recv job output protobuf",
+    // Only ever grow the buffer, so steady-state calls do not reallocate
+    if ((size_t)msgSize > recvBuf_.size()) {
+      recvBuf_.resize(msgSize);
+    }
+
+    snprintf(log, sizeof(log), "%s() %s protobuf", caller, what);
+    recvSuccess = socket_->HandleRecv(recvBuf_.data(), msgSize, log);
+    if (!recvSuccess) throw ServerConnectionError(
+        string(caller) + ": Could not recv " + what + " protobuf",
         host_, port_, currJobDir_, currJobId_);
   }
+}
 
-  if (msgType != terachem_server::JOBOUTPUT) {
-    throw ServerCommError("RecvJobAsync: Did not get the expected job output message",
+bool Client::ResumeJob(bool &completed)
+{
+  int msgType, msgSize;
+  bool sendSuccess;
+
+  completed = false;
+
+  // A job the server never acknowledged may or may not be there, so send it again
+  if (currJobId_ == -1) {
+    return false;
+  }
+
+  // Send Status Protocol Buffer
+  sendSuccess = socket_->HandleSendMessage(terachem_server::STATUS, NULL, 0,
+      "ResumeJob() status");
+  if (!sendSuccess) throw ServerConnectionError(
+      "ResumeJob: Could not send status header",
       host_, port_, currJobDir_, currJobId_);
-  } else if (msgSize == 0) {
-    throw ServerCommError("RecvJobAsync: Got empty job output message",
+
+  // Receive Status Protocol Buffer
+  RecvMessage("ResumeJob", "status", msgType, msgSize);
+
+  if (msgType != terachem_server::STATUS) throw ServerCommError(
+      "ResumeJob: Did not get the expected status message",
       host_, port_, currJobDir_, currJobId_);
+
+  Status status;
+  if (msgSize > 0 && !status.ParseFromArray(recvBuf_.data(), msgSize)) {
+    throw ServerCommError("ResumeJob: Could not parse status protobuf",
+      host_, port_, currJobDir_, currJobId_);
+  }
+
+  // Somebody else's job is running, ours is gone
+  if (status.server_job_id() != 0 && status.server_job_id() != currJobId_) {
+    return false;
+  }
+
+  if (status.job_status_case() == Status::JobStatusCase::kWorking) {
+    return true;
+  } else if (status.job_status_case() == Status::JobStatusCase::kCompleted) {
+    completed = true;
+    return true;
+  }
+
+  // Server is idle, the job (or its output) was lost with the connection
+  currJobDir_ = "";
+  currJobScrDir_ = "";
+  currJobId_ = -1;
+  return false;
+}
+
+// Whether nobody waits for the job any more
+static bool IsCancelled(JobState *job)
+{
+  if (job == nullptr) {
+    return false;
   }
 
-  // Cast char* to string, avoiding binary 0 being counted as null termination
-  msgStr.resize(msgSize);
-  memcpy((void *)msgStr.data(), msg, msgSize);
+  std::lock_guard<std::mutex> lock(job->mutex);
+  return job->status == JobState::CANCELLED;
+}
+
+int Client::SubmitJob(const Input &input,
+  const string *payload,
+  const WaitPolicy &policy,
+  int run,
+  JobState *job)
+{
+  using std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  steady_clock::time_point start = steady_clock::now();
+  long elapsed;
+  int backoff = policy.initialBackoff;
+
+  while (!(payload != nullptr ? SendSerializedJob(payload->data(), payload->size()) :
+      SendSerializedJob(sendBuf_.data(), SerializeJobInput(input.GetPB(), run)))) {
+    // A cancelled job is never sent again, so it does not hold the client for submitTimeout
+    if (IsCancelled(job)) {
+      return -1;
+    }
+
+    elapsed = duration_cast<microseconds>(steady_clock::now() - start).count();
+    if (elapsed >= policy.submitTimeout) {
+      return 0;
+    }
+
+    usleep(backoff);
+    backoff = min(2 * backoff, policy.maxBackoff);
+  }
+
+  return 1;
+}
+
+int Client::WaitForJob(const WaitPolicy &policy,
+  JobState *job)
+{
+  using std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  steady_clock::time_point start = steady_clock::now();
+  long elapsed, sleep;
+  long jobTimeout = 1000L * options_.jobTimeout;
+  int backoff = policy.initialBackoff;
+  int checks = 0;
+
+  while (true) {
+    checks++;
+    if (CheckJobComplete()) {
+      break;
+    }
+
+    // Nobody waits for a cancelled job, leave it to finish on its own
+    if (IsCancelled(job)) {
+      return -1;
+    }
+
+    if (abortJob_) {
+      throw ServerCommError("ComputeJobSync: Job was abandoned by client shutdown",
+        host_, port_, currJobDir_, currJobId_);
+    }
+
+    elapsed = duration_cast<microseconds>(steady_clock::now() - start).count();
+    if (jobTimeout > 0 && elapsed >= jobTimeout) {
+      throw ServerCommError("ComputeJobSync: Job did not complete before the job deadline",
+        host_, port_, currJobDir_, currJobId_);
+    }
+
+    if (elapsed < policy.spinTime) {
+      continue;
+    } else if (elapsed < (long)policy.spinTime + policy.backoffTime) {
+      sleep = backoff;
+      backoff = min(2 * backoff, policy.maxBackoff);
+    } else {
+      sleep = policy.sleepTime;
+    }
 
-  pb.ParseFromString(msgStr);
-  //printf("Received job output:\n%s\n", pb.DebugString().c_str());
+    // Do not oversleep the job deadline
+    if (jobTimeout > 0) {
+      sleep = min(sleep, jobTimeout - elapsed);
+    }
+    usleep(sleep);
+  }
 
-  return Output(pb);
+  return checks;
 }
 
-const Output Client::ComputeJobSync(const Input &input)
+bool Client::DrainJob(const WaitPolicy &policy,
+  bool wait)
 {
-  // Try to submit job
-  if (!SendJobAsync(input)) throw ServerCommError(
-    "ComputeJobSync: problem to submit the job",
-    host_, port_, currJobDir_, currJobId_);
+  std::lock_guard<std::recursive_mutex> lock(ioMutex_);
 
-  // Check for job completion
-  while (!CheckJobComplete()) {
-    sleep(1);
+  if (!drainPending_) {
+    return true;
   }
 
-  prevResults_ = RecvJobAsync();
+  try {
+    if (!wait && !CheckJobComplete()) {
+      return false;
+    }
+    if (wait) {
+      WaitForJob(policy);
+    }
+    RecvJobAsync();
+  } catch (const std::exception &) {
+    // The output is not wanted anyway
+  }
 
+  drainPending_ = false;
   currJobDir_ = "";
   currJobScrDir_ = "";
   currJobId_ = -1;
 
-  return prevResults_;
+  return true;
+}
+
+/********************
+ * BACKGROUND JOBS *
+ ********************/
+
+JobHandle Client::Submit(const Input &input,
+  std::function<void()> settled)
+{
+  // The shared memory data plane stages the MM arrays at send time, so keep the input then
+  std::shared_ptr<JobState> state = std::make_shared<JobState>(input, !useShm_);
+  state->settled = settled;
+
+  {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    queue_.push_back(state);
+    if (!ioThread_.joinable()) {
+      ioThread_ = std::thread(&Client::RunIOLoop, this);
+    }
+  }
+  queueCond_.notify_one();
+
+  return JobHandle(state);
+}
+
+void Client::RunIOLoop()
+{
+  std::shared_ptr<JobState> state;
+  std::shared_ptr<JobState> background; // Cancelled while running, still on the server
+
+  auto settle = [](std::shared_ptr<JobState> &job) {
+    if (job->settled) {
+      job->settled();
+    }
+    job.reset();
+  };
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(queueMutex_);
+      auto ready = [this] { return stopIO_ || !queue_.empty(); };
+      if (background) {
+        queueCond_.wait_for(lock, std::chrono::microseconds(waitPolicy_.sleepTime), ready);
+      } else {
+        queueCond_.wait(lock, ready);
+      }
+      if (stopIO_) {
+        break;
+      }
+      if (!queue_.empty()) {
+        state = queue_.front();
+        queue_.pop_front();
+      }
+    }
+
+    // Nothing queued, check on the job left running in the background
+    if (!state) {
+      if (background && DrainJob(waitPolicy_, false)) {
+        settle(background);
+      }
+      continue;
+    }
+
+    // Skip jobs cancelled while they were queued
+    bool cancelled;
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      cancelled = (state->status != JobState::PENDING);
+      state->status = (cancelled ? state->status : JobState::RUNNING);
+    }
+
+    if (!cancelled) {
+      // The server is only free once the job left running is drained
+      if (background) {
+        DrainJob(waitPolicy_, true);
+        settle(background);
+      }
+
+      // A job cancelled while running comes back without output and is left on the server;
+      // FinishJob() ignores the result of a cancelled job
+      try {
+        Output output = RunJob(state->input,
+            (state->serialized ? &state->payload : nullptr), waitPolicy_, -1, state.get());
+        FinishJob(state, JobState::DONE, output);
+      } catch (...) {
+        FinishJob(state, JobState::FAILED, Output(), std::current_exception());
+      }
+    }
+
+    if (drainPending_ && !background) {
+      background = state;
+      state.reset();
+    } else {
+      settle(state);
+    }
+  }
+
+  // Shutting down, the job left running is abandoned like a running one
+  if (background) {
+    settle(background);
+  }
+}
+
+/*********************
+ * NON-BLOCKING JOBS *
+ *********************/
+
+void Client::StartJob(const Input &input)
+{
+  std::unique_lock<std::recursive_mutex> lock(ioMutex_, std::try_to_lock);
+  int msgSize;
+
+  if (!lock.owns_lock() || asyncStep_ != ASYNC_IDLE || drainPending_) throw ServerCommError(
+      "StartJob: Client is busy with another job",
+      host_, port_, currJobDir_, currJobId_);
+
+  // Keep the serialized job around, a busy server means sending it again
+  msgSize = SerializeJobInput(input.GetPB());
+  asyncJob_.assign(sendBuf_.data(), msgSize);
+
+  asyncOut_.clear();
+  asyncOutPos_ = 0;
+  asyncInPos_ = 0;
+  asyncStart_ = std::chrono::steady_clock::now();
+  asyncBackoff_ = waitPolicy_.initialBackoff;
+  asyncChecks_ = 0;
+  progressError_.clear();
+  currJobId_ = -1;
+
+  QueueAsyncMessage(terachem_server::JOBINPUT, asyncJob_.data(), asyncJob_.size());
+  asyncStep_ = ASYNC_SUBMIT;
+}
+
+JobProgress Client::Progress()
+{
+  std::unique_lock<std::recursive_mutex> lock(ioMutex_, std::try_to_lock);
+  bool done;
+
+  // Somebody else is using the connection, come back later
+  if (!lock.owns_lock()) {
+    return JOB_PENDING;
+  }
+
+  if (asyncStep_ == ASYNC_IDLE) {
+    progressError_ = "Progress: No job was started";
+    return JOB_FAILED;
+  }
+
+  try {
+    done = AdvanceAsync();
+  } catch (const std::exception &e) {
+    progressError_ = e.what();
+    done = false;
+  }
+  if (!done && progressError_.empty()) {
+    return JOB_PENDING;
+  }
+
+  asyncStep_ = ASYNC_IDLE;
+  asyncJob_.clear();
+  currJobDir_ = "";
+  currJobScrDir_ = "";
+  currJobId_ = -1;
+
+  return (done ? JOB_COMPLETE : JOB_FAILED);
+}
+
+int Client::GetPollEvents() const
+{
+  if (asyncOutPos_ < asyncOut_.size()) {
+    return POLLOUT;
+  } else if (asyncStep_ == ASYNC_SUBMIT || asyncStep_ == ASYNC_CHECK ||
+    asyncStep_ == ASYNC_OUTPUT) {
+    return POLLIN;
+  }
+
+  return 0;
+}
+
+int Client::GetPollTimeout() const
+{
+  using std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  steady_clock::time_point now = steady_clock::now();
+  long left;
+
+  if (asyncStep_ == ASYNC_RETRY || asyncStep_ == ASYNC_SLEEP) {
+    left = duration_cast<microseconds>(asyncNext_ - now).count();
+  } else if (asyncStep_ == ASYNC_CHECK && options_.jobTimeout > 0) {
+    left = 1000L * options_.jobTimeout - duration_cast<microseconds>(now - asyncStart_).count();
+  } else {
+    return -1;
+  }
+
+  // Round up, so the caller does not wake up just before the time
+  return (left > 0 ? (int)((left + 999) / 1000) : 0);
+}
+
+void Client::QueueAsyncMessage(int msgType,
+  const char *buf,
+  int len)
+{
+  uint32_t header[2];
+
+  header[0] = htonl((uint32_t)msgType);
+  header[1] = htonl((uint32_t)len);
+  asyncOut_.append((const char *)header, sizeof(header));
+  if (len > 0) {
+    asyncOut_.append(buf, len);
+  }
+}
+
+bool Client::FlushAsync()
+{
+  int nsent;
+
+  while (asyncOutPos_ < asyncOut_.size()) {
+    nsent = socket_->TrySend(asyncOut_.data() + asyncOutPos_,
+        asyncOut_.size() - asyncOutPos_, "Progress() message");
+    if (nsent < 0) throw ServerConnectionError(
+        "Progress: Could not send message",
+        host_, port_, currJobDir_, currJobId_);
+    if (nsent == 0) {
+      return false;
+    }
+    asyncOutPos_ += nsent;
+  }
+
+  asyncOut_.clear();
+  asyncOutPos_ = 0;
+  return true;
+}
+
+bool Client::RecvAsync(int &msgType,
+  int &msgSize)
+{
+  const size_t headerSize = sizeof(asyncHeader_);
+  int nrecv;
+
+  while (asyncInPos_ < headerSize) {
+    nrecv = socket_->TryRecv((char *)asyncHeader_ + asyncInPos_,
+        headerSize - asyncInPos_, "Progress() header");
+    if (nrecv < 0) throw ServerConnectionError(
+        "Progress: Could not recv header",
+        host_, port_, currJobDir_, currJobId_);
+    if (nrecv == 0) {
+      return false;
+    }
+    asyncInPos_ += nrecv;
+  }
+
+  msgType = ntohl(asyncHeader_[0]);
+  msgSize = ntohl(asyncHeader_[1]);
+
+  if (msgSize < 0) throw ServerCommError(
+      "Progress: Got invalid message size",
+      host_, port_, currJobDir_, currJobId_);
+
+  if ((size_t)msgSize > recvBuf_.size()) {
+    recvBuf_.resize(msgSize);
+  }
+
+  while (asyncInPos_ < headerSize + msgSize) {
+    nrecv = socket_->TryRecv(recvBuf_.data() + (asyncInPos_ - headerSize),
+        headerSize + msgSize - asyncInPos_, "Progress() protobuf");
+    if (nrecv < 0) throw ServerConnectionError(
+        "Progress: Could not recv protobuf",
+        host_, port_, currJobDir_, currJobId_);
+    if (nrecv == 0) {
+      return false;
+    }
+    asyncInPos_ += nrecv;
+  }
+
+  asyncInPos_ = 0;
+  return true;
+}
+
+void Client::ScheduleAsync()
+{
+  using std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  steady_clock::time_point now = steady_clock::now();
+  long elapsed = duration_cast<microseconds>(now - asyncStart_).count();
+  long jobTimeout = 1000L * options_.jobTimeout;
+  long sleep;
+
+  // Same schedule as WaitForJob()
+  if (elapsed < waitPolicy_.spinTime) {
+    sleep = 0;
+  } else if (elapsed < (long)waitPolicy_.spinTime + waitPolicy_.backoffTime) {
+    sleep = asyncBackoff_;
+    asyncBackoff_ = min(2 * asyncBackoff_, waitPolicy_.maxBackoff);
+  } else {
+    sleep = waitPolicy_.sleepTime;
+  }
+
+  if (jobTimeout > 0) {
+    sleep = min(sleep, jobTimeout - elapsed);
+  }
+  asyncNext_ = now + microseconds(sleep);
+}
+
+bool Client::AdvanceAsync()
+{
+  using std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  steady_clock::time_point now;
+  long elapsed;
+  long jobTimeout = 1000L * options_.jobTimeout;
+  int msgType, msgSize;
+  Status status;
+
+  // Every step either moves the job on or returns because it has to wait
+  while (true) {
+    if (!FlushAsync()) {
+      return false;
+    }
+
+    now = steady_clock::now();
+    elapsed = duration_cast<microseconds>(now - asyncStart_).count();
+
+    if ((asyncStep_ == ASYNC_SLEEP || asyncStep_ == ASYNC_CHECK) &&
+      jobTimeout > 0 && elapsed >= jobTimeout) {
+      throw ServerCommError("Progress: Job did not complete before the job deadline",
+        host_, port_, currJobDir_, currJobId_);
+    }
+
+    switch (asyncStep_) {
+    case ASYNC_RETRY:
+      if (now < asyncNext_) {
+        return false;
+      }
+      QueueAsyncMessage(terachem_server::JOBINPUT, asyncJob_.data(), asyncJob_.size());
+      asyncStep_ = ASYNC_SUBMIT;
+      break;
+
+    case ASYNC_SLEEP:
+      if (now < asyncNext_) {
+        return false;
+      }
+      QueueAsyncMessage(terachem_server::STATUS, NULL, 0);
+      asyncChecks_++;
+      asyncStep_ = ASYNC_CHECK;
+      break;
+
+    case ASYNC_SUBMIT:
+    case ASYNC_CHECK:
+      if (!RecvAsync(msgType, msgSize)) {
+        return false;
+      }
+
+      if (msgType != terachem_server::STATUS) throw ServerCommError(
+          "Progress: Did not get the expected status message",
+          host_, port_, currJobDir_, currJobId_);
+
+      status.Clear();
+      if (msgSize > 0 && !status.ParseFromArray(recvBuf_.data(), msgSize)) {
+        throw ServerCommError("Progress: Could not parse status protobuf",
+          host_, port_, currJobDir_, currJobId_);
+      }
+
+      if (asyncStep_ == ASYNC_SUBMIT) {
+        if (status.job_status_case() != Status::JobStatusCase::kAccepted) {
+          // Server still busy, back off like SubmitJob()
+          if (elapsed >= waitPolicy_.submitTimeout) throw ServerCommError(
+              "Progress: problem to submit the job",
+              host_, port_, currJobDir_, currJobId_);
+          asyncNext_ = now + microseconds(asyncBackoff_);
+          asyncBackoff_ = min(2 * asyncBackoff_, waitPolicy_.maxBackoff);
+          asyncStep_ = ASYNC_RETRY;
+        } else {
+          currJobDir_ = status.job_dir();
+          currJobScrDir_ = status.job_scr_dir();
+          currJobId_ = status.server_job_id();
+
+          // The first status check goes out right away, like in WaitForJob()
+          asyncStart_ = now;
+          asyncBackoff_ = waitPolicy_.initialBackoff;
+          asyncNext_ = now;
+          asyncStep_ = ASYNC_SLEEP;
+        }
+      } else if (status.job_status_case() == Status::JobStatusCase::kWorking) {
+        ScheduleAsync();
+        asyncStep_ = ASYNC_SLEEP;
+      } else if (status.job_status_case() == Status::JobStatusCase::kCompleted) {
+        asyncStep_ = ASYNC_OUTPUT;
+      } else {
+        throw ServerCommError("Progress: No valid job status was received",
+          host_, port_, currJobDir_, currJobId_);
+      }
+      break;
+
+    case ASYNC_OUTPUT:
+      if (!RecvAsync(msgType, msgSize)) {
+        return false;
+      }
+      prevResults_ = Output();
+      prevResults_ = ParseJobOutput("Progress", msgType, msgSize);
+      prevStatusChecks_ = asyncChecks_;
+      return true;
+
+    default:
+      throw ServerCommError("Progress: No job was started",
+        host_, port_, currJobDir_, currJobId_);
+    }
+  }
 }
 
 /*************************
  * CONVENIENCE FUNCTIONS *
  *************************/
 
-const Output Client::ComputeEnergy(const Input &input,
+Output Client::ComputeEnergy(const Input &input,
   double &energy)
 {
-  // Reset runtype to energy
-  Input new_input(input);
-  terachem_server::JobInput pb = new_input.GetPB();
-  pb.set_run(terachem_server::JobInput::ENERGY);
-
-  Output output = ComputeJobSync(new_input);
+  // Override the runtype when the job is serialized, instead of copying the input
+  Output output = RunJob(input, nullptr, waitPolicy_, JobInput::ENERGY);
 
   output.GetEnergy(energy);
 
   return output;
 }
 
-const Output Client::ComputeGradient(const Input &input,
+Output Client::ComputeGradient(const Input &input,
   double &energy,
   double *qmgradient,
   double *mmgradient)
 {
-  // Reset runtype to gradient
-  Input new_input(input);
-  terachem_server::JobInput pb = new_input.GetPB();
-  pb.set_run(terachem_server::JobInput::GRADIENT);
-
   // Get target state, if needed
-  int state = 0;
-  std::string targetkeyword = "";
-  for (int i = 0; i < pb.user_options_size()/2; ++i) {
-    //printf(" %d: %s = %s\n", i, pb.user_options(2*i).c_str(), pb.user_options(2*i+1).c_str());
-    if ((pb.user_options(2*i) == "casscf" || pb.user_options(2*i) == "casci") && pb.user_options(2*i+1) == "yes") {
-      targetkeyword = "castarget";
-      break;
-    } else if (pb.user_options(2*i) == "cis" && pb.user_options(2*i+1) == "yes") {
-      targetkeyword = "cistarget";
-      break;
-    }
-  }
-  if (targetkeyword.size() > 0) {
-    for (int i = 0; i < pb.user_options_size()/2; ++i) {
-      if (pb.user_options(2*i) == targetkeyword) {
-        state = std::stoi(pb.user_options(2*i+1));
-        break;
-      }
-    }
-  }
+  int state = input.GetTargetState();
 
-  Output output = ComputeJobSync(new_input);
+  // Override the runtype when the job is serialized, instead of copying the input
+  Output output = RunJob(input, nullptr, waitPolicy_, JobInput::GRADIENT);
 
   output.GetEnergy(energy,state);
   output.GetGradient(qmgradient,mmgradient);
@@ -349,7 +1175,7 @@ const Output Client::ComputeGradient(const Input &input,
   return output;
 }
 
-const Output Client::ComputeForces(const Input &input,
+Output Client::ComputeForces(const Input &input,
   double &energy,
   double *qmgradient,
   double *mmgradient)
@@ -358,7 +1184,7 @@ const Output Client::ComputeForces(const Input &input,
   Output output = ComputeGradient(input, energy, qmgradient, mmgradient);
 
   // Flip sign on gradient
-  const JobInput pb = input.GetPB();
+  const JobInput &pb = input.GetPB();
   int num_qm_atoms = pb.mol().atoms().size();
   for (int i = 0; i < 3 * num_qm_atoms; i++) {
     qmgradient[i] *= -1.0;
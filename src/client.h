@@ -5,46 +5,217 @@
 #ifndef TCPB_CLIENT_H_
 #define TCPB_CLIENT_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "handle.h"
+#include "options.h"
 #include "socket.h"
 #include "input.h"
 #include "output.h"
+#include "shm.h"
 
 namespace TCPB {
 
+/**
+ * \brief Policy for polling the TCPB server for job completion
+ *
+ * Status checks are first sent back-to-back for spinTime microseconds.
+ * After that, the client sleeps between checks with an exponential backoff
+ * that starts at initialBackoff and doubles up to maxBackoff.
+ * Once backoffTime microseconds have been spent backing off,
+ * the client falls back to sleeping sleepTime microseconds between checks.
+ *
+ * The same backoff is used when the server is still busy wrapping up a previous job
+ * and declines a submission; the client keeps resubmitting for up to submitTimeout microseconds.
+ **/
+struct WaitPolicy {
+  int spinTime;       //!< Microseconds of back-to-back status checks
+  int initialBackoff; //!< First backoff sleep in microseconds
+  int maxBackoff;     //!< Ceiling for the backoff sleep in microseconds
+  int backoffTime;    //!< Microseconds spent backing off before switching to sleepTime
+  int sleepTime;      //!< Microseconds between status checks after backing off
+  int submitTimeout;  //!< Microseconds to keep resubmitting a job the server declined as busy
+
+  /**
+   * \brief Constructor for WaitPolicy
+   *
+   * The defaults give millisecond latency for short jobs (e.g. xTB)
+   * and settle into one status check per second for long jobs.
+   **/
+  WaitPolicy(int spinTime = 0,
+    int initialBackoff = 1000,
+    int maxBackoff = 100000,
+    int backoffTime = 10000000,
+    int sleepTime = 1000000,
+    int submitTimeout = 30000000) :
+    spinTime(spinTime),
+    initialBackoff(initialBackoff),
+    maxBackoff(maxBackoff),
+    backoffTime(backoffTime),
+    sleepTime(sleepTime),
+    submitTimeout(submitTimeout) {}
+};
+
+/**
+ * \brief Connection recovery statistics for a TCPB client
+ **/
+struct ClientStats {
+  int reconnects;        //!< Successful reconnects
+  int failedConnects;    //!< Connection attempts that failed while reconnecting
+  int resumes;           //!< In-flight jobs picked up again on the new connection
+  int resubmits;         //!< Jobs submitted again because they were lost
+  long reconnectTime;    //!< Total microseconds spent reconnecting
+  long maxReconnectTime; //!< Longest single reconnect in microseconds
+
+  ClientStats() :
+    reconnects(0),
+    failedConnects(0),
+    resumes(0),
+    resubmits(0),
+    reconnectTime(0),
+    maxReconnectTime(0) {}
+};
+
+/**
+ * \brief Result of Client::Progress()
+ **/
+enum JobProgress {
+  JOB_PENDING,  //!< Job is still being sent, run or received
+  JOB_COMPLETE, //!< Output is available from Client::GetPrevResults()
+  JOB_FAILED    //!< Job failed, see Client::GetProgressError()
+};
+
 /**
  * \brief TeraChem Protocol Buffer (TCPB) Client class
  *
  * Client handles communicating with a TeraChem server through sockets and protocol buffers.
  * Direct control of the asynchronous server communication is possible,
  * but the typical use would be the convenience functions like ComputeEnergy().
+ *
+ * Submit() hands jobs to a background I/O thread and returns right away.
+ * All server communication is serialized, so the blocking calls can still be used
+ * from other threads, they just wait for the I/O thread to finish its current job.
+ *
+ * For callers with their own event loop, StartJob() and Progress() run a job without
+ * blocking and without threads: watch GetFD() for GetPollEvents(), and call Progress()
+ * when it is ready or GetPollTimeout() runs out.
  **/
 class Client {
 public:
   /**
    * \brief Constructor for Client class
    *
-   * @param host Hostname of TCPB server
-   * @param port Integer port of TCPB server
+   * @param host Hostname of TCPB server, or "unix:/path/to.sock" for a server on a Unix domain socket
+   * @param port Integer port of TCPB server (ignored for Unix domain sockets)
+   * @param options Connection deadlines and keepalive settings
    **/
   Client(std::string host,
-    int port);
+    int port,
+    const ClientOptions &options = ClientOptions());
 
   /**
    * \brief Destructor for Client
+   *
+   * Queued jobs are cancelled and a running job is abandoned.
    **/
   ~Client();
 
   /**
    * \brief Accessor for previous job output
    *
+   * The output shares its protobuf with the client, so copying it is cheap.
+   *
    * @return Output object for last job
    **/
-  const Output GetPrevResults() {
+  const Output &GetPrevResults() const {
     return prevResults_;
   }
 
+  /**
+   * \brief Accessor for the number of status checks of the previous job
+   *
+   * @return Number of CheckJobComplete() round trips the last ComputeJobSync() took
+   **/
+  int GetPrevStatusChecks() const {
+    return prevStatusChecks_;
+  }
+
+  /**
+   * \brief Set the policy used by ComputeJobSync() to wait for job completion
+   *
+   * @param policy WaitPolicy used for all subsequent blocking calls
+   **/
+  void SetWaitPolicy(const WaitPolicy &policy) {
+    waitPolicy_ = policy;
+  }
+
+  /**
+   * \brief Accessor for the current wait policy
+   *
+   * @return WaitPolicy used by blocking calls
+   **/
+  const WaitPolicy &GetWaitPolicy() const {
+    return waitPolicy_;
+  }
+
+  /**
+   * \brief Get the connection options this client was created with
+   *
+   * @return Connection options
+   **/
+  const ClientOptions &GetOptions() const {
+    return options_;
+  }
+
+  /**
+   * \brief Get the connection recovery statistics
+   *
+   * @return Reconnect and resubmit counts and timings since construction
+   **/
+  const ClientStats &GetStats() const {
+    return stats_;
+  }
+
+  /**
+   * \brief Exchange the MM arrays through shared memory instead of the socket
+   *
+   * When enabled, mmatom_position and mmatom_charge are copied into a shared memory region
+   * and the JobInput only carries their offsets and sizes, and the server is asked to write
+   * mmatom_gradient into the same region. Protocol buffers remain the control plane.
+   *
+   * Only use this with a server on the same host that understands the shm_* fields.
+   *
+   * @param enable Whether to use the shared memory data plane
+   **/
+  void SetUseSharedMemory(bool enable) {
+    useShm_ = enable;
+  }
+
+  /**
+   * \brief Parse job outputs on protobuf arenas instead of the heap
+   *
+   * Each job output is parsed on an arena that is reset and reused once no Output
+   * of an earlier job refers to it any more. The arena's first block is kept across resets
+   * and grown to fit the largest output seen, so for a steady stream of similar jobs
+   * (e.g. MD steps) the heap allocations per output no longer grow with its size.
+   * Only the contents of string fields too long for std::string's inline buffer (e.g. job_dir)
+   * still go to the heap, see bench/alloc-bench.cpp. Keeping old Outputs around is safe,
+   * they keep their arena alive, but then a fresh arena is needed.
+   *
+   * @param enable Whether to parse job outputs on arenas
+   **/
+  void SetUseArena(bool enable) {
+    useArena_ = enable;
+  }
+
   /************************
    * SERVER COMMUNICATION *
    ************************/
@@ -52,10 +223,13 @@ public:
    * \brief Checks whether the server is available
    *
    * Does not reserve the server, only returns the current availability.
+   * Without waiting, a connection in use by a job counts as busy
+   * instead of blocking until the job is done.
    *
+   * @param wait Whether to wait for the connection if it is in use
    * @return True if server has no running job, False otherwise
    **/
-  bool IsAvailable();
+  bool IsAvailable(bool wait = true);
 
   /**
    * \brief Send a JobInput Protocol Buffer to the TCPB server
@@ -84,18 +258,131 @@ public:
    *
    * @return Output wrapping JobOutput protocol buffer
    **/
-  const Output RecvJobAsync();
+  Output RecvJobAsync();
+
+  /**
+   * \brief Drop the current connection and connect to the server again
+   *
+   * Makes up to ClientOptions::reconnectAttempts connection attempts with a doubling delay.
+   * The old connection is kept if no attempt succeeds.
+   * The server-side job information (job dir and id) is left untouched.
+   *
+   * @throw ServerConnectionError if the server could not be reached
+   **/
+  void Reconnect();
 
   /**
    * \brief Blocking wrapper for SendJobAsync(), CheckJobComplete(), and RecvJobAsync()
    *
    * The client repeatedly tries to submit and check on the status of the job, until job completion.
+   * A submission declined because the server is busy is retried according to the WaitPolicy.
    * Called exactly like SendJobAsync(), but blocks until the job is finished and stored in jobOutput_.
    *
+   * If the connection drops, the client reconnects (see ClientOptions::maxReconnects)
+   * and asks the server about the in-flight job. A job the server still has is waited on again,
+   * a job the server lost (or never acknowledged) is submitted again.
+   *
+   * @param input Input with JobInput protocol buffer
+   * @return Output wrapping JobOutput protocol buffer
+   **/
+  Output ComputeJobSync(const Input &input);
+
+  /**
+   * \brief Blocking wrapper for SendJobAsync(), CheckJobComplete(), and RecvJobAsync()
+   *
+   * Same as ComputeJobSync(input), but waits for completion with the given policy
+   * instead of the one set with SetWaitPolicy().
+   *
    * @param input Input with JobInput protocol buffer
+   * @param policy WaitPolicy to use for this call only
    * @return Output wrapping JobOutput protocol buffer
    **/
-  const Output ComputeJobSync(const Input &input);
+  Output ComputeJobSync(const Input &input,
+    const WaitPolicy &policy);
+
+  /**
+   * \brief Submit a job to be run by the background I/O thread
+   *
+   * Jobs run one at a time in submission order, each as a ComputeJobSync() call
+   * with the WaitPolicy set with SetWaitPolicy().
+   * The input is serialized (or copied, with shared memory enabled) on the calling thread,
+   * so the caller may change or reuse it as soon as Submit() returns.
+   *
+   * The settled callback (if any) runs on the I/O thread once the client is done with the job,
+   * i.e. after its output was received, or drained for a job cancelled while running.
+   * Unlike JobHandle::Then() continuations, it tells when the server is free again.
+   *
+   * A job cancelled while running is left to finish on the server: the I/O thread stops
+   * waiting on it and drains its output in the background, checking every sleepTime
+   * of the WaitPolicy, or waits it out once the next job needs the server.
+   *
+   * @param input Input with JobInput protocol buffer
+   * @param settled Function called once the client is done with the job
+   * @return JobHandle to wait on, cancel, or attach continuations to
+   **/
+  JobHandle Submit(const Input &input,
+    std::function<void()> settled = nullptr);
+
+  /*********************
+   * NON-BLOCKING JOBS *
+   *********************/
+  /**
+   * \brief Start a job to be driven with Progress()
+   *
+   * Only serializes the input into an internal buffer, nothing is sent until Progress().
+   * A declined submission is retried according to the WaitPolicy,
+   * and the status checks are spaced out the same way as in ComputeJobSync().
+   * There is no reconnect: a broken connection fails the job, after which the caller
+   * may Reconnect() (which changes GetFD()) and start it again.
+   *
+   * Do not mix with Submit() or the blocking calls while the job is in progress.
+   *
+   * @param input Input with JobInput protocol buffer
+   * @throw ServerCommError if a non-blocking job is already in progress or the client is busy
+   **/
+  void StartJob(const Input &input);
+
+  /**
+   * \brief Advance the job from StartJob() as far as possible without blocking
+   *
+   * Sends what the socket takes, reads what has arrived, and sends a status check
+   * if one is due. Partial messages are buffered internally.
+   *
+   * @return JOB_PENDING, JOB_COMPLETE (output in GetPrevResults()) or JOB_FAILED
+   **/
+  JobProgress Progress();
+
+  /**
+   * \brief Get the socket file descriptor to watch for the job from StartJob()
+   *
+   * @return Socket file descriptor
+   **/
+  int GetFD() const {
+    return socket_->GetFD();
+  }
+
+  /**
+   * \brief Get the poll events Progress() is waiting for on GetFD()
+   *
+   * @return POLLIN and/or POLLOUT (same values as EPOLLIN and EPOLLOUT), or 0 while waiting on a timer
+   **/
+  int GetPollEvents() const;
+
+  /**
+   * \brief Get how long the caller may wait for GetPollEvents() before calling Progress() anyway
+   *
+   * @return Milliseconds until the next status check or the job deadline, -1 for no limit
+   **/
+  int GetPollTimeout() const;
+
+  /**
+   * \brief Get why the last non-blocking job failed
+   *
+   * @return Error message, empty unless Progress() returned JOB_FAILED
+   **/
+  const std::string &GetProgressError() const {
+    return progressError_;
+  }
 
   /*************************
    * CONVENIENCE FUNCTIONS *
@@ -110,7 +397,7 @@ public:
    * @param energy Double for storing the computed energy
    * @return Copy of job Output data
    **/
-  const Output ComputeEnergy(const Input &input,
+  Output ComputeEnergy(const Input &input,
     double &energy);
 
   /**
@@ -125,7 +412,7 @@ public:
    * @param mmgradient Double array for storing the computed gradient in the MM region (user-allocated)
    * @return Copy of job Output data
    **/
-  const Output ComputeGradient(const Input &input,
+  Output ComputeGradient(const Input &input,
     double &energy,
     double *qmgradient,
     double *mmgradient = nullptr);
@@ -141,7 +428,7 @@ public:
    * @param mmforces Double array for storing the negative of the computed gradient of the MM region (user-allocated)
    * @return Copy of job Output data
    **/
-  const Output ComputeForces(const Input &input,
+  Output ComputeForces(const Input &input,
     double &energy,
     double *qmforces,
     double *mmforces = nullptr);
@@ -149,6 +436,7 @@ public:
 private:
   std::string host_;
   int port_;
+  ClientOptions options_;
   ClientSocket *socket_;
 
   std::string currJobDir_;
@@ -156,6 +444,246 @@ private:
   int currJobId_;
 
   Output prevResults_;
+  int prevStatusChecks_;
+
+  WaitPolicy waitPolicy_;
+  ClientStats stats_;
+
+  std::vector<char> recvBuf_; //!< Receive buffer reused across calls, grown on demand
+  std::vector<char> sendBuf_; //!< Serialization buffer reused across calls, grown on demand
+  terachem_server::JobInput ctrl_; //!< Job input sent in place of the caller's when it has to change, reused across calls
+
+  bool useShm_;               //!< Whether MM arrays go through shared memory
+  SharedMemoryRegion *shm_;   //!< Shared memory region, created on first use and grown on demand
+
+  /**
+   * \brief Arena for parsing job outputs, together with its first block that survives Reset()
+   *
+   * Outputs parsed on it share ownership of the whole object, so they may outlive the Client.
+   **/
+  struct OutputArena {
+    std::vector<char> block;       //!< First block of the arena, destroyed after it
+    google::protobuf::Arena arena; //!< Arena starting out in block
+
+    /**
+     * \brief Constructor for OutputArena
+     *
+     * @param size Byte size of the first block
+     **/
+    explicit OutputArena(size_t size);
+  };
+
+  bool useArena_;                    //!< Whether job outputs are parsed on arenas
+  std::vector<std::shared_ptr<OutputArena> > arenas_; //!< Arenas to parse on, reused once no Output refers to them
+
+  std::recursive_mutex ioMutex_;     //!< Serializes all server communication
+  std::thread ioThread_;             //!< Background thread running submitted jobs, started on first Submit()
+  std::mutex queueMutex_;            //!< Guards queue_ and stopIO_
+  std::condition_variable queueCond_; //!< Signaled when a job is queued or the client shuts down
+  std::deque<std::shared_ptr<JobState> > queue_; //!< Submitted jobs not yet picked up by ioThread_
+  bool stopIO_;                      //!< Whether ioThread_ should exit
+  std::atomic<bool> abortJob_;       //!< Whether the job being waited on should be abandoned
+  std::atomic<bool> drainPending_;   //!< Whether a job cancelled while running still has its output on the server
+
+  /**
+   * \brief Step of the non-blocking job from StartJob()
+   **/
+  enum AsyncStep {
+    ASYNC_IDLE,     //!< No job in progress
+    ASYNC_SUBMIT,   //!< Job input sent, waiting for the accepted status
+    ASYNC_RETRY,    //!< Server was busy, waiting to resubmit
+    ASYNC_SLEEP,    //!< Job accepted, waiting to send the next status check
+    ASYNC_CHECK,    //!< Status check sent, waiting for the reply
+    ASYNC_OUTPUT    //!< Job completed, waiting for the job output
+  };
+
+  AsyncStep asyncStep_;                           //!< Current step of the non-blocking job
+  std::string asyncJob_;                          //!< Framed JobInput, kept for resubmits
+  std::string asyncOut_;                          //!< Framed bytes waiting to be sent
+  size_t asyncOutPos_;                            //!< Bytes of asyncOut_ already sent
+  uint32_t asyncHeader_[2];                       //!< Header of the incoming message
+  size_t asyncInPos_;                             //!< Bytes of the incoming header and payload recv'd
+  std::chrono::steady_clock::time_point asyncStart_; //!< When the job was started or accepted
+  std::chrono::steady_clock::time_point asyncNext_;  //!< When the next resubmit or status check is due
+  int asyncBackoff_;                              //!< Next backoff sleep in microseconds
+  int asyncChecks_;                               //!< Status checks sent for the job
+  std::string progressError_;                     //!< Why the last non-blocking job failed
+
+  /**
+   * \brief Background I/O loop run by ioThread_
+   **/
+  void RunIOLoop();
+
+  /**
+   * \brief Receive a header and its protobuf payload from the TCPB server
+   *
+   * The payload is left in recvBuf_ so it can be parsed in place with ParseFromArray().
+   * Throws ServerCommError if either the header or the payload could not be recv'd.
+   *
+   * @param caller Name of the calling function, used in log and error messages
+   * @param what Description of the expected message, used in log and error messages
+   * @param msgType Message type from the header
+   * @param msgSize Byte size of the payload stored in recvBuf_
+   **/
+  void RecvMessage(const char *caller,
+    const char *what,
+    int &msgType,
+    int &msgSize);
+
+  /**
+   * \brief Turn a received job output message into an Output
+   *
+   * Parses the payload in recvBuf_ and picks up an MM gradient left in shared memory.
+   *
+   * @param caller Name of the calling function, used in error messages
+   * @param msgType Message type from the header
+   * @param msgSize Byte size of the payload stored in recvBuf_
+   * @return Output wrapping JobOutput protocol buffer
+   **/
+  Output ParseJobOutput(const char *caller,
+    int msgType,
+    int msgSize);
+
+  /**
+   * \brief Get an arena no Output refers to, reset and ready for the next job output
+   *
+   * @return Arena, or nullptr if all arenas are in use
+   **/
+  std::shared_ptr<OutputArena> AcquireArena();
+
+  /**
+   * \brief Ask the server about the in-flight job after a reconnect
+   *
+   * @param completed Set to True if the job is done and its output follows on the connection
+   * @return True if the server still has the job, False if it has to be submitted again
+   **/
+  bool ResumeJob(bool &completed);
+
+  /**
+   * \brief Serialize a JobInput protobuf into sendBuf_
+   *
+   * With shared memory enabled, the MM arrays are staged in shm_ and left out of the message.
+   * Either that or a different run type sends ctrl_ instead of pb, which stays unchanged.
+   *
+   * @param pb JobInput protobuf to serialize
+   * @param run RunType to send instead of the one in pb, or -1 to send pb as is
+   * @return Byte size of the serialized message
+   **/
+  int SerializeJobInput(const terachem_server::JobInput &pb,
+    int run = -1);
+
+  /**
+   * \brief Send an already serialized JobInput to the TCPB server
+   *
+   * Same as SendJobAsync(), minus the serialization.
+   *
+   * @param buf Serialized JobInput protobuf
+   * @param len Byte size of buf
+   * @return True if job was submitted, False if server was busy
+   **/
+  bool SendSerializedJob(const char *buf,
+    int len);
+
+  /**
+   * \brief ComputeJobSync() for an input that may already be serialized
+   *
+   * @param input Input with JobInput protocol buffer (unused if payload is given)
+   * @param payload Serialized JobInput protobuf, or nullptr to serialize input
+   * @param policy WaitPolicy to use
+   * @param run RunType to send instead of the one in input, or -1 (ignored if payload is given)
+   * @param job Job state checked for cancellation between status checks, or nullptr.
+   *            A cancelled job is left on the server for DrainJob(), and no output is returned.
+   * @return Output wrapping JobOutput protocol buffer
+   **/
+  Output RunJob(const Input &input,
+    const std::string *payload,
+    const WaitPolicy &policy,
+    int run = -1,
+    JobState *job = nullptr);
+
+  /**
+   * \brief Submit a job with SendJobAsync(), retrying with backoff while the server is busy
+   *
+   * The server can still be finishing the previous job right after handing out its output,
+   * so a declined submission is retried instead of sleeping a fixed amount before every job.
+   *
+   * @param input Input with JobInput protocol buffer (unused if payload is given)
+   * @param payload Serialized JobInput protobuf, or nullptr to serialize input
+   * @param policy WaitPolicy giving the backoff and the submitTimeout
+   * @param run RunType to send instead of the one in input, or -1 (ignored if payload is given)
+   * @param job Job state checked for cancellation between attempts, or nullptr
+   * @return 1 if job was accepted, 0 if the server stayed busy for submitTimeout,
+   *         or -1 if job was cancelled before the server took it
+   **/
+  int SubmitJob(const Input &input,
+    const std::string *payload,
+    const WaitPolicy &policy,
+    int run,
+    JobState *job = nullptr);
+
+  /**
+   * \brief Poll the TCPB server with CheckJobComplete() until the current job is done
+   *
+   * @param policy WaitPolicy deciding how long to sleep between checks
+   * @param job Job state checked for cancellation between status checks, or nullptr
+   * @return Number of status checks that were sent, or -1 if job was cancelled
+   **/
+  int WaitForJob(const WaitPolicy &policy,
+    JobState *job = nullptr);
+
+  /**
+   * \brief Receive and discard the output of a job left running by RunJob() after a cancel
+   *
+   * Errors are swallowed, the output is not wanted and the next job reconnects if need be.
+   *
+   * @param policy WaitPolicy to wait with
+   * @param wait Whether to wait for the job, or only check on it once
+   * @return True if no job is left on the server
+   **/
+  bool DrainJob(const WaitPolicy &policy,
+    bool wait);
+
+  /**
+   * \brief Queue a framed message for Progress() to send
+   *
+   * @param msgType Message type to put in the header
+   * @param buf Serialized payload (may be NULL if len is 0)
+   * @param len Byte size of the payload
+   **/
+  void QueueAsyncMessage(int msgType,
+    const char *buf,
+    int len);
+
+  /**
+   * \brief Send queued bytes without blocking
+   *
+   * @return True once everything queued is sent
+   **/
+  bool FlushAsync();
+
+  /**
+   * \brief Receive the next message without blocking
+   *
+   * The payload is left in recvBuf_, like RecvMessage() does.
+   *
+   * @param msgType Message type from the header
+   * @param msgSize Byte size of the payload stored in recvBuf_
+   * @return True once a complete message was recv'd
+   **/
+  bool RecvAsync(int &msgType,
+    int &msgSize);
+
+  /**
+   * \brief Pick the time of the next resubmit or status check from the WaitPolicy
+   **/
+  void ScheduleAsync();
+
+  /**
+   * \brief Run the non-blocking job as far as it goes, Progress() without the error handling
+   *
+   * @return True once the job output is in prevResults_
+   **/
+  bool AdvanceAsync();
 }; // end class Client
 
 } // end namespace TCPB
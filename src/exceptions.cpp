@@ -56,4 +56,12 @@ ServerCommError::ServerCommError(string msg,
   }
 }
 
+ServerConnectionError::ServerConnectionError(string msg,
+  string host,
+  int port,
+  string jobDir,
+  int jobId) : ServerCommError(msg, host, port, jobDir, jobId)
+{
+}
+
 } // end namespace TCPB
@@ -41,5 +41,29 @@ private:
   std::string msg_;
 }; // end class ServerCommError
 
+/**
+ * \brief Exception for a lost connection to the TCPB server
+ *
+ * Thrown instead of a plain ServerCommError when a send or recv fails (including timeouts),
+ * so callers can tell transient network failures apart from protocol errors.
+ **/
+class ServerConnectionError : public ServerCommError {
+public:
+  /**
+   * \brief Constructor for ServerConnectionError
+   *
+   * @param msg Base message for exception
+   * @param host Server hostname
+   * @param port Server port number
+   * @param jobDir Current job directory from server
+   * @param jobId Current job id number from server
+   **/
+  ServerConnectionError(std::string msg,
+    std::string host,
+    int port,
+    std::string jobDir,
+    int jobId);
+}; // end class ServerConnectionError
+
 } // end namespace TCPB
 #endif
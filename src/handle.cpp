@@ -0,0 +1,114 @@
+/** \file handle.cpp
+ *  \brief Implementation of JobHandle class
+ */
+
+#include <chrono>
+#include <stdexcept>
+using std::runtime_error;
+#include <utility>
+#include <vector>
+using std::vector;
+
+#include "handle.h"
+
+namespace TCPB {
+
+typedef std::unique_lock<std::mutex> JobLock;
+typedef std::function<void(const JobHandle &)> JobCallback;
+
+// Finished jobs are the ones Get() can return (or throw) for right away
+static bool IsFinished(JobState::Status status)
+{
+  return (status == JobState::DONE || status == JobState::FAILED ||
+      status == JobState::CANCELLED);
+}
+
+JobState::Status JobHandle::GetStatus() const
+{
+  JobLock lock(state_->mutex);
+  return state_->status;
+}
+
+bool JobHandle::Ready() const
+{
+  JobLock lock(state_->mutex);
+  return IsFinished(state_->status);
+}
+
+void JobHandle::Wait() const
+{
+  JobLock lock(state_->mutex);
+  state_->cv.wait(lock, [this] { return IsFinished(state_->status); });
+}
+
+bool JobHandle::WaitFor(int timeout) const
+{
+  JobLock lock(state_->mutex);
+  return state_->cv.wait_for(lock, std::chrono::milliseconds(timeout),
+      [this] { return IsFinished(state_->status); });
+}
+
+Output JobHandle::Get() const
+{
+  JobLock lock(state_->mutex);
+  state_->cv.wait(lock, [this] { return IsFinished(state_->status); });
+
+  if (state_->status == JobState::FAILED) {
+    std::rethrow_exception(state_->error);
+  } else if (state_->status == JobState::CANCELLED) {
+    throw runtime_error("JobHandle: Job was cancelled");
+  }
+
+  return state_->output;
+}
+
+bool JobHandle::Cancel()
+{
+  JobLock lock(state_->mutex);
+  if (IsFinished(state_->status)) {
+    return false;
+  }
+  lock.unlock();
+
+  FinishJob(state_, JobState::CANCELLED);
+  return true;
+}
+
+void JobHandle::Then(JobCallback callback)
+{
+  JobLock lock(state_->mutex);
+  if (!IsFinished(state_->status)) {
+    state_->callbacks.push_back(callback);
+    return;
+  }
+  lock.unlock();
+
+  callback(*this);
+}
+
+void FinishJob(const std::shared_ptr<JobState> &state,
+  JobState::Status status,
+  const Output &output,
+  std::exception_ptr error)
+{
+  vector<JobCallback> callbacks;
+
+  JobLock lock(state->mutex);
+  if (IsFinished(state->status)) {
+    return;
+  }
+  state->status = status;
+  state->output = output;
+  state->error = error;
+  std::swap(callbacks, state->callbacks);
+  lock.unlock();
+  state->cv.notify_all();
+
+  // Continuations run without the lock, so they may use the handle freely
+  JobHandle handle(state);
+  for (size_t i = 0; i < callbacks.size(); i++) {
+    callbacks[i](handle);
+  }
+}
+
+} // end namespace TCPB
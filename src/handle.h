@@ -0,0 +1,171 @@
+/** \file handle.h
+ *  \brief Definition of JobHandle class
+ */
+
+#ifndef TCPB_HANDLE_H_
+#define TCPB_HANDLE_H_
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "input.h"
+#include "output.h"
+
+namespace TCPB {
+
+class JobHandle;
+
+/**
+ * \brief Shared state between a JobHandle and the Client I/O thread running the job
+ *
+ * Internal to the library, users only see JobHandle.
+ **/
+struct JobState {
+  enum Status {
+    PENDING,   //!< Queued, not yet sent to the server
+    RUNNING,   //!< Submitted to the server
+    DONE,      //!< Output is available
+    FAILED,    //!< Job threw, error holds the exception
+    CANCELLED  //!< Cancelled before completion
+  };
+
+  /**
+   * \brief Constructor for JobState
+   *
+   * Serializing here, on the submitting thread, overlaps with the wait on earlier jobs.
+   *
+   * @param in Input of the job
+   * @param serialize Whether to keep the serialized JobInput instead of a copy of the input
+   **/
+  JobState(const Input &in,
+    bool serialize) :
+    input(serialize ? Input(terachem_server::JobInput()) : in),
+    serialized(serialize),
+    status(PENDING)
+  {
+    if (serialize) {
+      in.GetPB().SerializeToString(&payload);
+    }
+  }
+
+  Input input;                //!< Copy of the input, unless serialized
+  std::string payload;        //!< Serialized JobInput, if serialized
+  bool serialized;            //!< Whether payload holds the job instead of input
+  Status status;              //!< Current job status
+  Output output;              //!< Output, valid once DONE
+  std::exception_ptr error;   //!< Exception, valid once FAILED
+  std::vector<std::function<void(const JobHandle &)> > callbacks; //!< Continuations
+  std::function<void()> settled; //!< Called by the I/O thread once it is done with the job
+  std::mutex mutex;           //!< Guards everything above
+  std::condition_variable cv; //!< Signaled once the job is finished
+};
+
+/**
+ * \brief Completion handle for a job submitted with Client::Submit()
+ *
+ * The job is driven by the client's background I/O thread,
+ * so the caller is free to do other work (MM forces, neighbor lists, I/O) in the meantime.
+ * Handles are cheap to copy, and all copies refer to the same job.
+ **/
+class JobHandle {
+public:
+  /**
+   * \brief Constructor for JobHandle class
+   *
+   * @param state Shared job state (default: no job)
+   **/
+  JobHandle(std::shared_ptr<JobState> state = nullptr) : state_(state) {}
+
+  /**
+   * \brief Check whether this handle refers to a job
+   *
+   * @return True if the handle came from Client::Submit()
+   **/
+  bool Valid() const {
+    return (state_ != nullptr);
+  }
+
+  /**
+   * \brief Get the current status of the job without blocking
+   *
+   * @return PENDING, RUNNING, DONE, FAILED or CANCELLED
+   **/
+  JobState::Status GetStatus() const;
+
+  /**
+   * \brief Check whether the job is finished (done, failed or cancelled) without blocking
+   *
+   * @return True if Get() would not block
+   **/
+  bool Ready() const;
+
+  /**
+   * \brief Block until the job is finished
+   **/
+  void Wait() const;
+
+  /**
+   * \brief Block until the job is finished or the timeout runs out
+   *
+   * @param timeout Milliseconds to wait
+   * @return True if the job is finished
+   **/
+  bool WaitFor(int timeout) const;
+
+  /**
+   * \brief Block until the job is finished and return its output
+   *
+   * @return Output wrapping JobOutput protocol buffer
+   * @throw The exception the job failed with (e.g. ServerCommError),
+   *        or std::runtime_error if the job was cancelled
+   **/
+  Output Get() const;
+
+  /**
+   * \brief Cancel the job
+   *
+   * A queued job is never sent. A job already running on the server is abandoned:
+   * waiters are released right away and the I/O thread drains its output in the background,
+   * so the connection is ready for the next job.
+   *
+   * @return True if the job was cancelled, False if it had already finished
+   **/
+  bool Cancel();
+
+  /**
+   * \brief Register a continuation to run once the job is finished
+   *
+   * The callback runs on the client's I/O thread, or right away on the calling thread
+   * if the job is already finished. It should be short and must not block on the same client.
+   *
+   * @param callback Function taking the finished JobHandle
+   **/
+  void Then(std::function<void(const JobHandle &)> callback);
+
+private:
+  std::shared_ptr<JobState> state_; //!< Job state shared with the I/O thread
+}; // end class JobHandle
+
+/**
+ * \brief Finish a job and run its continuations
+ *
+ * Used by the Client I/O thread. Does nothing if the job was already cancelled.
+ *
+ * @param state Job state
+ * @param status DONE, FAILED or CANCELLED
+ * @param output Output for a DONE job
+ * @param error Exception for a FAILED job
+ **/
+void FinishJob(const std::shared_ptr<JobState> &state,
+  JobState::Status status,
+  const Output &output = Output(),
+  std::exception_ptr error = nullptr);
+
+} // end namespace TCPB
+
+#endif
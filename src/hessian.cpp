@@ -0,0 +1,135 @@
+/** \file hessian.cpp
+ *  \brief Implementation of the finite-difference Hessian driver
+ */
+
+#include <exception>
+using std::exception;
+#include <stdexcept>
+using std::runtime_error;
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+
+#include "constants.h"
+#include "hessian.h"
+#include "terachem_server.pb.h"
+using terachem_server::JobInput;
+using terachem_server::JobOutput;
+using terachem_server::Mol;
+
+namespace TCPB {
+
+Output ComputeFiniteDifferenceHessian(ClientPool &pool,
+  const Input &input,
+  double step,
+  double *hessian,
+  int session)
+{
+  Input ref(input);
+  JobInput &refPB = ref.GetMutablePB();
+  refPB.set_run(JobInput::GRADIENT);
+  if (refPB.md_global_type() == JobInput::CONTINUE) {
+    refPB.set_md_global_type(JobInput::NORMAL);
+  }
+
+  int ncoords = refPB.mol().xyz_size();
+  if (ncoords == 0) {
+    throw runtime_error("ComputeFiniteDifferenceHessian: No atoms in input");
+  }
+
+  // Gradients are in Hartree/bohr, the displacement goes in the units of the geometry
+  double delta = step;
+  if (refPB.mol().units() == Mol::ANGSTROM) {
+    delta /= constants::ANGSTROM_TO_AU;
+  }
+
+  // Reference gradient, for its wavefunction
+  Output refOutput = pool.ComputeJobSync(ref, session);
+  const JobOutput &refOutPB = refOutput.GetOutputPB();
+
+  // The wavefunction files live in the scratch directory of the server that wrote them,
+  // so only displaced jobs running there can start from them: with one server all of them,
+  // otherwise every nservers-th job, pinned to that server through the session
+  int nservers = pool.GetNumServers();
+  bool pinGuess = (nservers > 1 && session >= 0);
+  bool haveGuess = (!refOutPB.orb1afile().empty() && (nservers == 1 || pinGuess));
+
+  // Displaced inputs: 2i is coordinate i moved up, 2i+1 moved down
+  int njobs = 2 * ncoords;
+  vector<Input> batch;
+  vector<int> batchIndex;
+  vector<JobHandle> pinned;
+  vector<int> pinnedIndex;
+  for (int k = 0; k < njobs; k++) {
+    int i = k / 2;
+    Input job(ref);
+    JobInput &jobPB = job.GetMutablePB();
+    jobPB.mutable_mol()->mutable_xyz()->Set(i, refPB.mol().xyz(i) + (k % 2 ? -delta : delta));
+
+    bool onRefServer = (nservers == 1 || (pinGuess && k % nservers == 0));
+    if (haveGuess && onRefServer) {
+      jobPB.set_orb1afile(refOutPB.orb1afile());
+      jobPB.set_orb1bfile(refOutPB.orb1bfile());
+    }
+
+    if (pinGuess && onRefServer) {
+      pinned.push_back(pool.Submit(job, session));
+      pinnedIndex.push_back(k);
+    } else {
+      batch.push_back(job);
+      batchIndex.push_back(k);
+    }
+  }
+
+  // The pinned jobs already load the reference server, so the batch mostly goes elsewhere
+  vector<BatchResult> results(njobs);
+  vector<BatchResult> batchResults = pool.ComputeBatch(batch);
+  for (size_t k = 0; k < batch.size(); k++) {
+    results[batchIndex[k]] = batchResults[k];
+  }
+  for (size_t k = 0; k < pinned.size(); k++) {
+    BatchResult &result = results[pinnedIndex[k]];
+    try {
+      result.output = pinned[k].Get();
+      result.success = true;
+    } catch (const exception &e) {
+      result.error = e.what();
+    }
+  }
+
+  // Central differences, one row per displaced coordinate
+  for (int i = 0; i < ncoords; i++) {
+    const BatchResult &plus = results[2 * i];
+    const BatchResult &minus = results[2 * i + 1];
+    if (!plus.success || !minus.success) {
+      throw runtime_error("ComputeFiniteDifferenceHessian: Displaced gradient for coordinate "
+        + to_string(i) + " failed: " + (plus.success ? minus.error : plus.error));
+    }
+
+    const JobOutput &gplus = plus.output.GetOutputPB();
+    const JobOutput &gminus = minus.output.GetOutputPB();
+    if (gplus.gradient_size() != ncoords || gminus.gradient_size() != ncoords) {
+      throw runtime_error("ComputeFiniteDifferenceHessian: Displaced gradient for coordinate "
+        + to_string(i) + " has the wrong size");
+    }
+
+    for (int j = 0; j < ncoords; j++) {
+      hessian[i * ncoords + j] = (gplus.gradient(j) - gminus.gradient(j)) / (2.0 * step);
+    }
+  }
+
+  // Symmetrize in place
+  for (int i = 0; i < ncoords; i++) {
+    for (int j = i + 1; j < ncoords; j++) {
+      double avg = 0.5 * (hessian[i * ncoords + j] + hessian[j * ncoords + i]);
+      hessian[i * ncoords + j] = avg;
+      hessian[j * ncoords + i] = avg;
+    }
+  }
+
+  return refOutput;
+}
+
+} // end namespace TCPB
@@ -0,0 +1,47 @@
+/** \file hessian.h
+ *  \brief Definition of the finite-difference Hessian driver
+ */
+
+#ifndef TCPB_HESSIAN_H_
+#define TCPB_HESSIAN_H_
+
+#include "input.h"
+#include "output.h"
+#include "pool.h"
+
+namespace TCPB {
+
+/**
+ * \brief Build a Hessian from central differences of displaced gradients
+ *
+ * For methods without analytic Hessians. A reference gradient is computed first,
+ * then all 6N displaced gradients (every coordinate moved by +step and -step) run
+ * concurrently across the servers of the pool.
+ * Displaced jobs that run on the server of the reference job start from its wavefunction
+ * (orb1afile/orb1bfile), which cuts down the SCF iterations. The files are in that server's
+ * scratch directory, so with several servers the guess needs a session: every nservers-th
+ * displaced job is then pinned to the reference server, and the others start from scratch.
+ *
+ * The Hessian is symmetrized, H = (H + H^T) / 2, and stored row-major in a 3N x 3N buffer.
+ *
+ * The run type of input is overridden to gradient, and CONTINUE is replaced by NORMAL,
+ * since the displaced jobs are spread over several servers.
+ *
+ * @param pool ClientPool to run the gradients on
+ * @param input Input at the reference geometry
+ * @param step Displacement in bohr (also when the geometry is in Angstrom)
+ * @param hessian Contiguous 3N x 3N buffer for the Hessian in Hartree/bohr^2 (user-allocated)
+ * @param session ClientPool session for the reference job and the jobs using its guess,
+ *                or -1 for none (no guess unless the pool has a single server)
+ * @return Output of the reference gradient job
+ * @throw std::runtime_error if any displaced gradient fails
+ **/
+Output ComputeFiniteDifferenceHessian(ClientPool &pool,
+  const Input &input,
+  double step,
+  double *hessian,
+  int session = -1);
+
+} // end namespace TCPB
+
+#endif
@@ -138,6 +138,30 @@ bool Input::IsApproxEqual(const Input &other) const
   return MessageDifferencer::ApproximatelyEquals(pb_, other.pb_);
 }
 
+int Input::GetTargetState() const
+{
+  string targetkeyword = "";
+  for (int i = 0; i < pb_.user_options_size()/2; ++i) {
+    if ((pb_.user_options(2*i) == "casscf" || pb_.user_options(2*i) == "casci") && pb_.user_options(2*i+1) == "yes") {
+      targetkeyword = "castarget";
+      break;
+    } else if (pb_.user_options(2*i) == "cis" && pb_.user_options(2*i+1) == "yes") {
+      targetkeyword = "cistarget";
+      break;
+    }
+  }
+
+  if (targetkeyword.size() > 0) {
+    for (int i = 0; i < pb_.user_options_size()/2; ++i) {
+      if (pb_.user_options(2*i) == targetkeyword) {
+        return stoi(pb_.user_options(2*i+1));
+      }
+    }
+  }
+
+  return 0;
+}
+
 // Convenience function to enable both constructors
 JobInput Input::InitInputPB(const vector<string> &atoms,
   const strmap &options,
@@ -108,6 +108,15 @@ public:
    **/
   bool IsApproxEqual(const Input &other) const;
 
+  /**
+   * \brief Get the electronic state whose energy a gradient job targets
+   *
+   * Reads castarget (CASSCF/CASCI) or cistarget (CIS) from the user options.
+   *
+   * @return Target state index (0, ground state, if none is set)
+   **/
+  int GetTargetState() const;
+
 private:
   terachem_server::JobInput
   pb_; //!< Internal protobuf object for advanced manipulation
@@ -0,0 +1,325 @@
+/** \file neb.cpp
+ *  \brief Implementation of the nudged elastic band driver
+ */
+
+#include <algorithm>
+using std::max;
+using std::min;
+#include <cmath>
+#include <exception>
+using std::exception;
+#include <set>
+using std::set;
+#include <stdexcept>
+using std::runtime_error;
+#include <string>
+using std::string;
+using std::to_string;
+#include <vector>
+using std::vector;
+
+#include "constants.h"
+#include "neb.h"
+#include "terachem_server.pb.h"
+using terachem_server::JobInput;
+using terachem_server::JobOutput;
+using terachem_server::Mol;
+
+namespace TCPB {
+
+typedef vector<double> Coords;
+
+static double Dot(const Coords &a,
+  const Coords &b)
+{
+  double sum = 0.0;
+  for (size_t i = 0; i < a.size(); i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+// Energies and gradients (Hartree/bohr) of the given images, all submitted at once
+static void EvaluateImages(ClientPool &pool,
+  const Input &input,
+  const vector<Coords> &images,
+  const vector<int> &indices,
+  int sessionBase,
+  JobInput::MDGlobalTreatment mdType,
+  vector<double> &energies,
+  vector<Coords> &gradients)
+{
+  vector<JobHandle> handles;
+
+  for (size_t k = 0; k < indices.size(); k++) {
+    int i = indices[k];
+    Input image(input);
+    JobInput &pb = image.GetMutablePB();
+    pb.set_md_global_type(mdType);
+    for (size_t j = 0; j < images[i].size(); j++) {
+      pb.mutable_mol()->set_xyz(j, images[i][j]);
+    }
+
+    handles.push_back(pool.Submit(image, (sessionBase >= 0 ? sessionBase + i : -1)));
+  }
+
+  for (size_t k = 0; k < indices.size(); k++) {
+    int i = indices[k];
+    Output output;
+    try {
+      output = handles[k].Get();
+    } catch (const exception &e) {
+      throw runtime_error("OptimizeNEB: Gradient of image " + to_string(i) + " failed: " +
+        e.what());
+    }
+
+    const JobOutput &pb = output.GetOutputPB();
+    if (pb.energy_size() == 0 || pb.gradient_size() != (int)gradients[i].size()) {
+      throw runtime_error("OptimizeNEB: Incomplete output for image " + to_string(i));
+    }
+    energies[i] = pb.energy(0);
+    for (int j = 0; j < pb.gradient_size(); j++) {
+      gradients[i][j] = pb.gradient(j);
+    }
+  }
+}
+
+// Whether every image's session is pinned to a server of its own
+static bool OnDistinctServers(ClientPool &pool,
+  int sessionBase,
+  const vector<int> &indices)
+{
+  set<int> servers;
+  for (size_t k = 0; k < indices.size(); k++) {
+    int server = pool.GetSessionServer(sessionBase + indices[k]);
+    if (server < 0 || !servers.insert(server).second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Drop the sessions of the given images, a no-op without sessions
+static void ReleaseSessions(ClientPool &pool,
+  int sessionBase,
+  const vector<int> &indices)
+{
+  if (sessionBase < 0) {
+    return;
+  }
+  for (size_t k = 0; k < indices.size(); k++) {
+    pool.ReleaseSession(sessionBase + indices[k]);
+  }
+}
+
+// NEB forces on the movable images, returns the largest force component
+static double NEBForces(const vector<Coords> &R,
+  const vector<double> &energies,
+  const vector<Coords> &gradients,
+  double springConstant,
+  bool climb,
+  vector<Coords> &forces)
+{
+  int nimages = (int)R.size();
+  size_t ncoords = R[0].size();
+  Coords tplus(ncoords), tminus(ncoords), tau(ncoords);
+  double maxForce = 0.0;
+
+  int top = -1;
+  if (climb) {
+    top = 1;
+    for (int i = 2; i < nimages - 1; i++) {
+      if (energies[i] > energies[top]) {
+        top = i;
+      }
+    }
+  }
+
+  for (int i = 1; i < nimages - 1; i++) {
+    for (size_t j = 0; j < ncoords; j++) {
+      tplus[j] = R[i + 1][j] - R[i][j];
+      tminus[j] = R[i][j] - R[i - 1][j];
+    }
+
+    // Improved tangent: point uphill, and blend the two sides at extrema
+    double eplus = energies[i + 1] - energies[i];
+    double eminus = energies[i - 1] - energies[i];
+    double wplus, wminus;
+    if (eplus > 0.0 && eminus < 0.0) {
+      wplus = 1.0;
+      wminus = 0.0;
+    } else if (eplus < 0.0 && eminus > 0.0) {
+      wplus = 0.0;
+      wminus = 1.0;
+    } else {
+      double dmax = max(fabs(eplus), fabs(eminus));
+      double dmin = min(fabs(eplus), fabs(eminus));
+      wplus = (energies[i + 1] > energies[i - 1] ? dmax : dmin);
+      wminus = (energies[i + 1] > energies[i - 1] ? dmin : dmax);
+    }
+    for (size_t j = 0; j < ncoords; j++) {
+      tau[j] = wplus * tplus[j] + wminus * tminus[j];
+    }
+    double norm = sqrt(Dot(tau, tau));
+    for (size_t j = 0; j < ncoords && norm > 0.0; j++) {
+      tau[j] /= norm;
+    }
+
+    double gtau = Dot(gradients[i], tau);
+    double spring = springConstant * (sqrt(Dot(tplus, tplus)) - sqrt(Dot(tminus, tminus)));
+    for (size_t j = 0; j < ncoords; j++) {
+      if (i == top) {
+        // Climbing image: full force with the component along the band inverted
+        forces[i][j] = -gradients[i][j] + 2.0 * gtau * tau[j];
+      } else {
+        // Perpendicular true force plus parallel spring force
+        forces[i][j] = -gradients[i][j] + gtau * tau[j] + spring * tau[j];
+      }
+      maxForce = max(maxForce, fabs(forces[i][j]));
+    }
+  }
+
+  return maxForce;
+}
+
+NEBResult OptimizeNEB(ClientPool &pool,
+  const Input &input,
+  vector<Coords> &images,
+  const NEBOptions &options)
+{
+  NEBResult result;
+  int nimages = (int)images.size();
+
+  Input base(input);
+  JobInput &basePB = base.GetMutablePB();
+  basePB.set_run(JobInput::GRADIENT);
+  size_t ncoords = basePB.mol().xyz_size();
+
+  if (nimages < 3) {
+    throw runtime_error("OptimizeNEB: Need at least three images");
+  }
+  for (int i = 0; i < nimages; i++) {
+    if (images[i].size() != ncoords) {
+      throw runtime_error("OptimizeNEB: Image " + to_string(i) +
+        " does not match the number of atoms in the input");
+    }
+  }
+
+  // Work in bohr, like the gradients
+  double toBohr = (basePB.mol().units() == Mol::ANGSTROM ? constants::ANGSTROM_TO_AU : 1.0);
+  vector<Coords> R(images);
+  for (int i = 0; i < nimages; i++) {
+    for (size_t j = 0; j < ncoords; j++) {
+      R[i][j] *= toBohr;
+    }
+  }
+
+  vector<double> energies(nimages, 0.0);
+  vector<Coords> gradients(nimages, Coords(ncoords, 0.0));
+  vector<Coords> forces(nimages, Coords(ncoords, 0.0));
+  vector<Coords> velocity(nimages, Coords(ncoords, 0.0));
+
+  // Endpoints once, before any image starts a CONTINUE chain,
+  // since a NORMAL job frees the global state of the server it lands on
+  vector<int> endpoints;
+  endpoints.push_back(0);
+  endpoints.push_back(nimages - 1);
+  EvaluateImages(pool, base, images, endpoints, -1, JobInput::NORMAL, energies, gradients);
+
+  // CONTINUE is only safe if no two images share a server, which needs sessions
+  // and is confirmed once the first iteration has pinned them
+  vector<int> movable;
+  for (int i = 1; i < nimages - 1; i++) {
+    movable.push_back(i);
+  }
+  bool useContinue = (options.sessionBase >= 0 &&
+      pool.GetNumServers() >= (int)movable.size());
+
+  double dt = options.timeStep;
+  double alpha = 0.1;
+  int npositive = 0;
+
+  try {
+    for (int iter = 0; iter < options.maxIterations; iter++) {
+      JobInput::MDGlobalTreatment mdType = JobInput::NORMAL;
+      if (useContinue) {
+        mdType = (iter == 0 ? JobInput::NEW_CONDITION : JobInput::CONTINUE);
+      }
+      EvaluateImages(pool, base, images, movable, (useContinue ? options.sessionBase : -1),
+        mdType, energies, gradients);
+
+      // Two images on one server would continue from each other's wavefunction
+      if (useContinue && iter == 0 && !OnDistinctServers(pool, options.sessionBase, movable)) {
+        ReleaseSessions(pool, options.sessionBase, movable);
+        useContinue = false;
+      }
+
+      bool climb = (options.climbingImage && iter >= options.climbAfter);
+      result.maxForce = NEBForces(R, energies, gradients, options.springConstant, climb,
+          forces);
+      result.iterations = iter + 1;
+      if (result.maxForce < options.forceTolerance) {
+        result.converged = true;
+        break;
+      } else if (iter + 1 == options.maxIterations) {
+        break;
+      }
+
+      // FIRE: mix the velocity towards the force while going downhill, stop when going uphill
+      double power = 0.0, vnorm = 0.0, fnorm = 0.0;
+      for (int i = 1; i < nimages - 1; i++) {
+        power += Dot(forces[i], velocity[i]);
+        vnorm += Dot(velocity[i], velocity[i]);
+        fnorm += Dot(forces[i], forces[i]);
+      }
+      vnorm = sqrt(vnorm);
+      fnorm = sqrt(fnorm);
+
+      if (power > 0.0) {
+        for (int i = 1; i < nimages - 1; i++) {
+          for (size_t j = 0; j < ncoords; j++) {
+            velocity[i][j] = (1.0 - alpha) * velocity[i][j] +
+              alpha * vnorm * forces[i][j] / fnorm;
+          }
+        }
+        if (++npositive > 5) {
+          dt = min(1.1 * dt, options.maxTimeStep);
+          alpha *= 0.99;
+        }
+      } else {
+        for (int i = 1; i < nimages - 1; i++) {
+          velocity[i].assign(ncoords, 0.0);
+        }
+        dt *= 0.5;
+        alpha = 0.1;
+        npositive = 0;
+      }
+
+      // Euler step, scaled down so that no coordinate moves more than maxStep
+      double maxDisp = 0.0;
+      for (int i = 1; i < nimages - 1; i++) {
+        for (size_t j = 0; j < ncoords; j++) {
+          velocity[i][j] += dt * forces[i][j];
+          maxDisp = max(maxDisp, fabs(dt * velocity[i][j]));
+        }
+      }
+      double scale = (maxDisp > options.maxStep ? options.maxStep / maxDisp : 1.0);
+      for (int i = 1; i < nimages - 1; i++) {
+        for (size_t j = 0; j < ncoords; j++) {
+          R[i][j] += scale * dt * velocity[i][j];
+          images[i][j] = R[i][j] / toBohr;
+        }
+      }
+    }
+  } catch (...) {
+    ReleaseSessions(pool, options.sessionBase, movable);
+    throw;
+  }
+
+  ReleaseSessions(pool, options.sessionBase, movable);
+
+  result.energies = energies;
+  return result;
+}
+
+} // end namespace TCPB
@@ -0,0 +1,98 @@
+/** \file neb.h
+ *  \brief Definition of the nudged elastic band driver
+ */
+
+#ifndef TCPB_NEB_H_
+#define TCPB_NEB_H_
+
+#include <vector>
+
+#include "input.h"
+#include "pool.h"
+
+namespace TCPB {
+
+/**
+ * \brief Settings for OptimizeNEB()
+ *
+ * Forces are in Hartree/bohr and distances in bohr.
+ **/
+struct NEBOptions {
+  double springConstant; //!< Spring constant between neighboring images in Hartree/bohr^2
+  double forceTolerance; //!< Converged once no NEB force component exceeds this
+  int maxIterations;     //!< Iterations before giving up
+  bool climbingImage;    //!< Whether the highest image climbs to the saddle point
+  int climbAfter;        //!< Iterations of plain NEB before the climbing image starts
+  double timeStep;       //!< Initial FIRE time step
+  double maxTimeStep;    //!< Largest FIRE time step
+  double maxStep;        //!< Largest displacement of any coordinate per iteration
+  int sessionBase;       //!< ClientPool session of the first image, images use consecutive sessions (-1: none)
+
+  /**
+   * \brief Constructor for NEBOptions
+   **/
+  NEBOptions(double springConstant = 0.1,
+    double forceTolerance = 1.0e-3,
+    int maxIterations = 200,
+    bool climbingImage = false,
+    int climbAfter = 10,
+    double timeStep = 0.5,
+    double maxTimeStep = 5.0,
+    double maxStep = 0.2,
+    int sessionBase = 0) :
+    springConstant(springConstant),
+    forceTolerance(forceTolerance),
+    maxIterations(maxIterations),
+    climbingImage(climbingImage),
+    climbAfter(climbAfter),
+    timeStep(timeStep),
+    maxTimeStep(maxTimeStep),
+    maxStep(maxStep),
+    sessionBase(sessionBase) {}
+};
+
+/**
+ * \brief Outcome of OptimizeNEB()
+ **/
+struct NEBResult {
+  bool converged;               //!< Whether forceTolerance was reached
+  int iterations;               //!< Iterations run
+  double maxForce;              //!< Largest NEB force component in the last iteration
+  std::vector<double> energies; //!< Energy of every image (endpoints included) in Hartree
+
+  NEBResult() : converged(false), iterations(0), maxForce(0.0) {}
+};
+
+/**
+ * \brief Optimize a nudged elastic band, evaluating all images concurrently
+ *
+ * The endpoints are kept fixed and evaluated once. Every iteration, the gradients of all
+ * movable images are submitted to the pool at the same time, so an iteration takes
+ * as long as the slowest image instead of the sum of all of them.
+ *
+ * With a sessionBase, each image is pinned to its server through a ClientPool session.
+ * If the first iteration lands every movable image on a server of its own, the following
+ * iterations run with CONTINUE and reuse their previous wavefunction; otherwise, or
+ * without sessions, the sessions are released and every job starts fresh (NORMAL).
+ * CONTINUE assumes nobody outside this pool submits to those servers meanwhile.
+ *
+ * The NEB force uses the improved tangent of Henkelman and Jonsson (J. Chem. Phys. 113, 9978),
+ * optionally with a climbing image, and the band is relaxed with FIRE
+ * (Bitzek et al., Phys. Rev. Lett. 97, 170201).
+ *
+ * @param pool ClientPool to run the gradients on
+ * @param input Input with atoms, method and options (run type is overridden to gradient)
+ * @param images Geometries of all images, endpoints included, in the units of input;
+ *               the movable images are updated in place
+ * @param options NEB settings
+ * @return Convergence information and image energies
+ * @throw std::runtime_error if an image gradient fails
+ **/
+NEBResult OptimizeNEB(ClientPool &pool,
+  const Input &input,
+  std::vector<std::vector<double> > &images,
+  const NEBOptions &options = NEBOptions());
+
+} // end namespace TCPB
+
+#endif
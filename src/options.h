@@ -0,0 +1,73 @@
+/** \file options.h
+ *  \brief Definition of ClientOptions struct
+ */
+
+#ifndef TCPB_OPTIONS_H_
+#define TCPB_OPTIONS_H_
+
+namespace TCPB {
+
+/**
+ * \brief Connection options for a TCPB client
+ *
+ * Deadlines are in milliseconds, and 0 disables the corresponding deadline.
+ *
+ * connectTimeout bounds the whole connect (all resolved addresses together).
+ * sendTimeout and recvTimeout bound how long a single send/recv may make no progress,
+ * so a slow but steady transfer of a large payload is never cut off,
+ * while a dead server is detected after one timeout.
+ * jobTimeout bounds how long Client::ComputeJobSync() waits for a submitted job.
+ *
+ * TCP keepalive probes detect a peer that vanished while the connection was idle
+ * (e.g. during a long job). Times are in seconds, and 0 keeps the system default.
+ *
+ * When the connection drops, Client::ComputeJobSync() reconnects up to maxReconnects times per job.
+ * Each reconnect makes up to reconnectAttempts connection attempts,
+ * sleeping reconnectDelay milliseconds before the first retry and doubling the sleep after that.
+ **/
+struct ClientOptions {
+  int connectTimeout;    //!< Milliseconds allowed to establish the connection
+  int sendTimeout;       //!< Milliseconds a send may stall before failing
+  int recvTimeout;       //!< Milliseconds a recv may stall before failing
+  int jobTimeout;        //!< Milliseconds to wait for a submitted job to complete
+  bool keepAlive;        //!< Whether to enable TCP keepalive
+  int keepAliveIdle;     //!< Idle seconds before the first keepalive probe
+  int keepAliveInterval; //!< Seconds between keepalive probes
+  int keepAliveCount;    //!< Unanswered probes before the connection is dropped
+  int maxReconnects;     //!< Reconnects allowed per job (0 disables reconnecting)
+  int reconnectAttempts; //!< Connection attempts per reconnect
+  int reconnectDelay;    //!< Milliseconds before the first connection retry
+
+  /**
+   * \brief Constructor for ClientOptions
+   *
+   * The defaults keep the historical 15 second I/O timeouts,
+   * fail a connect to a dead host after 5 seconds and never give up on a running job.
+   **/
+  ClientOptions(int connectTimeout = 5000,
+    int sendTimeout = 15000,
+    int recvTimeout = 15000,
+    int jobTimeout = 0,
+    bool keepAlive = true,
+    int keepAliveIdle = 60,
+    int keepAliveInterval = 10,
+    int keepAliveCount = 6,
+    int maxReconnects = 3,
+    int reconnectAttempts = 5,
+    int reconnectDelay = 100) :
+    connectTimeout(connectTimeout),
+    sendTimeout(sendTimeout),
+    recvTimeout(recvTimeout),
+    jobTimeout(jobTimeout),
+    keepAlive(keepAlive),
+    keepAliveIdle(keepAliveIdle),
+    keepAliveInterval(keepAliveInterval),
+    keepAliveCount(keepAliveCount),
+    maxReconnects(maxReconnects),
+    reconnectAttempts(reconnectAttempts),
+    reconnectDelay(reconnectDelay) {}
+};
+
+} // end namespace TCPB
+
+#endif
@@ -5,6 +5,8 @@
 #ifndef TCPB_OUTPUT_H_
 #define TCPB_OUTPUT_H_
 
+#include <memory>
+
 #include "terachem_server.pb.h"
 
 namespace TCPB {
@@ -16,20 +18,45 @@ namespace TCPB {
  * Storing directly in protobuf is nice because it serializes and has explicit typing.
  * This class is designed to solidify the TCPB interface with explicit getters
  * and avoid developers needing to learn how to use protobufs.
+ *
+ * The protobuf is immutable and shared between copies of an Output,
+ * so copying or moving an Output never copies the protobuf.
+ * It may live on an arena (see Client::SetUseArena()), which the Output then keeps alive.
  **/
 class Output {
 public:
   /**
    * \brief Constructor for Output class
    *
-   * @param pb JobOutput protobuf to wrap
+   * @param pb JobOutput protobuf to copy
+   **/
+  Output(const terachem_server::JobOutput &pb) :
+    pb_(std::make_shared<terachem_server::JobOutput>(pb)) {}
+
+  /**
+   * \brief Constructor for Output class taking over a protobuf
+   *
+   * @param pb JobOutput protobuf to move from, left empty
    **/
-  Output(terachem_server::JobOutput pb) : pb_(pb) {}
+  Output(terachem_server::JobOutput &&pb) :
+    pb_(std::make_shared<terachem_server::JobOutput>(std::move(pb))) {}
+
+  /**
+   * \brief Constructor for Output class sharing an existing protobuf
+   *
+   * The protobuf must not be changed afterwards, other Outputs may share it.
+   *
+   * @param pb JobOutput protobuf to share, e.g. one on an arena (aliasing the arena's owner)
+   **/
+  Output(std::shared_ptr<const terachem_server::JobOutput> pb) : pb_(std::move(pb)) {}
 
   /**
    * \brief Alternate constructor for Output class
+   *
+   * Refers to the empty default JobOutput, so it does not allocate.
    **/
-  Output() : pb_(terachem_server::JobOutput()) {}
+  Output() : pb_(std::shared_ptr<const terachem_server::JobOutput>(),
+      &terachem_server::JobOutput::default_instance()) {}
 
   /**
    * \brief Gets the energy from a JobOutput Protocol Buffer
@@ -69,7 +96,7 @@ public:
    * @return Reference to internal protobuf object
    **/
   const terachem_server::JobOutput &GetOutputPB() const {
-    return pb_;
+    return *pb_;
   }
 
   /**
@@ -81,7 +108,7 @@ public:
    * @return Debug string of internal protobuf object
    **/
   std::string GetDebugString() const {
-    return pb_.DebugString();
+    return pb_->DebugString();
   }
 
   /**
@@ -94,7 +121,7 @@ public:
   bool IsApproxEqual(const Output &other) const;
 
 private:
-  terachem_server::JobOutput pb_; //!< Internal protobuf for advanced manipulation
+  std::shared_ptr<const terachem_server::JobOutput> pb_; //!< Internal protobuf, shared between copies
 }; // end class Output
 
 } // end namespace TCPB
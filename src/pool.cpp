@@ -0,0 +1,562 @@
+/** \file pool.cpp
+ *  \brief Implementation of ClientPool class
+ */
+
+#include <algorithm>
+using std::max;
+#include <chrono>
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+#include <condition_variable>
+using std::condition_variable;
+#include <exception>
+using std::exception;
+#include <map>
+using std::map;
+#include <memory>
+using std::make_shared;
+using std::shared_ptr;
+#include <mutex>
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+#include <stdexcept>
+using std::invalid_argument;
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+#include "exceptions.h"
+#include "pool.h"
+#include "utils.h"
+
+namespace TCPB {
+
+// Milliseconds before a server that could not be reached is asked for its availability again
+static const int PROBE_BACKOFF = 1000;
+
+// A job sent to more than one server, finished by the first copy to complete
+struct HedgedJob {
+  shared_ptr<JobState> proxy; // State behind the handle returned to the user
+  vector<JobHandle> copies;   // Copies sent to servers, the first one to the primary
+  int primary;                // Server of the first copy
+  int outstanding;            // Copies that have not finished yet
+  int unsettled;              // Copies whose server is not done with them yet
+  bool finished;              // Set once the proxy finished, no more copies are sent then
+  bool won;                   // Set once a copy completed
+  std::function<void()> settled; // Called once no server has a copy any more
+  std::mutex mutex;           // Guards everything above
+
+  HedgedJob() : primary(-1), outstanding(0), unsettled(0), finished(false), won(false) {}
+};
+
+// Count a copy whose server is done with it, the job is settled with its last copy.
+// Copies are only added until the proxy finishes, which happens before its last copy settles.
+static void SettleCopy(const shared_ptr<HedgedJob> &job)
+{
+  bool last;
+  {
+    lock_guard<mutex> lock(job->mutex);
+    job->unsettled--;
+    last = (job->unsettled == 0);
+  }
+
+  if (last && job->settled) {
+    job->settled();
+  }
+}
+
+// Finish the proxy of a hedged job once one of its copies finished.
+// The first copy to complete wins; failures only count once no other copy is left.
+// Returns whether this copy was the winner.
+static bool FinishCopy(const shared_ptr<HedgedJob> &job,
+  const JobHandle &copy)
+{
+  JobState::Status status = copy.GetStatus();
+  bool first = false;
+  bool last;
+
+  {
+    lock_guard<mutex> lock(job->mutex);
+    job->outstanding--;
+    last = (job->outstanding == 0);
+    if (status == JobState::DONE && !job->won) {
+      job->won = true;
+      first = true;
+    }
+  }
+
+  if (first) {
+    FinishJob(job->proxy, JobState::DONE, copy.Get());
+  } else if (last && status == JobState::FAILED) {
+    try {
+      copy.Get();
+    } catch (...) {
+      FinishJob(job->proxy, JobState::FAILED, Output(), std::current_exception());
+    }
+  } else if (last) {
+    FinishJob(job->proxy, JobState::CANCELLED);
+  }
+
+  return first;
+}
+
+ClientPool::ClientPool(const vector<Endpoint> &servers,
+  const ClientOptions &options,
+  const HedgeOptions &hedging) :
+  hedging_(hedging),
+  latencyNext_(0),
+  stopHedge_(false)
+{
+  if (servers.empty()) {
+    throw invalid_argument("ClientPool: No servers given");
+  }
+
+  try {
+    for (size_t i = 0; i < servers.size(); i++) {
+      clients_.push_back(new Client(servers[i].first, servers[i].second, options));
+    }
+  } catch (...) {
+    for (size_t i = 0; i < clients_.size(); i++) {
+      delete clients_[i];
+    }
+    throw;
+  }
+
+  load_.assign(clients_.size(), 0);
+  submitted_.assign(clients_.size(), 0);
+  probeAfter_.assign(clients_.size(), TimePoint());
+  next_ = 0;
+
+  // Hedging needs somewhere else to send the job
+  hedging_.enabled = (hedging_.enabled && clients_.size() > 1);
+  if (hedging_.enabled) {
+    hedgeThread_ = std::thread(&ClientPool::RunHedgeLoop, this);
+  }
+}
+
+ClientPool::~ClientPool()
+{
+  if (hedgeThread_.joinable()) {
+    {
+      lock_guard<mutex> lock(hedgeMutex_);
+      stopHedge_ = true;
+    }
+    hedgeCond_.notify_one();
+    hedgeThread_.join();
+  }
+
+  // Client destructors stop the I/O threads, so no load callbacks run after this.
+  // Hedged jobs finish as cancelled (or failed) along with their copies.
+  for (size_t i = 0; i < clients_.size(); i++) {
+    delete clients_[i];
+  }
+}
+
+JobHandle ClientPool::Submit(const Input &input,
+  int session,
+  std::function<void()> settled)
+{
+  TimePoint start = steady_clock::now();
+  int server = -1;
+
+  if (session < 0 &&
+    input.GetPB().md_global_type() == terachem_server::JobInput::CONTINUE) {
+    throw invalid_argument("ClientPool: CONTINUE jobs need a session to stay on one server");
+  }
+
+  {
+    lock_guard<mutex> lock(mutex_);
+    map<int, int>::const_iterator it = sessions_.find(session);
+    if (session >= 0 && it != sessions_.end()) {
+      server = it->second;
+      load_[server]++;
+    }
+  }
+
+  // Picking a server may take round trips, so it runs without the lock
+  if (server < 0) {
+    server = PickServer();
+  }
+
+  {
+    lock_guard<mutex> lock(mutex_);
+
+    // Another job of the session may have pinned it somewhere else in the meantime
+    if (session >= 0) {
+      map<int, int>::const_iterator it = sessions_.find(session);
+      if (it == sessions_.end()) {
+        sessions_[session] = server;
+      } else if (it->second != server) {
+        load_[server]--;
+        server = it->second;
+        load_[server]++;
+      }
+    }
+
+    submitted_[server]++;
+    stats_.jobs++;
+  }
+
+  // Only jobs that are free to run anywhere are hedged
+  double delay = -1.0;
+  if (hedging_.enabled && session < 0) {
+    delay = GetHedgeDelay();
+  }
+
+  JobHandle handle = (delay >= 0.0 ? SubmitHedged(server, input, delay, settled) :
+      SubmitTo(server, input, settled));
+  handle.Then([this, start](const JobHandle &h) {
+    if (h.GetStatus() == JobState::DONE) {
+      RecordLatency(start);
+    }
+  });
+
+  return handle;
+}
+
+Output ClientPool::ComputeJobSync(const Input &input,
+  int session)
+{
+  return Submit(input, session).Get();
+}
+
+vector<BatchResult> ClientPool::ComputeBatch(const vector<Input> &inputs,
+  BatchCallback callback)
+{
+  vector<BatchResult> results(inputs.size());
+  size_t window = 2 * clients_.size();
+  size_t running = 0;
+  mutex batchMutex;
+  condition_variable batchCond;
+
+  // Record a finished job, and let the feeder loop below submit the next one
+  auto finish = [&](int i) {
+    lock_guard<mutex> lock(batchMutex);
+    if (callback) {
+      callback(i, results[i]);
+    }
+    running--;
+    batchCond.notify_all();
+  };
+
+  for (size_t i = 0; i < inputs.size(); i++) {
+    {
+      unique_lock<mutex> lock(batchMutex);
+      batchCond.wait(lock, [&] { return running < window; });
+      running++;
+    }
+
+    try {
+      JobHandle handle = Submit(inputs[i]);
+      handle.Then([&results, &finish, i](const JobHandle &h) {
+        try {
+          results[i].output = h.Get();
+          results[i].success = true;
+        } catch (const exception &e) {
+          results[i].error = e.what();
+        }
+        finish(i);
+      });
+    } catch (const exception &e) {
+      results[i].error = e.what();
+      finish(i);
+    }
+  }
+
+  // Continuations still use the locals above, so wait for all of them
+  unique_lock<mutex> lock(batchMutex);
+  batchCond.wait(lock, [&] { return running == 0; });
+
+  return results;
+}
+
+void ClientPool::ReleaseSession(int session)
+{
+  lock_guard<mutex> lock(mutex_);
+  sessions_.erase(session);
+}
+
+int ClientPool::GetSessionServer(int session)
+{
+  lock_guard<mutex> lock(mutex_);
+  map<int, int>::const_iterator it = sessions_.find(session);
+  return (it != sessions_.end() ? it->second : -1);
+}
+
+int ClientPool::GetLoad(int server)
+{
+  lock_guard<mutex> lock(mutex_);
+  return load_[server];
+}
+
+int ClientPool::GetSubmitted(int server)
+{
+  lock_guard<mutex> lock(mutex_);
+  return submitted_[server];
+}
+
+PoolStats ClientPool::GetStats()
+{
+  PoolStats stats;
+  vector<double> samples;
+  {
+    lock_guard<mutex> lock(mutex_);
+    stats = stats_;
+    samples = latencies_;
+  }
+
+  stats.hedgeRate = (stats.jobs > 0 ? (double)stats.hedged / stats.jobs : 0.0);
+  stats.p50 = Utils::Percentile(samples, 50.0);
+  stats.p99 = Utils::Percentile(samples, 99.0);
+  return stats;
+}
+
+int ClientPool::PickServer()
+{
+  int n = (int)clients_.size();
+
+  // Among servers with nothing from us, take one that is not busy with someone else's job
+  int best = PickIdleServer(-1);
+
+  lock_guard<mutex> lock(mutex_);
+
+  // Otherwise least jobs in flight, ties broken round-robin.
+  // A server that could not be reached recently only gets jobs if all of them are like that.
+  if (best < 0) {
+    TimePoint now = steady_clock::now();
+    best = next_;
+    for (int k = 1; k < n; k++) {
+      int i = (next_ + k) % n;
+      bool down = (probeAfter_[i] > now);
+      bool bestDown = (probeAfter_[best] > now);
+      if (down != bestDown ? bestDown : load_[i] < load_[best]) {
+        best = i;
+      }
+    }
+    load_[best]++;
+  }
+
+  next_ = (best + 1) % n;
+  return best;
+}
+
+int ClientPool::PickIdleServer(int exclude)
+{
+  vector<int> candidates;
+
+  {
+    lock_guard<mutex> lock(mutex_);
+    candidates = GetIdleCandidates(exclude);
+  }
+
+  for (size_t k = 0; k < candidates.size(); k++) {
+    int server = candidates[k];
+
+    // Reserve the server while it is asked, so no other job is handed to it in between
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (load_[server] != 0) {
+        continue;
+      }
+      load_[server]++;
+    }
+
+    if (ProbeServer(server)) {
+      return server;
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    load_[server]--;
+  }
+
+  return -1;
+}
+
+vector<int> ClientPool::GetIdleCandidates(int exclude)
+{
+  int n = (int)clients_.size();
+  TimePoint now = steady_clock::now();
+  vector<int> candidates;
+
+  for (int k = 0; k < n; k++) {
+    int i = (next_ + k) % n;
+    if (i != exclude && load_[i] == 0 && probeAfter_[i] <= now) {
+      candidates.push_back(i);
+    }
+  }
+
+  return candidates;
+}
+
+bool ClientPool::ProbeServer(int server)
+{
+  try {
+    return clients_[server]->IsAvailable(false);
+  } catch (const ServerCommError &) {
+    // Unreachable for now, the client reconnects once it gets a job
+    lock_guard<mutex> lock(mutex_);
+    probeAfter_[server] = steady_clock::now() + milliseconds(PROBE_BACKOFF);
+    return false;
+  }
+}
+
+JobHandle ClientPool::SubmitTo(int server,
+  const Input &input,
+  std::function<void()> settled)
+{
+  // The load is released once the client is done with the job, which for a cancelled job
+  // is only after its output was drained off the connection
+  return clients_[server]->Submit(input, [this, server, settled]() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      load_[server]--;
+    }
+    if (settled) {
+      settled();
+    }
+  });
+}
+
+void ClientPool::RecordLatency(TimePoint start)
+{
+  double elapsed = duration_cast<microseconds>(steady_clock::now() - start).count() / 1000.0;
+
+  lock_guard<mutex> lock(mutex_);
+  if ((int)latencies_.size() < max(hedging_.window, 1)) {
+    latencies_.push_back(elapsed);
+  } else {
+    latencies_[latencyNext_] = elapsed;
+    latencyNext_ = (latencyNext_ + 1) % latencies_.size();
+  }
+}
+
+double ClientPool::GetHedgeDelay()
+{
+  vector<double> samples;
+  {
+    lock_guard<mutex> lock(mutex_);
+    if ((int)latencies_.size() < hedging_.minSamples) {
+      return -1.0;
+    }
+    samples = latencies_;
+  }
+
+  return max(Utils::Percentile(samples, hedging_.percentile), (double)hedging_.minDelay);
+}
+
+JobHandle ClientPool::SubmitHedged(int server,
+  const Input &input,
+  double delay,
+  std::function<void()> settled)
+{
+  // The proxy keeps the input for the second copy
+  shared_ptr<HedgedJob> job = make_shared<HedgedJob>();
+  job->proxy = make_shared<JobState>(input, false);
+  job->proxy->status = JobState::RUNNING;
+  job->primary = server;
+  job->outstanding = 1;
+  job->unsettled = 1;
+  job->settled = settled;
+
+  JobHandle primary = SubmitTo(server, input, [job]() {
+    SettleCopy(job);
+  });
+  {
+    lock_guard<mutex> lock(job->mutex);
+    job->copies.push_back(primary);
+  }
+  primary.Then([job](const JobHandle &h) {
+    FinishCopy(job, h);
+  });
+
+  // Once the job is decided (or cancelled by the user), abandon the remaining copies
+  JobHandle handle(job->proxy);
+  handle.Then([job](const JobHandle &) {
+    vector<JobHandle> copies;
+    {
+      lock_guard<mutex> lock(job->mutex);
+      job->finished = true;
+      copies = job->copies;
+    }
+    for (size_t i = 0; i < copies.size(); i++) {
+      copies[i].Cancel();
+    }
+  });
+
+  {
+    lock_guard<mutex> lock(hedgeMutex_);
+    hedgeQueue_.insert(std::make_pair(steady_clock::now() +
+        microseconds((long)(delay * 1000.0)), job));
+  }
+  hedgeCond_.notify_one();
+
+  return handle;
+}
+
+void ClientPool::RunHedgeLoop()
+{
+  unique_lock<mutex> lock(hedgeMutex_);
+
+  while (!stopHedge_) {
+    if (hedgeQueue_.empty()) {
+      hedgeCond_.wait(lock);
+      continue;
+    } else if (steady_clock::now() < hedgeQueue_.begin()->first) {
+      hedgeCond_.wait_until(lock, hedgeQueue_.begin()->first);
+      continue;
+    }
+
+    shared_ptr<HedgedJob> job = hedgeQueue_.begin()->second;
+    hedgeQueue_.erase(hedgeQueue_.begin());
+    lock.unlock();
+
+    // Send the second copy, unless the job finished or no server is idle.
+    // Finding an idle server takes round trips, so no lock is held meanwhile.
+    bool finished;
+    {
+      lock_guard<mutex> jobLock(job->mutex);
+      finished = job->finished;
+    }
+    int server = (finished ? -1 : PickIdleServer(job->primary));
+
+    JobHandle backup;
+    if (server >= 0) {
+      lock_guard<mutex> jobLock(job->mutex);
+      if (job->finished) {
+        // Decided while looking, give the server back
+        lock_guard<mutex> poolLock(mutex_);
+        load_[server]--;
+      } else {
+        {
+          lock_guard<mutex> poolLock(mutex_);
+          submitted_[server]++;
+          stats_.hedged++;
+        }
+        backup = SubmitTo(server, job->proxy->input, [job]() {
+          SettleCopy(job);
+        });
+        job->copies.push_back(backup);
+        job->outstanding++;
+        job->unsettled++;
+      }
+    }
+
+    // Continuations may run right away, so they are attached without the job lock
+    if (backup.Valid()) {
+      backup.Then([this, job](const JobHandle &h) {
+        if (FinishCopy(job, h)) {
+          lock_guard<mutex> lock(mutex_);
+          stats_.hedgeWins++;
+        }
+      });
+    }
+
+    lock.lock();
+  }
+}
+
+} // end namespace TCPB
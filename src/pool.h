@@ -0,0 +1,345 @@
+/** \file pool.h
+ *  \brief Definition of ClientPool class
+ */
+
+#ifndef TCPB_POOL_H_
+#define TCPB_POOL_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "client.h"
+
+namespace TCPB {
+
+/**
+ * \brief Result of one job in a ClientPool::ComputeBatch() call
+ **/
+struct BatchResult {
+  bool success;      //!< Whether the job completed
+  Output output;     //!< Output of the job, if successful
+  std::string error; //!< Error message, if not successful
+
+  BatchResult() : success(false) {}
+};
+
+/**
+ * \brief Settings for hedged requests in a ClientPool
+ *
+ * A job that has not finished by the given percentile of recent job latencies
+ * is sent a second time to an idle server, and whichever copy finishes first wins.
+ **/
+struct HedgeOptions {
+  bool enabled;      //!< Whether jobs are hedged at all
+  double percentile; //!< Latency percentile (0-100) after which a job is hedged
+  int minSamples;    //!< Completed jobs needed before hedging starts
+  int minDelay;      //!< Shortest hedge delay in milliseconds
+  int window;        //!< Number of recent job latencies kept
+
+  /**
+   * \brief Constructor for HedgeOptions
+   **/
+  HedgeOptions(bool enabled = false,
+    double percentile = 95.0,
+    int minSamples = 20,
+    int minDelay = 10,
+    int window = 1000) :
+    enabled(enabled),
+    percentile(percentile),
+    minSamples(minSamples),
+    minDelay(minDelay),
+    window(window) {}
+};
+
+/**
+ * \brief Job latency and hedging statistics for a ClientPool
+ **/
+struct PoolStats {
+  int jobs;         //!< Jobs submitted to the pool
+  int hedged;       //!< Jobs that were sent to a second server
+  int hedgeWins;    //!< Hedged jobs where the second copy finished first
+  double hedgeRate; //!< Fraction of jobs that were hedged
+  double p50;       //!< Median latency of recent jobs in milliseconds
+  double p99;       //!< 99th percentile latency of recent jobs in milliseconds
+
+  PoolStats() :
+    jobs(0),
+    hedged(0),
+    hedgeWins(0),
+    hedgeRate(0.0),
+    p50(0.0),
+    p99(0.0) {}
+};
+
+struct HedgedJob;
+
+/**
+ * \brief Pool of TCPB clients, one per server
+ *
+ * ClientPool connects to N TeraChem servers (e.g. one per GPU) and dispatches each job
+ * to the least-loaded one, counting the jobs it has in flight on each server.
+ * Servers with no jobs from this pool are asked with IsAvailable() whether they are really idle,
+ * so a server kept busy by someone else is only used when nothing better is left.
+ * A server is reserved while it is asked, and a connection still in use counts as busy,
+ * so asking never waits for a job to finish.
+ * These round trips happen without holding the pool lock, and a server that could not be reached
+ * is not asked again for a second, so a dead server does not hold up the rest of the pool.
+ *
+ * Jobs that belong to a session are pinned to the server the session first landed on.
+ * This is required for MD trajectories using JobInput::CONTINUE,
+ * because the wavefunction guess and global state live on that one server.
+ *
+ * With hedging enabled (see HedgeOptions), a job without a session that runs longer than
+ * most recent jobs is also sent to an idle server, which cuts the tail latency
+ * caused by a slow or stuck server. The losing copy is cancelled and drained in the background,
+ * and its server gets no new jobs from the pool until it is idle again.
+ **/
+class ClientPool {
+public:
+  typedef std::pair<std::string, int> Endpoint; //!< Server hostname (or "unix:/path") and port
+  typedef std::function<void(int, const BatchResult &)> BatchCallback; //!< Called with job index and result
+
+  /**
+   * \brief Constructor for ClientPool class
+   *
+   * @param servers Hostname and port of each server
+   * @param options Connection options shared by all clients
+   * @param hedging Hedged request settings (default: off)
+   **/
+  ClientPool(const std::vector<Endpoint> &servers,
+    const ClientOptions &options = ClientOptions(),
+    const HedgeOptions &hedging = HedgeOptions());
+
+  /**
+   * \brief Destructor for ClientPool
+   *
+   * Queued jobs are cancelled and running jobs are abandoned.
+   **/
+  ~ClientPool();
+
+  ClientPool(const ClientPool &) = delete;
+  ClientPool &operator=(const ClientPool &) = delete;
+
+  /**
+   * \brief Submit a job to the least-loaded server
+   *
+   * The settled callback (if any) runs once every server the job was sent to is done with it,
+   * which for a cancelled job is only after its output was drained (see Client::Submit()).
+   *
+   * @param input Input with JobInput protocol buffer
+   * @param session Session the job belongs to, or -1 for none.
+   *                All jobs of a session run on the same server.
+   * @param settled Function called once the servers are done with the job
+   * @return JobHandle for the job
+   * @throw std::invalid_argument for a CONTINUE job without a session
+   **/
+  JobHandle Submit(const Input &input,
+    int session = -1,
+    std::function<void()> settled = nullptr);
+
+  /**
+   * \brief Blocking wrapper for Submit()
+   *
+   * @param input Input with JobInput protocol buffer
+   * @param session Session the job belongs to, or -1 for none
+   * @return Output wrapping JobOutput protocol buffer
+   **/
+  Output ComputeJobSync(const Input &input,
+    int session = -1);
+
+  /**
+   * \brief Run a batch of independent jobs across all servers
+   *
+   * Jobs are fed to the servers in order, keeping up to two jobs per server in flight,
+   * so the next job of a server is serialized while it works on the current one
+   * and faster servers pick up more of the batch.
+   * A failing job is recorded in its result and does not stop the rest of the batch.
+   *
+   * The callback (if any) is called once per job as it finishes, in completion order.
+   * Calls are serialized, but they come from the client I/O threads and should be short.
+   *
+   * @param inputs Inputs with JobInput protocol buffers (CONTINUE jobs are not allowed)
+   * @param callback Function called with the job index and result as each job finishes
+   * @return Results in the order of inputs
+   **/
+  std::vector<BatchResult> ComputeBatch(const std::vector<Input> &inputs,
+    BatchCallback callback = nullptr);
+
+  /**
+   * \brief Forget a session's server, so its next job may go anywhere
+   *
+   * @param session Session to release
+   **/
+  void ReleaseSession(int session);
+
+  /**
+   * \brief Get the server a session is pinned to
+   *
+   * @param session Session to look up
+   * @return Server index, or -1 if the session has no jobs yet
+   **/
+  int GetSessionServer(int session);
+
+  /**
+   * \brief Get the number of servers in the pool
+   *
+   * @return Number of servers
+   **/
+  int GetNumServers() const {
+    return (int)clients_.size();
+  }
+
+  /**
+   * \brief Get the number of unfinished jobs this pool has on a server
+   *
+   * @param server Server index
+   * @return Number of queued or running jobs
+   **/
+  int GetLoad(int server);
+
+  /**
+   * \brief Get the total number of jobs this pool sent to a server
+   *
+   * @param server Server index
+   * @return Number of submitted jobs
+   **/
+  int GetSubmitted(int server);
+
+  /**
+   * \brief Get the client for a server, e.g. to look at its statistics
+   *
+   * @param server Server index
+   * @return Client connected to the server
+   **/
+  Client &GetClient(int server) {
+    return *clients_[server];
+  }
+
+  /**
+   * \brief Get job latency and hedging statistics
+   *
+   * @return Statistics since the pool was created (latencies over the recent window)
+   **/
+  PoolStats GetStats();
+
+private:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  std::vector<Client *> clients_; //!< One client per server
+  std::vector<int> load_;         //!< Unfinished jobs per server
+  std::vector<int> submitted_;    //!< Submitted jobs per server
+  std::vector<TimePoint> probeAfter_; //!< Earliest time to ask each server for its availability again
+  std::map<int, int> sessions_;   //!< Server index for each session
+  int next_;                      //!< Server to start the next least-loaded search from
+  std::mutex mutex_;              //!< Guards load_, submitted_, sessions_, next_ and stats
+
+  HedgeOptions hedging_;            //!< Hedged request settings
+  PoolStats stats_;                 //!< Job counts (latencies are filled in by GetStats())
+  std::vector<double> latencies_;   //!< Recent job latencies in milliseconds, as a ring buffer
+  size_t latencyNext_;              //!< Next slot to overwrite in latencies_
+  std::multimap<TimePoint, std::shared_ptr<HedgedJob> > hedgeQueue_; //!< Jobs by hedge deadline
+  std::thread hedgeThread_;         //!< Sends the second copy of jobs past their deadline
+  std::mutex hedgeMutex_;           //!< Guards hedgeQueue_ and stopHedge_
+  std::condition_variable hedgeCond_; //!< Wakes the hedge thread
+  bool stopHedge_;                  //!< Tells the hedge thread to exit
+
+  /**
+   * \brief Pick the least-loaded server, preferring ones that report themselves available
+   *
+   * Must be called without mutex_ held. The load of the picked server is incremented.
+   *
+   * @return Server index
+   **/
+  int PickServer();
+
+  /**
+   * \brief Pick a server with no jobs from this pool that reports itself available
+   *
+   * Must be called without mutex_ held. The load of the picked server is incremented.
+   *
+   * @param exclude Server to skip (the one already running the job)
+   * @return Server index, or -1 if no server is idle
+   **/
+  int PickIdleServer(int exclude);
+
+  /**
+   * \brief Get the servers with no jobs from this pool, in round-robin order
+   *
+   * Must be called with mutex_ held.
+   *
+   * @param exclude Server to skip, or -1
+   * @return Server indices, leaving out servers not to be asked for their availability yet
+   **/
+  std::vector<int> GetIdleCandidates(int exclude);
+
+  /**
+   * \brief Ask a server whether it is available
+   *
+   * Must be called without mutex_ held, it takes a round trip.
+   * The server must be reserved by the caller, and a connection in use counts as unavailable.
+   * A server that cannot be reached is not asked again for a while.
+   *
+   * @param server Server index
+   * @return True if the server reported itself available
+   **/
+  bool ProbeServer(int server);
+
+  /**
+   * \brief Submit one copy of a job to a server, releasing its load once the server is done
+   *
+   * Load and submission counts must already be incremented.
+   *
+   * @param server Server index
+   * @param input Input with JobInput protocol buffer
+   * @param settled Function called once the server is done with the copy
+   * @return JobHandle for the copy
+   **/
+  JobHandle SubmitTo(int server,
+    const Input &input,
+    std::function<void()> settled);
+
+  /**
+   * \brief Record the latency of a finished job
+   *
+   * @param start Time the job was submitted
+   **/
+  void RecordLatency(TimePoint start);
+
+  /**
+   * \brief Get the hedge delay from the recent job latencies
+   *
+   * @return Delay in milliseconds, or -1 if there are not enough samples yet
+   **/
+  double GetHedgeDelay();
+
+  /**
+   * \brief Submit a job with a hedge deadline
+   *
+   * @param server Server for the first copy
+   * @param input Input with JobInput protocol buffer
+   * @param delay Milliseconds after which a second copy is sent
+   * @param settled Function called once the servers are done with all copies
+   * @return JobHandle that finishes with the first copy to complete
+   **/
+  JobHandle SubmitHedged(int server,
+    const Input &input,
+    double delay,
+    std::function<void()> settled);
+
+  /**
+   * \brief Body of the hedge thread: send second copies of jobs past their deadline
+   **/
+  void RunHedgeLoop();
+}; // end class ClientPool
+
+} // end namespace TCPB
+
+#endif
@@ -0,0 +1,204 @@
+/** \file scheduler.cpp
+ *  \brief Implementation of JobScheduler class
+ */
+
+#include <algorithm>
+using std::find;
+using std::max;
+using std::min;
+#include <chrono>
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+#include <deque>
+using std::deque;
+#include <map>
+using std::map;
+#include <stdexcept>
+using std::invalid_argument;
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+#include "scheduler.h"
+#include "utils.h"
+
+namespace TCPB {
+
+JobScheduler::JobScheduler(const SchedulerOptions &options) :
+  options_(options),
+  virtualTime_(0.0),
+  size_(0)
+{
+  if (options_.numClasses < 1) {
+    throw invalid_argument("JobScheduler: Need at least one priority class");
+  }
+
+  // A job costs a tenant 1/weight of virtual time, so weights must be positive (and not NaN)
+  for (map<string, double>::const_iterator it = options_.weights.begin();
+    it != options_.weights.end(); ++it) {
+    if (!(it->second > 0.0)) {
+      throw invalid_argument("JobScheduler: Weight of tenant \"" + it->first + "\" must be positive");
+    }
+  }
+
+  stats_.resize(options_.numClasses);
+  waits_.resize(options_.numClasses);
+  waitNext_.assign(options_.numClasses, 0);
+}
+
+JobScheduler::Tenant &JobScheduler::GetTenant(const string &name)
+{
+  map<string, Tenant>::iterator it = tenants_.find(name);
+  if (it != tenants_.end()) {
+    return it->second;
+  }
+
+  Tenant &tenant = tenants_[name];
+  map<string, double>::const_iterator weight = options_.weights.find(name);
+  tenant.queues.resize(options_.numClasses);
+  tenant.weight = (weight != options_.weights.end() ? weight->second : 1.0);
+  tenant.virtualTime = virtualTime_;
+  tenant.queued = 0;
+  return tenant;
+}
+
+void JobScheduler::Push(const JobPtr &job)
+{
+  Tenant &tenant = GetTenant(job->tenant);
+
+  // No credit for the time a tenant had nothing queued
+  if (tenant.queued == 0) {
+    tenant.virtualTime = max(tenant.virtualTime, virtualTime_);
+  }
+
+  job->priority = min(max(job->priority, 0), options_.numClasses - 1);
+  job->queued = steady_clock::now();
+  tenant.queues[job->priority].push_back(job);
+  tenant.queued++;
+  size_++;
+}
+
+JobScheduler::JobPtr JobScheduler::Pop()
+{
+  steady_clock::time_point now = steady_clock::now();
+  Tenant *best = nullptr;
+  int bestClass = -1;
+  int bestRank = -1;
+
+  for (map<string, Tenant>::iterator it = tenants_.begin(); it != tenants_.end(); ++it) {
+    Tenant &tenant = it->second;
+    if (tenant.queued == 0) {
+      continue;
+    }
+
+    // Only the oldest job of each class can be the next one for this tenant
+    for (int c = 0; c < options_.numClasses; c++) {
+      if (tenant.queues[c].empty()) {
+        continue;
+      }
+
+      const JobPtr &head = tenant.queues[c].front();
+      int rank = c;
+      if (options_.agingInterval > 0) {
+        long waited = duration_cast<microseconds>(now - head->queued).count() / 1000;
+        rank = (int)min((long)options_.numClasses - 1, c + waited / options_.agingInterval);
+      }
+
+      // Highest (aged) class first, then least virtual time, then oldest
+      bool better = (best == nullptr || rank > bestRank);
+      if (!better && rank == bestRank) {
+        if (tenant.virtualTime != best->virtualTime) {
+          better = (tenant.virtualTime < best->virtualTime);
+        } else {
+          better = (head->queued < best->queues[bestClass].front()->queued);
+        }
+      }
+
+      if (better) {
+        best = &tenant;
+        bestClass = c;
+        bestRank = rank;
+      }
+    }
+  }
+
+  if (best == nullptr) {
+    return nullptr;
+  }
+
+  JobPtr job = best->queues[bestClass].front();
+  best->queues[bestClass].pop_front();
+  best->queued--;
+  size_--;
+
+  virtualTime_ = best->virtualTime;
+  best->virtualTime += 1.0 / best->weight;
+
+  // Wait statistics go to the class the job was tagged with
+  double wait = duration_cast<microseconds>(now - job->queued).count() / 1000.0;
+  ClassStats &stats = stats_[job->priority];
+  stats.jobs++;
+  stats.meanWait += (wait - stats.meanWait) / stats.jobs;
+  stats.maxWait = max(stats.maxWait, wait);
+
+  vector<double> &waits = waits_[job->priority];
+  if ((int)waits.size() < max(options_.window, 1)) {
+    waits.push_back(wait);
+  } else {
+    waits[waitNext_[job->priority]] = wait;
+    waitNext_[job->priority] = (waitNext_[job->priority] + 1) % waits.size();
+  }
+
+  return job;
+}
+
+bool JobScheduler::Remove(const JobPtr &job)
+{
+  map<string, Tenant>::iterator it = tenants_.find(job->tenant);
+  if (it == tenants_.end()) {
+    return false;
+  }
+
+  Tenant &tenant = it->second;
+  deque<JobPtr> &queue = tenant.queues[job->priority];
+  deque<JobPtr>::iterator pos = find(queue.begin(), queue.end(), job);
+  if (pos == queue.end()) {
+    return false;
+  }
+
+  queue.erase(pos);
+  tenant.queued--;
+  size_--;
+  return true;
+}
+
+void JobScheduler::SetWeight(const string &tenant,
+  double weight)
+{
+  if (!(weight > 0.0)) {
+    throw invalid_argument("JobScheduler: Tenant weight must be positive");
+  }
+
+  options_.weights[tenant] = weight;
+  map<string, Tenant>::iterator it = tenants_.find(tenant);
+  if (it != tenants_.end()) {
+    it->second.weight = weight;
+  }
+}
+
+vector<ClassStats> JobScheduler::GetWaitStats() const
+{
+  vector<ClassStats> stats(stats_);
+
+  for (size_t c = 0; c < stats.size(); c++) {
+    vector<double> waits(waits_[c]);
+    stats[c].p50 = Utils::Percentile(waits, 50.0);
+    stats[c].p99 = Utils::Percentile(waits, 99.0);
+  }
+
+  return stats;
+}
+
+} // end namespace TCPB
@@ -0,0 +1,172 @@
+/** \file scheduler.h
+ *  \brief Definition of JobScheduler class
+ */
+
+#ifndef TCPB_SCHEDULER_H_
+#define TCPB_SCHEDULER_H_
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace TCPB {
+
+/**
+ * \brief Settings for JobScheduler
+ **/
+struct SchedulerOptions {
+  int numClasses;    //!< Priority classes 0 (lowest) to numClasses-1, higher priorities are clamped
+  int agingInterval; //!< Milliseconds of waiting that raise a job by one class (0: no aging)
+  int window;        //!< Recent waits kept per class for the percentiles
+  std::map<std::string, double> weights; //!< Fair-share weight of each tenant (positive, default 1)
+
+  /**
+   * \brief Constructor for SchedulerOptions
+   **/
+  SchedulerOptions(int numClasses = 3,
+    int agingInterval = 30000,
+    int window = 1000) :
+    numClasses(numClasses),
+    agingInterval(agingInterval),
+    window(window) {}
+};
+
+/**
+ * \brief Queue wait statistics of one priority class
+ **/
+struct ClassStats {
+  long jobs;       //!< Jobs that left the queue
+  double meanWait; //!< Mean wait in milliseconds over all jobs
+  double maxWait;  //!< Longest wait in milliseconds
+  double p50;      //!< Median wait of recent jobs in milliseconds
+  double p99;      //!< 99th percentile wait of recent jobs in milliseconds
+
+  ClassStats() :
+    jobs(0),
+    meanWait(0.0),
+    maxWait(0.0),
+    p50(0.0),
+    p99(0.0) {}
+};
+
+/**
+ * \brief A job as seen by JobScheduler, derived classes add the job itself
+ **/
+struct ScheduledJob {
+  int priority;       //!< Priority class, higher runs first
+  std::string tenant; //!< Fair-share group
+  std::chrono::steady_clock::time_point queued; //!< Set by JobScheduler::Push()
+
+  ScheduledJob(int priority = 0,
+    const std::string &tenant = "") :
+    priority(priority),
+    tenant(tenant) {}
+
+  virtual ~ScheduledJob() {}
+};
+
+/**
+ * \brief Job queue with priority classes, weighted fair share and aging
+ *
+ * Pop() takes the job with the highest class. Within a class, tenants share the servers
+ * by weight: each job a tenant gets costs it 1/weight of virtual time, and the tenant
+ * with the least virtual time goes next. Jobs of one tenant and class leave in FIFO order.
+ * A tenant that was idle starts from the current virtual time, so it cannot save up a burst.
+ *
+ * To keep low classes from starving, a job moves up one class for every agingInterval
+ * it waits, up to the highest class.
+ *
+ * Not thread-safe: the owner must serialize calls.
+ **/
+class JobScheduler {
+public:
+  typedef std::shared_ptr<ScheduledJob> JobPtr;
+
+  /**
+   * \brief Constructor for JobScheduler class
+   *
+   * @param options Scheduling settings
+   **/
+  JobScheduler(const SchedulerOptions &options = SchedulerOptions());
+
+  /**
+   * \brief Queue a job
+   *
+   * @param job Job to queue, its priority is clamped to the valid classes
+   **/
+  void Push(const JobPtr &job);
+
+  /**
+   * \brief Take the next job off the queue and record how long it waited
+   *
+   * @return Next job, or nullptr if the queue is empty
+   **/
+  JobPtr Pop();
+
+  /**
+   * \brief Take a job off the queue without running it (e.g. its client left)
+   *
+   * @param job Job to remove
+   * @return True if the job was queued
+   **/
+  bool Remove(const JobPtr &job);
+
+  /**
+   * \brief Get the number of queued jobs
+   *
+   * @return Queued jobs
+   **/
+  size_t Size() const {
+    return size_;
+  }
+
+  /**
+   * \brief Set the fair-share weight of a tenant
+   *
+   * @param tenant Tenant name
+   * @param weight Relative share of the servers (must be positive)
+   **/
+  void SetWeight(const std::string &tenant,
+    double weight);
+
+  /**
+   * \brief Get the queue wait statistics
+   *
+   * @return Statistics for each priority class, lowest class first
+   **/
+  std::vector<ClassStats> GetWaitStats() const;
+
+private:
+  /**
+   * \brief Queued jobs and fair-share state of a tenant
+   **/
+  struct Tenant {
+    std::vector<std::deque<JobPtr> > queues; //!< FIFO queue per class
+    double weight;                           //!< Fair-share weight
+    double virtualTime;                      //!< Service received, scaled by 1/weight
+    size_t queued;                           //!< Jobs in all queues
+  };
+
+  SchedulerOptions options_;                //!< Scheduling settings
+  std::map<std::string, Tenant> tenants_;   //!< Tenants seen so far
+  double virtualTime_;                      //!< Virtual time of the last job that left
+  size_t size_;                             //!< Jobs in all queues
+  std::vector<ClassStats> stats_;           //!< Wait totals per class (percentiles filled on demand)
+  std::vector<std::vector<double> > waits_; //!< Recent waits per class, as ring buffers
+  std::vector<size_t> waitNext_;            //!< Next slot to overwrite in each of waits_
+
+  /**
+   * \brief Look up a tenant, adding it with the configured weight if new
+   *
+   * @param name Tenant name
+   * @return Tenant state
+   **/
+  Tenant &GetTenant(const std::string &name);
+}; // end class JobScheduler
+
+} // end namespace TCPB
+
+#endif
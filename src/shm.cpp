@@ -0,0 +1,94 @@
+/** \file shm.cpp
+ *  \brief Implementation of SharedMemoryRegion class
+ */
+
+#include <atomic>
+#include <fcntl.h>
+#include <stdexcept>
+using std::out_of_range;
+using std::runtime_error;
+#include <string>
+using std::string;
+using std::to_string;
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm.h"
+
+namespace TCPB {
+
+SharedMemoryRegion::SharedMemoryRegion(size_t size) :
+  size_(size),
+  data_(NULL),
+  owner_(true)
+{
+  static std::atomic<int> counter(0);
+  int fd;
+
+  // Unique per process and per region
+  name_ = "/tcpb-" + to_string(getpid()) + "-" + to_string(counter++);
+
+  fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    throw runtime_error("Could not create shared memory region " + name_);
+  }
+  if (ftruncate(fd, size_) < 0) {
+    close(fd);
+    shm_unlink(name_.c_str());
+    throw runtime_error("Could not size shared memory region " + name_);
+  }
+
+  data_ = (char *)mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    shm_unlink(name_.c_str());
+    throw runtime_error("Could not map shared memory region " + name_);
+  }
+}
+
+SharedMemoryRegion::SharedMemoryRegion(const string &name) :
+  name_(name),
+  size_(0),
+  data_(NULL),
+  owner_(false)
+{
+  struct stat st;
+  int fd;
+
+  fd = shm_open(name_.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    throw runtime_error("Could not open shared memory region " + name_);
+  }
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    throw runtime_error("Could not stat shared memory region " + name_);
+  }
+  size_ = st.st_size;
+
+  data_ = (char *)mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    throw runtime_error("Could not map shared memory region " + name_);
+  }
+}
+
+SharedMemoryRegion::~SharedMemoryRegion()
+{
+  munmap(data_, size_);
+  if (owner_) {
+    shm_unlink(name_.c_str());
+  }
+}
+
+double *SharedMemoryRegion::GetDoubles(uint64_t offset,
+  uint64_t count)
+{
+  if (offset > size_ || count > (size_ - offset) / sizeof(double)) {
+    throw out_of_range("Array does not fit in shared memory region " + name_);
+  }
+
+  return (double *)(data_ + offset);
+}
+
+} // end namespace TCPB
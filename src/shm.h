@@ -0,0 +1,93 @@
+/** \file shm.h
+ *  \brief Definition of SharedMemoryRegion class
+ */
+
+#ifndef TCPB_SHM_H_
+#define TCPB_SHM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace TCPB {
+
+/**
+ * \brief POSIX shared memory region for the same-host TCPB data plane
+ *
+ * Large double arrays (e.g. MM point charge positions, charges and gradients)
+ * can be exchanged through a region mapped by both client and server,
+ * so that the JobInput/JobOutput protocol buffers only carry offsets and sizes
+ * (see the SharedArray message in terachem_server.proto).
+ *
+ * The client creates (and owns) the region, the server opens it by name.
+ **/
+class SharedMemoryRegion {
+public:
+  /**
+   * \brief Constructor that creates a new region
+   *
+   * The region is removed from the system when the creating object is destroyed.
+   *
+   * @param size Size of the region in bytes
+   **/
+  SharedMemoryRegion(size_t size);
+
+  /**
+   * \brief Constructor that maps an existing region
+   *
+   * @param name Name of the region, as given by GetName() on the creating side
+   **/
+  SharedMemoryRegion(const std::string &name);
+
+  /**
+   * \brief Destructor for SharedMemoryRegion
+   *
+   * Unmaps the region, and unlinks it if this object created it.
+   **/
+  ~SharedMemoryRegion();
+
+  // Not copyable, the mapping is owned
+  SharedMemoryRegion(const SharedMemoryRegion &)            = delete;
+  SharedMemoryRegion &operator=(const SharedMemoryRegion &) = delete;
+
+  /**
+   * \brief Accessor for the region name
+   *
+   * @return Name to pass to the other side (e.g. JobInput::shm_name)
+   **/
+  const std::string &GetName() const {
+    return name_;
+  }
+
+  /**
+   * \brief Accessor for the region size
+   *
+   * @return Size of the mapping in bytes
+   **/
+  size_t GetSize() const {
+    return size_;
+  }
+
+  /**
+   * \brief Get a pointer to a double array inside the region
+   *
+   * Throws std::out_of_range if the array does not fit in the region.
+   *
+   * @param offset Byte offset from the start of the region
+   * @param count Number of doubles
+   * @return Pointer to the first element
+   **/
+  double *GetDoubles(uint64_t offset,
+    uint64_t count);
+
+private:
+  std::string name_; //!< Name of the POSIX shared memory object
+  size_t size_;      //!< Size of the mapping in bytes
+  char *data_;       //!< Start of the mapping
+  bool owner_;       //!< Whether to unlink the region in the destructor
+}; // end class SharedMemoryRegion
+
+} // end namespace TCPB
+
+#endif
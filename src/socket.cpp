@@ -4,6 +4,7 @@
 
 #include <algorithm>
 using std::max;
+#include <chrono>
 #include <errno.h>
 #include <mutex>
 using std::lock_guard;
@@ -23,9 +24,15 @@ using std::swap;
 //Socket includes
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <poll.h>
 #include <sys/time.h>
 
 #include "socket.h"
@@ -35,13 +42,14 @@ namespace TCPB {
 Socket::Socket(
   int sfd,
   const string &logName,
-  bool cleanOnDestroy) :
+  bool cleanOnDestroy,
+  int domain) :
   socket_(sfd),
   logFile_(NULL),
   cleanOnDestroy_(cleanOnDestroy)
 {
   if (socket_ == -1) {
-    socket_ = socket(AF_INET, SOCK_STREAM, 0);
+    socket_ = socket(domain, SOCK_STREAM, 0);
   }
 
 #ifdef SOCKETLOGS
@@ -55,6 +63,10 @@ Socket::~Socket()
     shutdown(socket_, SHUT_RDWR);
     close(socket_);
     SocketLog("Successfully closed socket %d", socket_);
+
+    if (!unixPath_.empty()) {
+      unlink(unixPath_.c_str());
+    }
   }
 
 #ifdef SOCKETLOGS
@@ -69,6 +81,7 @@ void Socket::swap(Socket &other) noexcept
   swap(socket_, other.socket_);
   swap(logFile_, other.logFile_);
   swap(cleanOnDestroy_, other.cleanOnDestroy_);
+  swap(unixPath_, other.unixPath_);
 }
 
 Socket::Socket(Socket &&move) noexcept : Socket()
@@ -82,6 +95,19 @@ Socket &Socket::operator=(Socket &&move) noexcept
   return *this;
 }
 
+bool Socket::ParseUnixEndpoint(const string &endpoint,
+  string &path)
+{
+  const string prefix("unix:");
+
+  if (endpoint.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+
+  path = endpoint.substr(prefix.size());
+  return true;
+}
+
 bool Socket::HandleRecv(char *buf,
   int len,
   const char *log) const
@@ -91,7 +117,7 @@ bool Socket::HandleRecv(char *buf,
   // Try to recv
   nrecv = RecvN(buf, len);
   if (nrecv < 0) {
-    if (errno == EINTR || errno == EAGAIN) {
+    if (errno == EINTR) {
       SocketLog("Packet read for %s on socket %d was interrupted, trying again", log,
         socket_);
       nrecv = RecvN(buf, len);
@@ -131,7 +157,7 @@ bool Socket::HandleSend(const char *buf,
   // Try to send
   nsent = SendN(buf, len);
   if (nsent < 0) {
-    if (errno == EINTR || errno == EAGAIN) {
+    if (errno == EINTR) {
       SocketLog("Packet send for %s on socket %d was interrupted, trying again", log,
         socket_);
       nsent = SendN(buf, len);
@@ -153,6 +179,105 @@ bool Socket::HandleSend(const char *buf,
   return true;
 }
 
+bool Socket::HandleSendMessage(int msgType,
+  const char *buf,
+  int len,
+  const char *log) const
+{
+  uint32_t header[2];
+  struct iovec iov[2];
+  struct msghdr msg;
+  int nsent, total;
+
+  header[0] = htonl((uint32_t)msgType);
+  header[1] = htonl((uint32_t)len);
+  total = sizeof(header) + len;
+
+  iov[0].iov_base = (void *)header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = (void *)buf;
+  iov[1].iov_len = len;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = (len > 0 ? 2 : 1);
+
+  // Try to send, msg is advanced past whatever already went out
+  nsent = SendMsgN(&msg);
+  if (nsent < 0) {
+    if (errno == EINTR) {
+      SocketLog("Message send for %s on socket %d was interrupted, trying again", log,
+        socket_);
+      nsent = SendMsgN(&msg);
+    }
+  }
+  if (nsent >= 0) {
+    nsent = total;
+    for (size_t i = 0; i < msg.msg_iovlen; i++) {
+      nsent -= msg.msg_iov[i].iov_len;
+    }
+  }
+
+  if (nsent <= 0) {
+    SocketLog("Could not properly send message for %s on socket %d. Errno: %d (%s)",
+      log, socket_, errno, strerror(errno));
+    return false;
+  } else if (nsent != total) {
+    SocketLog("Only sent %d bytes of %d expected bytes for %s on socket %d", nsent,
+      total, log, socket_);
+    return false;
+  }
+
+  SocketLog("Successfully sent message of %d bytes for %s on socket %d", nsent,
+    log, socket_);
+  return true;
+}
+
+int Socket::TryRecv(char *buf,
+  int len,
+  const char *log) const
+{
+  int nrecv;
+
+  do {
+    nrecv = recv(socket_, buf, len, MSG_DONTWAIT);
+  } while (nrecv < 0 && errno == EINTR);
+
+  if (nrecv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  } else if (nrecv < 0) {
+    SocketLog("Could not properly recv for %s on socket %d. Errno: %d (%s)",
+      log, socket_, errno, strerror(errno));
+    return -1;
+  } else if (nrecv == 0 && len > 0) {
+    SocketLog("Received shutdown signal for %s on socket %d", log, socket_);
+    return -1;
+  }
+
+  return nrecv;
+}
+
+int Socket::TrySend(const char *buf,
+  int len,
+  const char *log) const
+{
+  int nsent;
+
+  do {
+    nsent = send(socket_, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  } while (nsent < 0 && errno == EINTR);
+
+  if (nsent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  } else if (nsent < 0) {
+    SocketLog("Could not properly send for %s on socket %d. Errno: %d (%s)",
+      log, socket_, errno, strerror(errno));
+    return -1;
+  }
+
+  return nsent;
+}
+
 int Socket::RecvN(char *buf,
   int len) const
 {
@@ -160,7 +285,7 @@ int Socket::RecvN(char *buf,
 
   nleft = len;
   while (nleft) {
-    nrecv = recv(socket_, buf, len, 0);
+    nrecv = recv(socket_, buf, nleft, 0);
     if (nrecv < 0) {
       return nrecv;
     } else if (nrecv == 0) {
@@ -181,7 +306,7 @@ int Socket::SendN(const char *buf,
 
   nleft = len;
   while (nleft) {
-    nsent = send(socket_, buf, len, 0);
+    nsent = send(socket_, buf, nleft, 0);
     if (nsent < 0) {
       return nsent;
     } else if (nsent == 0) {
@@ -195,6 +320,39 @@ int Socket::SendN(const char *buf,
   return len - nleft;
 }
 
+int Socket::SendMsgN(struct msghdr *msg) const
+{
+  int nsent, nleft;
+
+  nleft = 0;
+  for (size_t i = 0; i < msg->msg_iovlen; i++) {
+    nleft += msg->msg_iov[i].iov_len;
+  }
+
+  while (nleft) {
+    nsent = sendmsg(socket_, msg, MSG_NOSIGNAL);
+    if (nsent < 0) {
+      return nsent;
+    } else if (nsent == 0) {
+      break;
+    }
+    nleft -= nsent;
+
+    // Skip over whatever went out so the next call picks up where we stopped
+    while (msg->msg_iovlen > 0 && (size_t)nsent >= msg->msg_iov->iov_len) {
+      nsent -= msg->msg_iov->iov_len;
+      msg->msg_iov++;
+      msg->msg_iovlen--;
+    }
+    if (msg->msg_iovlen > 0) {
+      msg->msg_iov->iov_base = (char *)msg->msg_iov->iov_base + nsent;
+      msg->msg_iov->iov_len -= nsent;
+    }
+  }
+
+  return nleft;
+}
+
 void Socket::SocketLog(const char *format, ...) const
 {
 #ifdef SOCKETLOGS
@@ -216,50 +374,263 @@ void Socket::SocketLog(const char *format, ...) const
 #endif
 }
 
+void Socket::BindPort(int port)
+{
+  struct sockaddr_in listenaddr;
+
+  // Set up port reuse
+  int t = 1;
+  if (setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t)) < 0) {
+    SocketLog("Could not set address reuse on socket %d", socket_);
+    throw runtime_error("Could not set address reuse on socket");
+  }
+
+  // Try to bind port
+  memset(&listenaddr, 0, sizeof(listenaddr));
+  listenaddr.sin_family = AF_INET;
+  listenaddr.sin_port = htons((uint16_t)port);
+  listenaddr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(socket_, (struct sockaddr *)&listenaddr, sizeof(listenaddr)) < 0) {
+    SocketLog("Could not bind socket %d for connections on port %d", socket_, port);
+    throw runtime_error("Could not bind socket for connections");
+  }
+
+  SocketLog("Successfully bound port %d with socket %d", port, socket_);
+}
+
+void Socket::BindUnix(const string &path)
+{
+  struct sockaddr_un listenaddr;
+
+  memset(&listenaddr, 0, sizeof(listenaddr));
+  listenaddr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(listenaddr.sun_path)) {
+    SocketLog("Unix domain socket path %s is too long", path.c_str());
+    throw runtime_error("Unix domain socket path is too long");
+  }
+  strncpy(listenaddr.sun_path, path.c_str(), sizeof(listenaddr.sun_path) - 1);
+
+  // A socket file left over from a previous run would make bind() fail
+  unlink(path.c_str());
+  if (bind(socket_, (struct sockaddr *)&listenaddr, sizeof(listenaddr)) < 0) {
+    SocketLog("Could not bind socket %d for connections on %s", socket_, path.c_str());
+    throw runtime_error("Could not bind socket for connections");
+  }
+  unixPath_ = path;
+
+  SocketLog("Successfully bound %s with socket %d", path.c_str(), socket_);
+}
+
+string Socket::PeerName(const struct sockaddr_storage &addr)
+{
+  char name[MAX_STR_LEN];
+
+  if (addr.ss_family == AF_INET) {
+    const struct sockaddr_in *in = (const struct sockaddr_in *)&addr;
+    snprintf(name, MAX_STR_LEN, "host %s, port %d", inet_ntoa(in->sin_addr),
+      ntohs(in->sin_port));
+  } else if (addr.ss_family == AF_INET6) {
+    const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)&addr;
+    char host[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+    snprintf(name, MAX_STR_LEN, "host %s, port %d", host, ntohs(in6->sin6_port));
+  } else {
+    snprintf(name, MAX_STR_LEN, "Unix domain socket");
+  }
+
+  return string(name);
+}
+
 /***************
  * ClientSocket
  ***************/
 
-ClientSocket::ClientSocket(const string &host, int port) :
-  Socket(-1, "client.log", true)
+// Address family for a ClientSocket endpoint, needed before the Socket base is built
+static int EndpointDomain(const string &endpoint)
+{
+  string path;
+  return (Socket::ParseUnixEndpoint(endpoint, path) ? AF_UNIX : AF_INET);
+}
+
+ClientSocket::ClientSocket(const string &host,
+  int port,
+  const ClientOptions &options) :
+  Socket(-1, "client.log", true, EndpointDomain(host))
+{
+  using std::chrono::steady_clock;
+  using std::chrono::duration_cast;
+  using std::chrono::milliseconds;
+
+  struct addrinfo hints, *results, *ai;
+  char service[16];
+  string path;
+  int family, timeout, rc;
+  bool fresh, connected;
+
+  // Co-located server, skip the TCP stack entirely
+  if (ParseUnixEndpoint(host, path)) {
+    struct sockaddr_un unixaddr;
+
+    memset(&unixaddr, 0, sizeof(unixaddr));
+    unixaddr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(unixaddr.sun_path)) {
+      SocketLog("Unix domain socket path %s is too long", path.c_str());
+      throw runtime_error("Unix domain socket path is too long");
+    }
+    strncpy(unixaddr.sun_path, path.c_str(), sizeof(unixaddr.sun_path) - 1);
+
+    if (!ConnectWithTimeout((struct sockaddr *)&unixaddr, sizeof(unixaddr),
+        options.connectTimeout)) {
+      SocketLog("Could not connect to %s on socket %d. Errno: %d (%s)", path.c_str(),
+        socket_, errno, strerror(errno));
+      throw runtime_error("Could not connect");
+    }
+
+    SetTimeouts(options);
+    SocketLog("Successfully connected to %s on socket %d", path.c_str(), socket_);
+    return;
+  }
+
+  // Resolve both IPv4 and IPv6 addresses (getaddrinfo is reentrant, unlike gethostbyname)
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+  snprintf(service, sizeof(service), "%d", port);
+  rc = getaddrinfo(host.c_str(), service, &hints, &results);
+  if (rc != 0) {
+    SocketLog("Could not lookup hostname %s: %s", host.c_str(), gai_strerror(rc));
+    throw runtime_error("Could not lookup hostname");
+  }
+
+  // Try each address in turn, all of them sharing the connect deadline
+  steady_clock::time_point deadline = steady_clock::now() +
+    milliseconds(options.connectTimeout);
+  family = AF_INET;
+  fresh = true;
+  connected = false;
+  for (ai = results; ai != NULL && !connected; ai = ai->ai_next) {
+    timeout = 0;
+    if (options.connectTimeout > 0) {
+      timeout = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+      if (timeout <= 0) {
+        errno = ETIMEDOUT;
+        break;
+      }
+    }
+
+    // A failed connect leaves the socket unusable, so every retry needs a new one
+    if (!fresh || ai->ai_family != family) {
+      close(socket_);
+      socket_ = socket(ai->ai_family, SOCK_STREAM, 0);
+      family = ai->ai_family;
+    }
+    fresh = false;
+
+    connected = ConnectWithTimeout(ai->ai_addr, ai->ai_addrlen, timeout);
+  }
+  freeaddrinfo(results);
+
+  if (!connected) {
+    SocketLog("Could not connect to host %s, port %d on socket %d. Errno: %d (%s)",
+      host.c_str(), port, socket_, errno, strerror(errno));
+    throw runtime_error("Could not connect");
+  }
+
+  // Disable Nagle's algorithm, our messages are small request/reply pairs
+  int t = 1;
+  if (setsockopt(socket_, IPPROTO_TCP, TCP_NODELAY, &t, sizeof(t)) < 0) {
+    SocketLog("Could not set TCP_NODELAY on socket %d", socket_);
+    throw runtime_error("Socket setup failed for TCP_NODELAY");
+  }
+
+  SetKeepAlive(options);
+  SetTimeouts(options);
+
+  SocketLog("Successfully connected to host %s, port %d on socket %d",
+    host.c_str(), port, socket_);
+}
+
+bool ClientSocket::ConnectWithTimeout(const struct sockaddr *addr,
+  socklen_t addrlen,
+  int timeout)
+{
+  struct pollfd pfd;
+  int flags, err, rc;
+  socklen_t errlen;
+
+  // Connect in non-blocking mode so that we can wait on the deadline ourselves
+  flags = fcntl(socket_, F_GETFL, 0);
+  fcntl(socket_, F_SETFL, flags | O_NONBLOCK);
+
+  rc = connect(socket_, addr, addrlen);
+  if (rc < 0 && errno == EINPROGRESS) {
+    pfd.fd = socket_;
+    pfd.events = POLLOUT;
+    do {
+      rc = poll(&pfd, 1, (timeout > 0 ? timeout : -1));
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc == 0) {
+      errno = ETIMEDOUT;
+      rc = -1;
+    } else if (rc > 0) {
+      err = 0;
+      errlen = sizeof(err);
+      getsockopt(socket_, SOL_SOCKET, SO_ERROR, &err, &errlen);
+      errno = err;
+      rc = (err == 0 ? 0 : -1);
+    }
+  }
+
+  err = errno;
+  fcntl(socket_, F_SETFL, flags);
+  errno = err;
+
+  return (rc == 0);
+}
+
+void ClientSocket::SetTimeouts(const ClientOptions &options)
 {
-  struct hostent *serverinfo;
-  struct sockaddr_in serveraddr;
   struct timeval tv;
 
-  // Set timeout to 15 seconds
-  memset(&tv, 0, sizeof(timeval));
-  tv.tv_sec = 15;
+  // A zero timeval disables the timeout
+  tv.tv_sec = options.recvTimeout / 1000;
+  tv.tv_usec = (options.recvTimeout % 1000) * 1000;
   if (setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-    SocketLog("Could not set recv timeout to %d seconds", tv.tv_sec);
+    SocketLog("Could not set recv timeout to %d milliseconds", options.recvTimeout);
     throw runtime_error("Socket timeout setup failed for recv");
   }
+
+  tv.tv_sec = options.sendTimeout / 1000;
+  tv.tv_usec = (options.sendTimeout % 1000) * 1000;
   if (setsockopt(socket_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0) {
-    SocketLog("Could not set send timeout to %d seconds", tv.tv_sec);
+    SocketLog("Could not set send timeout to %d milliseconds", options.sendTimeout);
     throw runtime_error("Socket timeout setup failed for send");
   }
+}
 
-  // Set up connection
-  serverinfo = gethostbyname(host.c_str());
-  if (serverinfo == NULL) {
-    SocketLog("Could not lookup hostname %s", host.c_str());
-    throw runtime_error("Could not lookup hostname");
-  }
-  memset(&serveraddr, 0, sizeof(serveraddr));
-  serveraddr.sin_family = AF_INET;
-  memcpy((char *)&serveraddr.sin_addr.s_addr, (char *)serverinfo->h_addr,
-    serverinfo->h_length);
-  serveraddr.sin_port = htons(port);
+void ClientSocket::SetKeepAlive(const ClientOptions &options)
+{
+  int t = (options.keepAlive ? 1 : 0);
 
-  // Connect
-  if (connect(socket_, (struct sockaddr *)&serveraddr, sizeof(serveraddr)) < 0) {
-    SocketLog("Could not connect to host %s, port %d on socket %d", host.c_str(),
-      port, socket_);
-    throw runtime_error("Could not connect");
+  if (setsockopt(socket_, SOL_SOCKET, SO_KEEPALIVE, &t, sizeof(t)) < 0) {
+    SocketLog("Could not set SO_KEEPALIVE on socket %d", socket_);
+    throw runtime_error("Socket setup failed for SO_KEEPALIVE");
+  }
+  if (!options.keepAlive) {
+    return;
   }
 
-  SocketLog("Successfully connected to host %s, port %d on socket %d",
-    host.c_str(), port, socket_);
+  if ((options.keepAliveIdle > 0 && setsockopt(socket_, IPPROTO_TCP, TCP_KEEPIDLE,
+        &options.keepAliveIdle, sizeof(int)) < 0) ||
+    (options.keepAliveInterval > 0 && setsockopt(socket_, IPPROTO_TCP, TCP_KEEPINTVL,
+        &options.keepAliveInterval, sizeof(int)) < 0) ||
+    (options.keepAliveCount > 0 && setsockopt(socket_, IPPROTO_TCP, TCP_KEEPCNT,
+        &options.keepAliveCount, sizeof(int)) < 0)) {
+    SocketLog("Could not tune keepalive on socket %d", socket_);
+    throw runtime_error("Socket setup failed for keepalive");
+  }
 }
 
 /***************
@@ -267,36 +638,32 @@ ClientSocket::ClientSocket(const string &host, int port) :
  ***************/
 
 SelectServerSocket::SelectServerSocket(int port) :
-  Socket(-1, "server.log", true),
+  Socket(-1, "server.log", true, AF_INET),
   exitFlag_(false),
   selectSleep_(100000)
 {
-  struct sockaddr_in listenaddr;
-
-  // Set up port reuse
-  int t = 1;
-  if (setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t)) < 0) {
-    SocketLog("Could not set address reuse on socket %d", socket_);
-    throw runtime_error("Could not set address reuse on socket");
-  }
+  BindPort(port);
+  StartSelectLoop();
+}
 
-  // Try to bind port
-  listenaddr.sin_family = AF_INET;
-  listenaddr.sin_port = htons((uint16_t)port);
-  listenaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-  if (bind(socket_, (struct sockaddr *)&listenaddr, sizeof(listenaddr)) < 0) {
-    SocketLog("Could not bind socket %d for connections on port %d", socket_, port);
-    throw runtime_error("Could not bind socket for connections");
-  }
+SelectServerSocket::SelectServerSocket(const string &path) :
+  Socket(-1, "server.log", true, AF_UNIX),
+  exitFlag_(false),
+  selectSleep_(100000)
+{
+  BindUnix(path);
+  StartSelectLoop();
+}
 
+void SelectServerSocket::StartSelectLoop()
+{
   // Open port for listening
   if (listen(socket_, 1) < 0) {
     SocketLog("Could not listen for connections on socket %d", socket_);
     throw runtime_error("Could not listen on socket for connections");
   }
 
-  SocketLog("Successfully bound and listening on port %d with socket %d", port,
-    socket_);
+  SocketLog("Successfully listening with socket %d", socket_);
 
   // Set up file descriptor set
   FD_ZERO(&activefds_);
@@ -326,7 +693,7 @@ SelectServerSocket::~SelectServerSocket()
 void SelectServerSocket::RunSelectLoop()
 {
   int newsock; // Socket to listen for connections, and new socket for accepting connections
-  struct sockaddr_in clientaddr; // Address for new active client
+  struct sockaddr_storage clientaddr; // Address for new active client (TCP or Unix domain)
   size_t size; //Used for sizeof(clientaddr) in accept()
   fd_set readfds; // Set of sockets that are reading (local copy of activefds_)
   int maxfd; // Local copy of maxfd_
@@ -362,11 +729,9 @@ void SelectServerSocket::RunSelectLoop()
           size = sizeof(clientaddr);
           newsock = accept(socket_, (struct sockaddr *)&clientaddr, (socklen_t *)&size);
           if (newsock < 0) {
-            SocketLog("Error in accepting connection from host %s, port %d",
-              inet_ntoa(clientaddr.sin_addr), ntohs(clientaddr.sin_port));
+            SocketLog("Error in accepting connection: %d (%s)", errno, strerror(errno));
           } else {
-            SocketLog("Accepting connection from host %s, port %d",
-              inet_ntoa(clientaddr.sin_addr), ntohs(clientaddr.sin_port));
+            SocketLog("Accepting connection from %s", PeerName(clientaddr).c_str());
             FD_SET(newsock,
               &activefds_); //Set as active for next select, but do not read now
             maxfd_ = max(maxfd_, newsock + 1);
@@ -383,4 +748,459 @@ void SelectServerSocket::RunSelectLoop()
   } // end while(!exitFlag_)
 }
 
+/***************
+ * EpollServerSocket
+ ***************/
+
+// Ids stored in the epoll data of the two internal file descriptors
+static const int EPOLL_LISTEN_ID = -1;
+static const int EPOLL_WAKE_ID = -2;
+
+EpollServerSocket::EpollServerSocket(int port,
+  int numWorkers,
+  bool start) :
+  Socket(-1, "server.log", true, AF_INET),
+  epollfd_(-1),
+  eventfd_(-1),
+  nextConnId_(0),
+  exitFlag_(false),
+  maxMessageSize_(DEFAULT_MAX_MESSAGE_SIZE)
+{
+  BindPort(port);
+  if (start) {
+    StartEpollLoop(numWorkers);
+  }
+}
+
+EpollServerSocket::EpollServerSocket(const string &path,
+  int numWorkers,
+  bool start) :
+  Socket(-1, "server.log", true, AF_UNIX),
+  epollfd_(-1),
+  eventfd_(-1),
+  nextConnId_(0),
+  exitFlag_(false),
+  maxMessageSize_(DEFAULT_MAX_MESSAGE_SIZE)
+{
+  BindUnix(path);
+  if (start) {
+    StartEpollLoop(numWorkers);
+  }
+}
+
+void EpollServerSocket::StartEpollLoop(int numWorkers)
+{
+  struct epoll_event ev;
+
+  // Open port for listening, with room for many simultaneous connects
+  if (listen(socket_, SOMAXCONN) < 0) {
+    SocketLog("Could not listen for connections on socket %d", socket_);
+    throw runtime_error("Could not listen on socket for connections");
+  }
+  if (fcntl(socket_, F_SETFL, fcntl(socket_, F_GETFL, 0) | O_NONBLOCK) < 0) {
+    SocketLog("Could not make listening socket %d non-blocking", socket_);
+    throw runtime_error("Could not make listening socket non-blocking");
+  }
+
+  SocketLog("Successfully listening with socket %d", socket_);
+
+  // Set up epoll, watching the listening socket and the wake-up eventfd
+  epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+  eventfd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epollfd_ < 0 || eventfd_ < 0) {
+    SocketLog("Could not create epoll instance: %d (%s)", errno, strerror(errno));
+    throw runtime_error("Could not create epoll instance");
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.fd = EPOLL_LISTEN_ID;
+  if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, socket_, &ev) < 0) {
+    SocketLog("Could not add socket %d to epoll", socket_);
+    throw runtime_error("Could not add listening socket to epoll");
+  }
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.fd = EPOLL_WAKE_ID;
+  if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, eventfd_, &ev) < 0) {
+    SocketLog("Could not add eventfd %d to epoll", eventfd_);
+    throw runtime_error("Could not add eventfd to epoll");
+  }
+
+  // Launch workers and epoll() loop
+  for (int i = 0; i < max(numWorkers, 1); i++) {
+    workers_.push_back(thread(&EpollServerSocket::RunWorker, this));
+  }
+  loopThread_ = thread(&EpollServerSocket::RunEpollLoop, this);
+
+  SocketLog("Successfully launched epoll() loop thread with %d workers",
+    (int)workers_.size());
+}
+
+EpollServerSocket::~EpollServerSocket()
+{
+  Stop();
+}
+
+void EpollServerSocket::Stop()
+{
+  lock_guard<mutex> stopGuard(stopMutex_);
+  if (!loopThread_.joinable()) {
+    return;
+  }
+
+  {
+    lock_guard<mutex> guard(taskMutex_);
+    exitFlag_ = true;
+  }
+  taskCond_.notify_all();
+
+  uint64_t one = 1;
+  if (write(eventfd_, &one, sizeof(one)) < 0) {
+    SocketLog("Could not wake up epoll() loop: %d (%s)", errno, strerror(errno));
+  }
+
+  loopThread_.join();
+  for (size_t i = 0; i < workers_.size(); i++) {
+    workers_[i].join();
+  }
+  workers_.clear();
+
+  // Socket cleanup (no longer need mutex)
+  for (auto it = conns_.begin(); it != conns_.end(); ++it) {
+    shutdown(it->second.fd, SHUT_RDWR);
+    close(it->second.fd);
+  }
+  conns_.clear();
+
+  close(eventfd_);
+  close(epollfd_);
+}
+
+void EpollServerSocket::RunEpollLoop()
+{
+  const int maxEvents = 64;
+  struct epoll_event events[maxEvents];
+  int nevents, id;
+  uint64_t count;
+
+  while ( !exitFlag_ ) {
+    // Block until action on any socket, no timeout needed since shutdown goes through eventfd_
+    nevents = epoll_wait(epollfd_, events, maxEvents, -1);
+    if (nevents < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Nothing left to serve anyone with, but an exception here would take the process down
+      SocketLog("Error in epoll_wait, stopping the epoll() loop: %d (%s)", errno, strerror(errno));
+      return;
+    }
+
+    for (int i = 0; i < nevents; i++) {
+      id = events[i].data.fd;
+
+      if (id == EPOLL_LISTEN_ID) { // New connections
+        AcceptConnections();
+      } else if (id == EPOLL_WAKE_ID) { // Workers finished messages, or shutdown
+        while (read(eventfd_, &count, sizeof(count)) > 0) {}
+        if (exitFlag_) {
+          break;
+        }
+        CompleteTasks();
+      } else { // Activity on a client socket (it may have been closed earlier in this batch)
+        try {
+          if ((events[i].events & EPOLLOUT) && conns_.count(id)) {
+            FlushConnection(id);
+          }
+          if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            && conns_.count(id)) {
+            ReadConnection(id);
+          }
+        } catch (const std::exception &e) {
+          // Only this connection is affected, e.g. it ran the server out of memory
+          SocketLog("Error on connection %d, closing it: %s", id, e.what());
+          CloseConnection(id);
+        }
+      }
+    } // end event for loop
+  } // end while(!exitFlag_)
+}
+
+void EpollServerSocket::RunWorker()
+{
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<mutex> lock(taskMutex_);
+      taskCond_.wait(lock, [this] { return exitFlag_ || !tasks_.empty(); });
+      if (exitFlag_) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    try {
+      task.keepAlive = HandleClientMessage(task.connId, task.request, task.replies);
+    } catch (const std::exception &e) {
+      SocketLog("Error handling message from connection %d: %s", task.connId, e.what());
+      task.replies.clear();
+      task.keepAlive = false;
+    }
+
+    {
+      lock_guard<mutex> guard(taskMutex_);
+      done_.push_back(std::move(task));
+    }
+
+    uint64_t one = 1;
+    if (write(eventfd_, &one, sizeof(one)) < 0) {
+      SocketLog("Could not wake up epoll() loop: %d (%s)", errno, strerror(errno));
+    }
+  }
+}
+
+void EpollServerSocket::AcceptConnections()
+{
+  struct sockaddr_storage clientaddr;
+  socklen_t size;
+  struct epoll_event ev;
+  int newsock, id;
+
+  // Edge-triggered, so accept until the backlog is drained
+  while (true) {
+    size = sizeof(clientaddr);
+    newsock = accept4(socket_, (struct sockaddr *)&clientaddr, &size,
+        SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (newsock < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        SocketLog("Error in accepting connection: %d (%s)", errno, strerror(errno));
+      }
+      break;
+    }
+
+    SocketLog("Accepting connection from %s", PeerName(clientaddr).c_str());
+
+    if (clientaddr.ss_family != AF_UNIX) {
+      int t = 1;
+      setsockopt(newsock, IPPROTO_TCP, TCP_NODELAY, &t, sizeof(t));
+    }
+
+    id = nextConnId_++;
+    try {
+      Connection &conn = conns_[id];
+      conn.fd = newsock;
+      conn.outPos = 0;
+      conn.busy = false;
+      conn.closing = false;
+    } catch (const std::exception &e) {
+      SocketLog("Could not accept connection on socket %d: %s", newsock, e.what());
+      close(newsock);
+      continue;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = id;
+    if (epoll_ctl(epollfd_, EPOLL_CTL_ADD, newsock, &ev) < 0) {
+      SocketLog("Could not add socket %d to epoll", newsock);
+      close(newsock);
+      conns_.erase(id);
+    }
+  }
+}
+
+void EpollServerSocket::ReadConnection(int connId)
+{
+  Connection &conn = conns_[connId];
+  char chunk[65536];
+  ssize_t nrecv;
+  bool peerClosed = false;
+
+  // Edge-triggered, so read until the socket is drained
+  while (true) {
+    nrecv = recv(conn.fd, chunk, sizeof(chunk), 0);
+    if (nrecv > 0 && conn.closing) {
+      // Nothing more gets handled on a closing connection
+      continue;
+    } else if (nrecv > 0) {
+      conn.inBuf.append(chunk, nrecv);
+      // A client pipelining behind a busy connection may not buffer more than one message
+      if (conn.inBuf.size() > 2 * sizeof(uint32_t) + maxMessageSize_) {
+        SocketLog("Connection %d buffered %zu bytes, over the message size limit",
+          connId, conn.inBuf.size());
+        conn.inBuf.clear();
+        peerClosed = true;
+        break;
+      }
+    } else if (nrecv == 0) {
+      SocketLog("Received shutdown signal on socket %d", conn.fd);
+      peerClosed = true;
+      break;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else {
+      SocketLog("Could not properly recv on socket %d. Errno: %d (%s)",
+        conn.fd, errno, strerror(errno));
+      peerClosed = true;
+      break;
+    }
+  }
+
+  if (peerClosed) {
+    if (conn.busy) {
+      // Wait for the worker to be done with this connection before closing
+      conn.closing = true;
+    } else {
+      CloseConnection(connId);
+    }
+    return;
+  }
+
+  DispatchConnection(connId);
+}
+
+bool EpollServerSocket::FlushConnection(int connId)
+{
+  Connection &conn = conns_[connId];
+  ssize_t nsent;
+
+  while (conn.outPos < conn.outBuf.size()) {
+    nsent = send(conn.fd, conn.outBuf.data() + conn.outPos,
+        conn.outBuf.size() - conn.outPos, MSG_NOSIGNAL);
+    if (nsent > 0) {
+      conn.outPos += nsent;
+    } else if (nsent < 0 && errno == EINTR) {
+      continue;
+    } else if (nsent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // Rest goes out on the next EPOLLOUT
+      return true;
+    } else {
+      SocketLog("Could not properly send on socket %d. Errno: %d (%s)",
+        conn.fd, errno, strerror(errno));
+      CloseConnection(connId);
+      return false;
+    }
+  }
+
+  conn.outBuf.clear();
+  conn.outPos = 0;
+
+  if (conn.closing && !conn.busy) {
+    CloseConnection(connId);
+    return false;
+  }
+
+  return true;
+}
+
+void EpollServerSocket::DispatchConnection(int connId)
+{
+  Connection &conn = conns_[connId];
+  uint32_t header[2];
+  size_t msgSize;
+
+  if (conn.busy || conn.closing || conn.inBuf.size() < sizeof(header)) {
+    return;
+  }
+
+  memcpy(header, conn.inBuf.data(), sizeof(header));
+  msgSize = ntohl(header[1]);
+  if (msgSize > maxMessageSize_) {
+    SocketLog("Message of %zu bytes on connection %d exceeds the limit of %zu bytes",
+      msgSize, connId, (size_t)maxMessageSize_);
+    CloseConnection(connId);
+    return;
+  }
+  if (conn.inBuf.size() < sizeof(header) + msgSize) {
+    // Payload still coming, make room for it in one go
+    conn.inBuf.reserve(sizeof(header) + msgSize);
+    return;
+  }
+
+  Task task;
+  task.connId = connId;
+  task.request.type = ntohl(header[0]);
+  task.request.payload.assign(conn.inBuf, sizeof(header), msgSize);
+  task.keepAlive = true;
+  conn.inBuf.erase(0, sizeof(header) + msgSize);
+  conn.busy = true;
+
+  {
+    lock_guard<mutex> guard(taskMutex_);
+    tasks_.push_back(std::move(task));
+  }
+  taskCond_.notify_one();
+}
+
+void EpollServerSocket::CompleteTasks()
+{
+  std::deque<Task> done;
+  uint32_t header[2];
+
+  {
+    lock_guard<mutex> guard(taskMutex_);
+    done.swap(done_);
+  }
+
+  for (size_t i = 0; i < done.size(); i++) {
+    Task &task = done[i];
+    auto it = conns_.find(task.connId);
+    if (it == conns_.end()) {
+      continue;
+    }
+
+    Connection &conn = it->second;
+    conn.busy = false;
+    if (conn.closing) {
+      CloseConnection(task.connId);
+      continue;
+    }
+
+    try {
+      for (size_t j = 0; j < task.replies.size(); j++) {
+        header[0] = htonl((uint32_t)task.replies[j].type);
+        header[1] = htonl((uint32_t)task.replies[j].payload.size());
+        conn.outBuf.append((char *)header, sizeof(header));
+        conn.outBuf.append(task.replies[j].payload);
+      }
+      if (!task.keepAlive) {
+        conn.closing = true;
+      }
+
+      if (FlushConnection(task.connId)) {
+        // Client may have pipelined its next message already
+        DispatchConnection(task.connId);
+      }
+    } catch (const std::exception &e) {
+      SocketLog("Error replying on connection %d, closing it: %s", task.connId, e.what());
+      CloseConnection(task.connId);
+    }
+  }
+}
+
+void EpollServerSocket::CloseConnection(int connId)
+{
+  auto it = conns_.find(connId);
+  if (it == conns_.end()) {
+    return;
+  }
+
+  int fd = it->second.fd;
+  epoll_ctl(epollfd_, EPOLL_CTL_DEL, fd, NULL);
+  shutdown(fd, SHUT_RDWR);
+  close(fd);
+  conns_.erase(it);
+  SocketLog("Closed connection %d on socket %d", connId, fd);
+
+  try {
+    HandleClientDisconnect(connId);
+  } catch (const std::exception &e) {
+    SocketLog("Error handling disconnect of connection %d: %s", connId, e.what());
+  }
+}
+
 } // end namespace TCPB
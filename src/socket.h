@@ -6,13 +6,21 @@
 #define TCPB_SOCKET_H_
 
 #include <sys/time.h> // for fd_set
+#include <sys/socket.h> // for msghdr
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
+
+#include "options.h"
 
 #define MAX_STR_LEN 1024
+#define DEFAULT_MAX_MESSAGE_SIZE (256UL << 20)
 
 namespace TCPB {
 
@@ -31,10 +39,12 @@ public:
    * @param sfd Socket file descriptor (default: -1, which creates new)
    * @param logName Logfile name (default: socket_<fd>.log)
    * @param cleanOnDestroy Whether to close the socket in destructor (default: true)
+   * @param domain Address family used when creating a new socket (default: AF_INET)
    **/
   Socket(int sfd = -1,
     const std::string &logName = "socket.log",
-    bool cleanOnDestroy = true);
+    bool cleanOnDestroy = true,
+    int domain = AF_INET);
 
   /**
    * \brief Destructor for Socket
@@ -68,6 +78,27 @@ public:
     return (socket_ != -1);
   }
 
+  /**
+   * \brief Get the underlying socket file descriptor, e.g. to watch it with poll() or epoll()
+   *
+   * @return Socket file descriptor (-1 if not connected)
+   **/
+  int GetFD() const {
+    return socket_;
+  }
+
+  /**
+   * \brief Check whether an endpoint names a Unix domain socket
+   *
+   * Unix domain socket endpoints are written as "unix:/path/to.sock".
+   *
+   * @param endpoint Hostname or endpoint string
+   * @param path Filled with the socket path if endpoint is a Unix domain socket
+   * @return True if endpoint is a Unix domain socket
+   **/
+  static bool ParseUnixEndpoint(const std::string &endpoint,
+    std::string &path);
+
   /**
    * \brief A high-level socket recv with error checking and clean up for broken connections
    *
@@ -92,10 +123,75 @@ public:
     int len,
     const char *log) const;
 
+  /**
+   * \brief A high-level framed send of a TCPB header and payload
+   *
+   * Builds the 8-byte header (message type and payload size, network byte order)
+   * and pushes it together with the payload in a single sendmsg() call,
+   * so small messages leave in one segment.
+   *
+   * @param msgType Message type to put in the header
+   * @param buf Buffer with the serialized payload (may be NULL if len is 0)
+   * @param len Byte size of the payload
+   * @param log String message to be printed out as part of SocketLog messages (easier debugging)
+   * @return status True if sent full message, False otherwise
+   **/
+  bool HandleSendMessage(int msgType,
+    const char *buf,
+    int len,
+    const char *log) const;
+
+  /**
+   * \brief A non-blocking recv of whatever has arrived, up to len bytes
+   *
+   * @param buf Buffer for incoming bytes
+   * @param len Byte size of buf
+   * @param log String message to be printed out as part of SocketLog messages (easier debugging)
+   * @return Bytes recv'd (0 if nothing has arrived yet), or -1 if the connection is closed or broken
+   **/
+  int TryRecv(char *buf,
+    int len,
+    const char *log) const;
+
+  /**
+   * \brief A non-blocking send of as much as the socket buffer takes, up to len bytes
+   *
+   * @param buf Buffer with outgoing bytes
+   * @param len Byte size of buf
+   * @param log String message to be printed out as part of SocketLog messages (easier debugging)
+   * @return Bytes sent (0 if the socket buffer is full), or -1 if the connection is broken
+   **/
+  int TrySend(const char *buf,
+    int len,
+    const char *log) const;
+
 protected:
   int socket_;          //!< Socket file descriptor
   FILE *logFile_;       //!< Logfile pointer
   bool cleanOnDestroy_; //!< Bool for closing socket in destructor
+  std::string unixPath_; //!< Unix domain socket file to remove in destructor (listeners only)
+
+  /**
+   * \brief Bind the socket to a TCP port on all interfaces, with address reuse
+   *
+   * @param port Port to bind
+   **/
+  void BindPort(int port);
+
+  /**
+   * \brief Bind the socket to a Unix domain socket path, replacing a stale socket file
+   *
+   * @param path Filesystem path of the socket
+   **/
+  void BindUnix(const std::string &path);
+
+  /**
+   * \brief Describe the peer of an accepted connection for SocketLog messages
+   *
+   * @param addr Address filled in by accept()
+   * @return Printable "host X, port Y" or "Unix domain socket" string
+   **/
+  static std::string PeerName(const struct sockaddr_storage &addr);
 
   /**
    * \brief A low-level socket recv wrapper to ensure full packet recv
@@ -117,6 +213,14 @@ protected:
   int SendN(const char *buf,
     int len) const;
 
+  /**
+   * \brief A low-level scatter/gather send wrapper to ensure full message send
+   *
+   * @param msg Message header for sendmsg(), advanced in place past the bytes that were sent
+   * @return nleft Number of bytes left unsent, or negative on error
+   **/
+  int SendMsgN(struct msghdr *msg) const;
+
   /**
    * \brief Verbose logging with timestamps for the client socket into "client.log"
    *
@@ -140,10 +244,43 @@ public:
   /**
    * \brief Constructor for ClientSocket class
    *
-   * @param host Server hostname
-   * @param port Server port number
+   * Hostnames are resolved to IPv4 and IPv6 addresses, which are tried in order
+   * until one connects or options.connectTimeout runs out.
+   *
+   * @param host Server hostname, or "unix:/path/to.sock" for a Unix domain socket
+   * @param port Server port number (ignored for Unix domain sockets)
+   * @param options Connection deadlines and keepalive settings
    **/
-  ClientSocket(const std::string &host, int port);
+  ClientSocket(const std::string &host,
+    int port,
+    const ClientOptions &options = ClientOptions());
+
+protected:
+  /**
+   * \brief Non-blocking connect that gives up after a timeout
+   *
+   * @param addr Address to connect to
+   * @param addrlen Byte size of addr
+   * @param timeout Milliseconds to wait for the connection (0 waits forever)
+   * @return True if connected, False otherwise (with errno set)
+   **/
+  bool ConnectWithTimeout(const struct sockaddr *addr,
+    socklen_t addrlen,
+    int timeout);
+
+  /**
+   * \brief Apply the send and recv timeouts from options
+   *
+   * @param options Connection options
+   **/
+  void SetTimeouts(const ClientOptions &options);
+
+  /**
+   * \brief Apply the TCP keepalive settings from options
+   *
+   * @param options Connection options
+   **/
+  void SetKeepAlive(const ClientOptions &options);
 }; // end class ClientSocket
 
 /**
@@ -158,6 +295,7 @@ public:
  * function, which is called in the select() loop, in order to use this.
  *
  * Note that Server no longer uses this class directly, but it is still used for testing purposes.
+ * New servers should use EpollServerSocket, which does not block all clients on one slow handler.
  **/
 class SelectServerSocket : public Socket {
 public:
@@ -170,6 +308,15 @@ public:
    **/
   SelectServerSocket(int port);
 
+  /**
+   * \brief Constructor for SelectServerSocket class on a Unix domain socket
+   *
+   * Launches select() loop in the background to handle multiple clients
+   *
+   * @param path Filesystem path of the socket to listen on
+   **/
+  SelectServerSocket(const std::string &path);
+
   /**
    * \brief Destructor for SelectServerSocket class
    **/
@@ -191,6 +338,11 @@ protected:
   std::atomic<bool> exitFlag_;    //!< Flag for exiting select() loop
   const int selectSleep_;         //!< Microseconds for select() sleep
 
+  /**
+   * \brief Listen on the bound socket and launch the select() loop
+   **/
+  void StartSelectLoop();
+
   /**
    * \brief Run the select() loop to multiplex the listening socket
    **/
@@ -207,6 +359,216 @@ protected:
   virtual bool HandleClientMessage(int sfd) = 0;
 }; // end class SelectServerSocket
 
+/**
+ * \brief A complete TCPB message: header type plus serialized protobuf payload
+ **/
+struct FramedMessage {
+  int type;            //!< MessageType from the header
+  std::string payload; //!< Serialized protobuf (may be empty)
+
+  FramedMessage(int type = 0,
+    const std::string &payload = "") :
+    type(type),
+    payload(payload) {}
+};
+
+/**
+ * \brief EpollServerSocket class
+ *
+ * Uses the bind() and listen() functions to bind a socket, designed for server usage
+ * Uses an edge-triggered epoll() loop in a background thread to multiplex any number of clients,
+ * with a non-blocking read/write state machine per connection.
+ *
+ * The loop thread only moves bytes: once a full TCPB message (header and payload) has arrived,
+ * it is handed to a small pool of worker threads which call HandleClientMessage().
+ * Each connection has at most one message in flight, so replies keep the request order,
+ * but handlers for different connections run concurrently and must synchronize shared state.
+ *
+ * This is an abstract class: You must inherit this class and implement HandleClientMessage().
+ * Derived classes must call Stop() in their destructor, so no handler runs on a partially destroyed object.
+ **/
+class EpollServerSocket : public Socket {
+public:
+  /**
+   * \brief Constructor for EpollServerSocket class
+   *
+   * Launches the epoll() loop and the worker threads in the background
+   *
+   * @param port Port to listen on
+   * @param numWorkers Number of threads running HandleClientMessage() (default: 4)
+   * @param start False to only bind, for derived classes that must finish constructing
+   *              before the first message; they call StartEpollLoop() themselves
+   **/
+  EpollServerSocket(int port,
+    int numWorkers = 4,
+    bool start = true);
+
+  /**
+   * \brief Constructor for EpollServerSocket class on a Unix domain socket
+   *
+   * Launches the epoll() loop and the worker threads in the background
+   *
+   * @param path Filesystem path of the socket to listen on
+   * @param numWorkers Number of threads running HandleClientMessage() (default: 4)
+   * @param start False to only bind, for derived classes that must finish constructing
+   *              before the first message; they call StartEpollLoop() themselves
+   **/
+  EpollServerSocket(const std::string &path,
+    int numWorkers = 4,
+    bool start = true);
+
+  /**
+   * \brief Destructor for EpollServerSocket class
+   **/
+  virtual ~EpollServerSocket();
+
+  // Rule of 5: Not moveable or copyable due to threading
+  void swap(EpollServerSocket &other)                     =
+    delete; // Helper swap function
+  EpollServerSocket(EpollServerSocket &&move)             =
+    delete; // Move constructor
+  EpollServerSocket &operator=(EpollServerSocket &&move)  =
+    delete; // Move operator
+
+  /**
+   * \brief Stop the epoll() loop and the workers, and close all client connections
+   *
+   * Safe to call more than once.
+   **/
+  void Stop();
+
+  /**
+   * \brief Set the largest message payload a client may send
+   *
+   * A client announcing a bigger message, or buffering more than one message of that size,
+   * is disconnected. Can be changed while the loop runs.
+   *
+   * @param bytes Largest accepted payload in bytes (default: DEFAULT_MAX_MESSAGE_SIZE)
+   **/
+  void SetMaxMessageSize(size_t bytes) {
+    maxMessageSize_ = bytes;
+  }
+
+protected:
+  /**
+   * \brief Per-connection state, only touched by the epoll() loop thread
+   **/
+  struct Connection {
+    int fd;              //!< Client socket file descriptor
+    std::string inBuf;   //!< Bytes received but not yet dispatched
+    std::string outBuf;  //!< Bytes waiting to be sent
+    size_t outPos;       //!< Bytes of outBuf already sent
+    bool busy;           //!< A message is being handled by a worker
+    bool closing;        //!< Close once the in-flight message is answered
+  };
+
+  /**
+   * \brief Message handed from the loop thread to a worker, and the worker's answer
+   **/
+  struct Task {
+    int connId;                         //!< Connection the message came from
+    FramedMessage request;              //!< Incoming message
+    std::vector<FramedMessage> replies; //!< Messages to send back, in order
+    bool keepAlive;                     //!< False to close the connection after replying
+  };
+
+  int epollfd_;                         //!< epoll instance
+  int eventfd_;                         //!< Wakes the loop for handled messages and shutdown
+  int nextConnId_;                      //!< Id for the next accepted connection
+  std::map<int, Connection> conns_;     //!< Active connections by id (loop thread only)
+
+  std::thread loopThread_;              //!< Thread for epoll() loop
+  std::vector<std::thread> workers_;    //!< Threads running HandleClientMessage()
+  std::mutex taskMutex_;                //!< Guards tasks_ and done_
+  std::condition_variable taskCond_;    //!< Signals workers that tasks_ changed
+  std::deque<Task> tasks_;              //!< Messages waiting for a worker
+  std::deque<Task> done_;               //!< Handled messages waiting to be sent back
+  std::atomic<bool> exitFlag_;          //!< Flag for exiting the loop and workers
+  std::atomic<size_t> maxMessageSize_;  //!< Largest accepted message payload in bytes
+  std::mutex stopMutex_;                //!< Serializes Stop() calls
+
+  /**
+   * \brief Listen on the bound socket and launch the epoll() loop and the workers
+   *
+   * @param numWorkers Number of threads running HandleClientMessage()
+   **/
+  void StartEpollLoop(int numWorkers);
+
+  /**
+   * \brief Run the epoll() loop to multiplex the listening socket and the clients
+   **/
+  void RunEpollLoop();
+
+  /**
+   * \brief Run a worker, taking messages from tasks_ until shutdown
+   **/
+  void RunWorker();
+
+  /**
+   * \brief Accept all pending connections on the listening socket
+   **/
+  void AcceptConnections();
+
+  /**
+   * \brief Read everything available on a connection and dispatch a complete message
+   *
+   * @param connId Id of the connection to read from
+   **/
+  void ReadConnection(int connId);
+
+  /**
+   * \brief Send as much of the pending output of a connection as the socket takes
+   *
+   * @param connId Id of the connection to write to
+   * @return False if the connection broke and was closed
+   **/
+  bool FlushConnection(int connId);
+
+  /**
+   * \brief Hand the next complete message of an idle connection to the workers
+   *
+   * @param connId Id of the connection
+   **/
+  void DispatchConnection(int connId);
+
+  /**
+   * \brief Send out the replies of handled messages and resume reading their connections
+   **/
+  void CompleteTasks();
+
+  /**
+   * \brief Close a connection and forget about it
+   *
+   * @param connId Id of the connection to close
+   **/
+  void CloseConnection(int connId);
+
+  /**
+   * \brief Handle processing and replying to a single client message
+   *
+   * This pure virtual function must be implemented in a derived class.
+   * It is called from a worker thread.
+   *
+   * @param connId Id of the connection that sent the message, unique for the lifetime of the server
+   * @param request Complete incoming message
+   * @param replies Messages to send back to the client, in order
+   * @return False to close the connection after the replies are sent
+   **/
+  virtual bool HandleClientMessage(int connId,
+    const FramedMessage &request,
+    std::vector<FramedMessage> &replies) = 0;
+
+  /**
+   * \brief Notification that a client connection was closed
+   *
+   * Called from the epoll() loop thread. Default does nothing.
+   * Exceptions are logged and otherwise ignored.
+   *
+   * @param connId Id of the closed connection
+   **/
+  virtual void HandleClientDisconnect(int connId) {}
+}; // end class EpollServerSocket
+
 } // end namespace TCPB
 
 #endif
@@ -3,10 +3,14 @@
  */
 
 #include <algorithm>
+using std::max;
+using std::min;
+using std::nth_element;
 using std::transform;
 #include <cctype>
 using std::toupper;
 using std::tolower;
+#include <cmath>
 #include <stdio.h> // For printf() debugging
 #include <fstream>
 using std::ifstream;
@@ -193,6 +197,20 @@ string ToLower(const string &str)
   return lower;
 }
 
+double Percentile(vector<double> &samples,
+  double percentile)
+{
+  if (samples.empty()) {
+    return 0.0;
+  }
+
+  size_t n = samples.size();
+  size_t rank = (size_t)ceil(percentile / 100.0 * n);
+  size_t k = min(max(rank, (size_t)1), n) - 1;
+  nth_element(samples.begin(), samples.begin() + k, samples.end());
+  return samples[k];
+}
+
 } // end namespace Utils
 
 } // end namespace TCPB
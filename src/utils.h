@@ -95,6 +95,16 @@ std::string ToUpper(const std::string &str);
  **/
 std::string ToLower(const std::string &str);
 
+/**
+ * \brief Percentile of a set of samples (nearest rank)
+ *
+ * @param samples Samples, reordered in place
+ * @param percentile Percentile between 0 and 100
+ * @return Sample at the percentile, or 0 if there are no samples
+ **/
+double Percentile(std::vector<double> &samples,
+  double percentile);
+
 } // end namespace Utils
 
 } // end namespace TCPB